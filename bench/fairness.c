@@ -0,0 +1,223 @@
+// how the scheduler shares workers between a heavy and a light client. the heavy one
+// keeps D commands in flight the whole time, the light one sends a single command,
+// waits for its DONE, and sends the next. both run for T seconds; the bench reports
+// each client's throughput and the latency of its commands (send to DONE), so the
+// gap between them shows whether the light client waits behind the heavy one's queue.
+//
+//   ./bench/fairness -d 32 -t 10 -H "sleep 0.02" -L "echo x"
+//
+// start the server with one worker (-w 1) to make the queue the bottleneck. a
+// command refused with BUSY is counted apart, and the client waits out the
+// retry-after hint before it sends the next one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include "protocol.h"
+
+#define MAX_SAMPLES 1000000
+
+typedef struct Client {
+    pthread_t tid;
+    const char* name;
+    char line[512];             // the command followed by a newline
+    int depth;                  // commands kept in flight
+    double* sent;               // send time per command, in order (replies come back in order per tag)
+    double* latency;            // send to DONE, per finished command
+    long count;
+    long busy;                  // commands the server refused with BUSY
+    int failed;
+} Client;
+
+static struct sockaddr_in server_addr;
+static double seconds = 10;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* client_main(void* arg) {
+    Client* c = arg;
+    static __thread char payload[1 << 16];
+    size_t line_len = strlen(c->line);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        c->failed = 1;
+        return NULL;
+    }
+
+    // tags count up from 1 per connection, so tag n is the n-th line sent
+    long next_tag = 1;
+    for (int i = 0; i < c->depth; i++) {
+        c->sent[next_tag++] = now_s();
+        write_full(fd, c->line, line_len);
+    }
+
+    double end = now_s() + seconds;
+    int in_flight = c->depth;
+    int deferred = 0;               // refused commands waiting out their retry-after
+    double resume_at = 0;
+    uint32_t retry_after_ms = 0;
+    uint32_t refused_tag = 0;
+    while (in_flight > 0 || deferred > 0) {
+        double now = now_s();
+        if (deferred > 0 && now >= resume_at) {
+            for (; deferred > 0; deferred--) {
+                if (now >= end || next_tag >= MAX_SAMPLES) continue;
+                c->sent[next_tag++] = now;
+                write_full(fd, c->line, line_len);
+                in_flight++;
+            }
+            continue;
+        }
+        if (deferred > 0) {
+            // nothing to read before the retry is due: go back and send
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, (int)((resume_at - now) * 1e3) + 1) == 0) continue;
+        }
+
+        unsigned char raw[FRAME_HEADER_SIZE];
+        FrameHeader header;
+        if (read_full(fd, raw, sizeof(raw)) < 0) {
+            c->failed = 1;
+            break;
+        }
+        frame_decode(raw, &header);
+        uint32_t left = header.length;
+        if (header.type == FRAME_BUSY && left >= sizeof(retry_after_ms)) {
+            if (read_full(fd, &retry_after_ms, sizeof(retry_after_ms)) < 0) {
+                c->failed = 1;
+                break;
+            }
+            retry_after_ms = ntohl(retry_after_ms);
+            left -= sizeof(retry_after_ms);
+            refused_tag = header.tag;
+            c->busy++;
+        }
+        while (left > 0) {
+            uint32_t n = left < sizeof(payload) ? left : sizeof(payload);
+            if (read_full(fd, payload, n) < 0) {
+                c->failed = 1;
+                break;
+            }
+            left -= n;
+        }
+        if (header.type == FRAME_ERROR) c->failed = 1;
+        if (header.type != FRAME_DONE) continue;
+
+        now = now_s();
+        in_flight--;
+        if (header.tag == refused_tag) {
+            // send it again once the hint has passed, without holding up the replies
+            deferred++;
+            resume_at = now + retry_after_ms / 1e3;
+            continue;
+        }
+        if (now < end && header.tag < MAX_SAMPLES) {
+            c->latency[c->count++] = now - c->sent[header.tag];
+        }
+        if (now < end && next_tag < MAX_SAMPLES) {
+            c->sent[next_tag++] = now;
+            write_full(fd, c->line, line_len);
+            in_flight++;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void report(Client* c) {
+    if (c->count == 0) {
+        printf("%-8s %-24s no command finished (%ld busy)\n", c->name, c->line, c->busy);
+        return;
+    }
+    qsort(c->latency, c->count, sizeof(double), compare_double);
+    double sum = 0;
+    for (long i = 0; i < c->count; i++) sum += c->latency[i];
+    c->line[strcspn(c->line, "\n")] = '\0';
+    printf("%-8s %-24s %6d %10.1f %10.2f %10.2f %10.2f %10.2f %8ld\n", c->name, c->line, c->depth,
+           c->count / seconds, sum / c->count * 1e3, c->latency[c->count / 2] * 1e3,
+           c->latency[c->count * 99 / 100] * 1e3, c->latency[c->count - 1] * 1e3, c->busy);
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    const char* heavy_cmd = "sleep 0.02";
+    const char* light_cmd = "echo x";
+    int port = 8081, depth = 32;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:d:t:H:L:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'H': heavy_cmd = optarg; break;
+        case 'L': light_cmd = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-d heavy_depth] [-t seconds] "
+                            "[-H heavy_command] [-L light_command]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (depth <= 0 || seconds <= 0) {
+        fprintf(stderr, "depth and seconds must be positive\n");
+        return 1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad host %s\n", host);
+        return 1;
+    }
+
+    Client clients[2] = {
+        { .name = "heavy", .depth = depth },
+        { .name = "light", .depth = 1 },
+    };
+    snprintf(clients[0].line, sizeof(clients[0].line), "%s\n", heavy_cmd);
+    snprintf(clients[1].line, sizeof(clients[1].line), "%s\n", light_cmd);
+    for (int i = 0; i < 2; i++) {
+        clients[i].sent = calloc(MAX_SAMPLES, sizeof(double));
+        clients[i].latency = calloc(MAX_SAMPLES, sizeof(double));
+        if (!clients[i].sent || !clients[i].latency) {
+            perror("calloc");
+            return 1;
+        }
+        pthread_create(&clients[i].tid, NULL, client_main, &clients[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < 2; i++) {
+        pthread_join(clients[i].tid, NULL);
+        failed |= clients[i].failed;
+    }
+    if (failed) fprintf(stderr, "warning: some commands failed or were rejected\n");
+
+    printf("%-8s %-24s %6s %10s %10s %10s %10s %10s %8s\n", "client", "command", "depth",
+           "cmds/s", "mean ms", "p50 ms", "p99 ms", "max ms", "busy");
+    report(&clients[0]);
+    report(&clients[1]);
+    return 0;
+}
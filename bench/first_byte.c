@@ -0,0 +1,121 @@
+// measures how long a command sent to an idle server waits before its first reply
+// byte comes back. between probes the client pauses for a random gap so every
+// command lands on a scheduler that has gone idle, at a random point of whatever
+// the workers do while idle.
+//
+//   ./bench/first_byte -n 30
+//
+// the default probe "demo 1" answers its first line as soon as a worker picks it up,
+// so no fork/exec time is included. -c runs any other command instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double* sorted, int n, double p) {
+    if (n == 0) return 0;
+    int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+// reads frames until the DONE frame; returns 0, or -1 if the connection broke
+static int wait_done(int fd) {
+    static char payload[1 << 16];
+    while (1) {
+        unsigned char raw[FRAME_HEADER_SIZE];
+        FrameHeader header;
+        if (read_full(fd, raw, sizeof(raw)) < 0) return -1;
+        frame_decode(raw, &header);
+        uint32_t left = header.length;
+        while (left > 0) {
+            uint32_t n = left < sizeof(payload) ? left : sizeof(payload);
+            if (read_full(fd, payload, n) < 0) return -1;
+            left -= n;
+        }
+        if (header.type == FRAME_DONE) return 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    const char* command = "demo 1";
+    int port = 8081, probes = 30, max_gap_ms = 200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:c:g:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': probes = atoi(optarg); break;
+        case 'c': command = optarg; break;
+        case 'g': max_gap_ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-n probes] [-c command] [-g max_gap_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (probes <= 0 || max_gap_ms <= 0) {
+        fprintf(stderr, "probes and gap must be positive\n");
+        return 1;
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    char line[1024];
+    snprintf(line, sizeof(line), "%s\n", command);
+    double* samples = malloc(sizeof(double) * probes);
+    double sum = 0;
+    srand(time(NULL));
+
+    for (int i = 0; i < probes; i++) {
+        usleep((rand() % max_gap_ms + 1) * 1000);
+
+        double start = now_us();
+        char first;
+        if (write_full(fd, line, strlen(line)) < 0 || recv(fd, &first, 1, MSG_PEEK) != 1) {
+            fprintf(stderr, "server went away\n");
+            return 1;
+        }
+        samples[i] = now_us() - start;
+        sum += samples[i];
+        if (wait_done(fd) < 0) {
+            fprintf(stderr, "server went away\n");
+            return 1;
+        }
+    }
+    close(fd);
+
+    qsort(samples, probes, sizeof(double), cmp_double);
+    printf("idle-to-first-byte for \"%s\" over %d probes (us)\n", command, probes);
+    printf("  mean %.0f  p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n", sum / probes,
+           percentile(samples, probes, 50), percentile(samples, probes, 90),
+           percentile(samples, probes, 99), samples[probes - 1]);
+    free(samples);
+    return 0;
+}
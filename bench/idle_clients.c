@@ -0,0 +1,145 @@
+// holds N idle connections open against the server and reports what they cost it:
+// resident memory and thread count before/after, plus how long a fresh client waits
+// to be accepted and served while the idle ones are parked.
+//
+//   ./bench/idle_clients -n 10000 -s $(pidof server)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// "demo 0" is rejected with a usage line straight from the network layer, so it
+// measures accept + read + reply without going through the scheduler
+#define PROBE_COMMAND "demo 0\n"
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double* sorted, int n, double p) {
+    if (n == 0) return 0;
+    int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+// prints VmRSS and Threads from /proc/<pid>/status
+static void print_server_usage(int pid, const char* label) {
+    if (pid <= 0) return;
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror("open server status");
+        return;
+    }
+    printf("%-8s", label);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0 || strncmp(line, "Threads:", 8) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            printf("  %s", line);
+        }
+    }
+    printf("\n");
+    fclose(f);
+}
+
+static int open_client(struct sockaddr_in* addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    int port = 8081, clients = 10000, server_pid = 0, probes = 200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:s:r:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': clients = atoi(optarg); break;
+        case 's': server_pid = atoi(optarg); break;
+        case 'r': probes = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-n idle_clients] [-s server_pid] [-r probes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // we need one descriptor per idle client
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, host, &addr.sin_addr);
+
+    print_server_usage(server_pid, "before");
+
+    int* fds = malloc(sizeof(int) * clients);
+    double* connect_us = malloc(sizeof(double) * clients);
+    int opened = 0;
+    double start = now_us();
+    for (int i = 0; i < clients; i++) {
+        double t0 = now_us();
+        fds[i] = open_client(&addr);
+        if (fds[i] < 0) {
+            perror("connect");
+            break;
+        }
+        connect_us[opened++] = now_us() - t0;
+    }
+    double elapsed = now_us() - start;
+    printf("opened %d idle connections in %.1f ms\n", opened, elapsed / 1000);
+
+    sleep(1);                            // let the server finish accepting the backlog
+    print_server_usage(server_pid, "idle");
+
+    // time a fresh connection until its first reply arrives
+    double* probe_us = malloc(sizeof(double) * probes);
+    int done = 0;
+    char buf[256];
+    for (int i = 0; i < probes; i++) {
+        double t0 = now_us();
+        int fd = open_client(&addr);
+        if (fd < 0) break;
+        if (send(fd, PROBE_COMMAND, strlen(PROBE_COMMAND), 0) > 0 && recv(fd, buf, sizeof(buf), 0) > 0) {
+            probe_us[done++] = now_us() - t0;
+        }
+        close(fd);
+    }
+
+    qsort(connect_us, opened, sizeof(double), cmp_double);
+    qsort(probe_us, done, sizeof(double), cmp_double);
+    printf("connect      (us): p50 %.0f  p99 %.0f  max %.0f\n",
+           percentile(connect_us, opened, 50), percentile(connect_us, opened, 99),
+           opened ? connect_us[opened - 1] : 0);
+    printf("accept+reply (us): p50 %.0f  p99 %.0f  max %.0f  (%d probes)\n",
+           percentile(probe_us, done, 50), percentile(probe_us, done, 99),
+           done ? probe_us[done - 1] : 0, done);
+
+    for (int i = 0; i < opened; i++) close(fds[i]);
+    free(fds);
+    free(connect_us);
+    free(probe_us);
+    return 0;
+}
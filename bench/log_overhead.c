@@ -0,0 +1,127 @@
+// what a log line costs the thread that logs it: printf() against the server's log
+// (log.c), with T threads logging N lines each, a line like the server's [SCHEDULER]
+// line. reports the mean, p99 and max per call. stdout is where the lines go, so
+// redirect it to what the server would write to:
+//
+//   ./bench/log_overhead -t 8 -n 200000 > /tmp/log.txt
+//
+// with -s the log goes into a pipe that nobody reads, as when the terminal or the disk
+// the log goes to stalls. printf would block there for good and is skipped; the log
+// drops lines instead and its callers carry on.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+
+static int lines = 200000;
+static int use_log;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef struct Worker {
+    pthread_t tid;
+    int id;
+    double* cost;               // ns per call
+} Worker;
+
+static void* worker_main(void* arg) {
+    Worker* w = arg;
+    for (int i = 0; i < lines; i++) {
+        double start = now_ns();
+        if (use_log) {
+            log_debug("[SCHEDULER] Worker %d running Task ID %d (Client #%d)... Remaining Time: %d, Round: %d\n",
+                      w->id, i, i % 100, -1, 1);
+        } else {
+            printf("[SCHEDULER] Worker %d running Task ID %d (Client #%d)... Remaining Time: %d, Round: %d\n",
+                   w->id, i, i % 100, -1, 1);
+        }
+        w->cost[i] = now_ns() - start;
+    }
+    return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char* name, Worker* workers, int threads) {
+    double start = now_ns();
+    for (int i = 0; i < threads; i++) pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    for (int i = 0; i < threads; i++) pthread_join(workers[i].tid, NULL);
+    double elapsed = now_ns() - start;
+    if (!use_log) fflush(stdout);
+
+    long total = (long)threads * lines;
+    double* all = malloc(sizeof(double) * total);
+    double sum = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(all + (long)i * lines, workers[i].cost, sizeof(double) * lines);
+    }
+    for (long i = 0; i < total; i++) sum += all[i];
+    qsort(all, total, sizeof(double), compare_double);
+    fprintf(stderr, "%-8s %10.0f %10.0f %10.0f %12.0f %12.0f\n", name, sum / total, all[total * 99 / 100],
+            all[total - 1], total / (elapsed / 1e9), elapsed / 1e6);
+    free(all);
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 8, stall = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:s")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'n': lines = atoi(optarg); break;
+        case 's': stall = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-n lines_per_thread] [-s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads <= 0 || lines <= 0) {
+        fprintf(stderr, "threads and lines must be positive\n");
+        return 1;
+    }
+
+    Worker* workers = calloc(threads, sizeof(Worker));
+    for (int i = 0; i < threads; i++) {
+        workers[i].id = i;
+        workers[i].cost = calloc(lines, sizeof(double));
+        if (!workers[i].cost) {
+            perror("calloc");
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "%-8s %10s %10s %10s %12s %12s\n", "path", "mean ns", "p99 ns", "max ns", "lines/s", "ms");
+    if (!stall) {
+        run("printf", workers, threads);
+    } else {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return 1;
+        }
+        dup2(fds[1], STDOUT_FILENO);     // fds[0] stays open and unread
+    }
+
+    log_init(LOG_LEVEL_DEBUG);
+    use_log = 1;
+    run("log", workers, threads);
+    if (stall) {
+        // the drain thread is stuck in write() by now; report what the callers saw
+        fprintf(stderr, "stdout stalled: the log's callers went on, the lines that did not fit were dropped\n");
+        _exit(0);                        // the atexit flush would block on the full pipe
+    }
+    return 0;
+}
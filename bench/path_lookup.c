@@ -0,0 +1,107 @@
+// what the PATH cache saves per started command. runs a program N times with
+// posix_spawnp (which tries execve in every PATH directory until one works) and N
+// times with posix_spawn on the path pathcache_lookup() returned, and times the
+// lookup itself against a fresh PATH search.
+//
+//   ./bench/path_lookup -n 2000 -c true
+//
+// the gap grows with the number of PATH entries in front of the program's directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "pathcache.h"
+
+extern char **environ;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// spawns and reaps the program n times, returns microseconds per run
+static double spawn_loop(const char* program, int use_path, int n) {
+    char* argv[] = { (char*)program, NULL };
+    posix_spawn_file_actions_t quiet;
+    posix_spawn_file_actions_init(&quiet);
+    posix_spawn_file_actions_addopen(&quiet, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    double start = now_s();
+    for (int i = 0; i < n; i++) {
+        pid_t pid;
+        int rc = use_path ? posix_spawnp(&pid, program, &quiet, NULL, argv, environ)
+                          : posix_spawn(&pid, program, &quiet, NULL, argv, environ);
+        if (rc != 0) {
+            fprintf(stderr, "spawn %s: %s\n", program, strerror(rc));
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    posix_spawn_file_actions_destroy(&quiet);
+    return (now_s() - start) / n * 1e6;
+}
+
+// the uncached search, the way execvp and the cache's miss path walk PATH
+static int search(const char* path_env, const char* name, char* out) {
+    char dirs[8192];
+    snprintf(dirs, sizeof(dirs), "%s", path_env);
+    for (char* dir = strtok(dirs, ":"); dir; dir = strtok(NULL, ":")) {
+        struct stat st;
+        snprintf(out, PATH_MAX, "%s/%s", dir, name);
+        if (stat(out, &st) == 0 && S_ISREG(st.st_mode) && access(out, X_OK) == 0) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* command = "true";
+    int n = 2000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+        switch (opt) {
+        case 'n': n = atoi(optarg); break;
+        case 'c': command = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n runs] [-c command]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* path_env = getenv("PATH");
+    char resolved[PATH_MAX], scratch[PATH_MAX];
+    if (!path_env || !pathcache_lookup(command, path_env, resolved, sizeof(resolved))) {
+        fprintf(stderr, "%s not found on PATH (or PATH has relative entries)\n", command);
+        return 1;
+    }
+    int entries = 1;
+    for (const char* p = path_env; *p; p++) entries += *p == ':';
+    printf("%s -> %s (%d PATH entries)\n\n", command, resolved, entries);
+
+    double start = now_s();
+    for (int i = 0; i < n * 100; i++) search(path_env, command, scratch);
+    double searched = (now_s() - start) / (n * 100) * 1e9;
+    start = now_s();
+    for (int i = 0; i < n * 100; i++) pathcache_lookup(command, path_env, scratch, sizeof(scratch));
+    double cached = (now_s() - start) / (n * 100) * 1e9;
+    printf("%-28s %10.0f ns\n", "lookup, PATH search", searched);
+    printf("%-28s %10.0f ns\n", "lookup, cache hit", cached);
+
+    // alternate the two in rounds so drift on the machine hits both alike
+    double with_search = 0, with_cache = 0;
+    spawn_loop(resolved, 0, n / 10 + 1);                 // warm up
+    for (int round = 0; round < 10; round++) {
+        with_search += spawn_loop(command, 1, n / 10 + 1) / 10;
+        with_cache += spawn_loop(resolved, 0, n / 10 + 1) / 10;
+    }
+    printf("%-28s %10.1f us\n", "spawn+wait, posix_spawnp", with_search);
+    printf("%-28s %10.1f us\n", "spawn+wait, cached path", with_cache);
+    return 0;
+}
@@ -0,0 +1,141 @@
+// times turning a command line into something runnable. "before" repeats what the
+// server used to do per shell command: tokenize on the event loop, tokenize again on
+// the worker, strcmp every token for pipes and redirects, then split and re-scan the
+// argv the way the handle* executors did. "after" is countTokens on the event loop
+// plus plan_build into a recycled arena, which is all that happens now.
+//
+//   ./bench/plan_build -n 1000000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ctype.h>
+#include "parser.h"
+#include "plan.h"
+#include "arena.h"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile int sink;   // keeps the compiler from dropping the work
+
+// parseInput as it was, with isspace()
+static void legacy_parse(char* userInput, char* command[], int* argCount) {
+    *argCount = 0;
+    int inQuote = 0;
+    char* start = userInput;
+    while (*userInput) {
+        if (*userInput == '"') {
+            inQuote = !inQuote;
+        } else if (isspace(*userInput) && !inQuote) {
+            *userInput = '\0';
+            if (*start) command[(*argCount)++] = start;
+            start = userInput + 1;
+        }
+        userInput++;
+    }
+    if (*start) command[(*argCount)++] = start;
+    command[*argCount] = NULL;
+}
+
+static void before(const char* command) {
+    char copy[1024];
+    char* tokens[128];
+    int count;
+
+    // event loop: tokenize to look for "demo N"
+    strcpy(copy, command);
+    legacy_parse(copy, tokens, &count);
+
+    // worker: tokenize again and classify
+    strcpy(copy, command);
+    legacy_parse(copy, tokens, &count);
+    int pipes = 0, redirects = 0;
+    for (int j = 0; j < count; j++) {
+        if (strcmp(tokens[j], "|") == 0) pipes++;
+        if (strcmp(tokens[j], "<") == 0) redirects++;
+        if (strcmp(tokens[j], ">") == 0) redirects++;
+        if (strcmp(tokens[j], "2>") == 0 || strcmp(tokens[j], "2>&1") == 0) redirects++;
+    }
+
+    // executor: split the stages and strip the redirections out of each
+    int start = 0;
+    for (int s = 0; s <= pipes; s++) {
+        int end = start;
+        while (tokens[end] != NULL && strcmp(tokens[end], "|") != 0) end++;
+        char* stage[128];
+        char* clean[128];
+        int n = 0, m = 0;
+        for (int j = start; j < end; j++) stage[n++] = tokens[j];
+        stage[n] = NULL;
+        for (int j = 0; j < n; j++) {
+            if (strcmp(stage[j], "<") == 0 || strcmp(stage[j], ">") == 0 || strcmp(stage[j], "2>") == 0) {
+                j++;
+            } else if (strcmp(stage[j], "2>&1") != 0) {
+                clean[m++] = stage[j];
+            }
+        }
+        clean[m] = NULL;
+        sink += m + (clean[0] != NULL);
+        start = end + 1;
+    }
+    sink += redirects;
+}
+
+static void after(const char* command, Arena* arena) {
+    Plan plan;
+    sink += countTokens(command);
+    arena_reset(arena);
+    if (plan_build(&plan, command, arena) < 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    sink += plan.stage_count;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = strtol(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* commands[] = {
+        "ls -la",
+        "grep -n main src/server.c > matches.txt 2>&1",
+        "cat < access.log | cut -d \" \" -f 1 | sort | uniq -c | sort -rn | head -20 > top.txt 2> err.log",
+        "echo a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16 a17 a18 a19 a20 "
+        "a21 a22 a23 a24 a25 a26 a27 a28 a29 a30 a31 a32 a33 a34 a35 a36 a37 a38 a39 a40",
+    };
+    char space[768];                     // same inline size as a Task's arena
+    Arena arena;
+    arena_init(&arena, space, sizeof(space));
+
+    printf("%-12s %12s %12s\n", "command", "before ns", "after ns");
+    for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++) {
+        double start = now_s();
+        for (long i = 0; i < iterations; i++) before(commands[c]);
+        double t_before = (now_s() - start) / iterations * 1e9;
+
+        start = now_s();
+        for (long i = 0; i < iterations; i++) after(commands[c], &arena);
+        double t_after = (now_s() - start) / iterations * 1e9;
+
+        char label[16];
+        snprintf(label, sizeof(label), "%.10s", commands[c]);
+        printf("%-12s %12.0f %12.0f\n", label, t_before, t_after);
+    }
+    arena_reset(&arena);
+    return 0;
+}
@@ -0,0 +1,127 @@
+// measures what one scheduling decision costs as the run queue grows: pick the next
+// demo task, charge it a quantum and put it back, the way a worker does on preemption.
+// compares the heap-based RunQueue with the old singly linked list (tail walk on
+// enqueue, full scan on dispatch), which is copied below for reference.
+//
+//   ./bench/queue_dispatch -o 200000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "taskqueue.h"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the list the scheduler used before
+static void list_push(Task** head, Task* task) {
+    task->next = NULL;
+    if (*head == NULL) {
+        *head = task;
+        return;
+    }
+    Task* temp = *head;
+    while (temp->next != NULL) temp = temp->next;
+    temp->next = task;
+}
+
+static Task* list_take_best(Task** head) {
+    if (*head == NULL) return NULL;
+    Task* selected = *head;
+    Task* selected_prev = NULL;
+    Task* prev = NULL;
+    for (Task* curr = *head; curr; prev = curr, curr = curr->next) {
+        if ((!curr->is_shell && !selected->is_shell && curr->remaining_time < selected->remaining_time) ||
+            (curr->is_shell && !selected->is_shell)) {
+            selected = curr;
+            selected_prev = prev;
+        }
+    }
+    if (selected_prev == NULL) {
+        *head = selected->next;
+    } else {
+        selected_prev->next = selected->next;
+    }
+    selected->next = NULL;
+    return selected;
+}
+
+static Task* make_tasks(int n) {
+    Task* tasks = calloc(n, sizeof(Task));
+    if (!tasks) {
+        perror("calloc");
+        exit(1);
+    }
+    srand(42);
+    for (int i = 0; i < n; i++) {
+        tasks[i].task_id = i + 1;
+        tasks[i].remaining_time = 1000000 + rand() % 1000000;   // never runs out during the bench
+    }
+    return tasks;
+}
+
+// nanoseconds per dispatch + requeue with n tasks queued
+static double run_list(int n, int ops) {
+    Task* tasks = make_tasks(n);
+    for (int i = 0; i + 1 < n; i++) tasks[i].next = &tasks[i + 1];   // same order as n pushes
+    Task* head = &tasks[0];
+
+    double start = now_s();
+    for (int i = 0; i < ops; i++) {
+        Task* t = list_take_best(&head);
+        t->remaining_time += 7;
+        list_push(&head, t);
+    }
+    double elapsed = now_s() - start;
+    free(tasks);
+    return elapsed / ops * 1e9;
+}
+
+static double run_heap(int n, int ops) {
+    Task* tasks = make_tasks(n);
+    RunQueue queue;
+    runqueue_init(&queue);
+    for (int i = 0; i < n; i++) runqueue_push(&queue, &tasks[i]);
+
+    double start = now_s();
+    for (int i = 0; i < ops; i++) {
+        Task* t = runqueue_pop(&queue);
+        t->remaining_time += 7;
+        runqueue_charge(&queue, t, 7000000000LL);
+        runqueue_push(&queue, t);
+    }
+    double elapsed = now_s() - start;
+    Task* t;
+    while ((t = runqueue_pop(&queue)) != NULL) runqueue_charge(&queue, t, 0);   // frees the flow
+    free(tasks);
+    return elapsed / ops * 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    long ops = 200000;         // dispatches per size for the heap
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o': ops = strtol(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "Usage: %s [-o heap_ops]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const int sizes[] = { 100, 1000, 10000, 100000 };
+    printf("%8s %14s %14s\n", "queued", "list ns/op", "heap ns/op");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int n = sizes[i];
+        long list_ops = 20000000L / n;           // the list walks ~2n tasks per op, keep it bounded
+        if (list_ops > ops) list_ops = ops;
+        printf("%8d %14.0f %14.0f\n", n, run_list(n, (int)list_ops), run_heap(n, (int)ops));
+    }
+    return 0;
+}
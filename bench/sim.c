@@ -0,0 +1,773 @@
+// replays a workload of demo and shell tasks against a virtual clock, once per
+// scheduling policy, and reports what each did to it. "current" is the server's own:
+// the run queue of taskqueue.c (shell first, clients by DRR, demos by SRTF) with the
+// quanta and preemption rules of policy.h, the same code the workers run. the others
+// (MLFQ, plain DRR over clients, EDF) exist here only, to compare against. a run of a
+// few thousand tasks, hours of server time, takes milliseconds.
+//
+//   ./bench/sim -n 5000 -c 8 -u 0.9          synthetic: N tasks from C clients at load U
+//   ./bench/sim -i workload.csv              a workload file (see below)
+//   ./bench/sim -i stats.csv                 the server's stats log (-S), as it ran
+//   ./bench/sim -o workload.csv              also writes the synthetic workload out
+//   ./bench/sim -p current,edf               only those policies
+//
+// a workload file has one task per line, arrival,client,kind,burst[,deadline], times
+// in seconds from the start and kind "shell" or "demo"; a first line starting with
+// "arrival" is skipped. demo bursts are whole seconds, like ./demo N.
+//
+// the simulated machine is one worker: what each worker does with its own queue,
+// without the stealing between them. demo tasks run in one second ticks and only
+// stop at a tick, under every policy; shell tasks stop anywhere. a task's deadline,
+// unless the file gives one, is its arrival plus -d times its burst, at least a
+// second. the report, per policy:
+//   thru/s     tasks finished per second of virtual time
+//   turnaround arrival to finish, mean and p99, and p99 of the shell tasks alone
+//   wait       time spent queued, mean
+//   missed     tasks that finished after their deadline
+//   fairness   Jain's index of the clients' mean slowdown (turnaround / burst): 1
+//              when every client's tasks are slowed down alike, 1/clients at worst
+//
+// quanta other than the server's can be tried at build time:
+//   make sim SIM_FLAGS="-DFIRST_ROUND_QUANTUM=1 -DNEXT_ROUND_QUANTUM=4"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include "taskqueue.h"
+#include "policy.h"
+
+#define NS 1000000000LL
+#define TICK NS                     // a demo iteration
+#define LINE_SIZE 1024
+
+// a task of the workload, with what happened to it under the policy being run
+typedef struct Job {
+    int id;                 // index in the workload, by arrival
+    int client;             // 0 .. clients - 1
+    int shell;
+    int64_t arrival;        // ns, virtual time
+    int64_t burst;          // ns of run time it needs
+    int64_t deadline;       // ns, absolute
+
+    int64_t remaining;
+    int64_t queued_at;
+    int64_t waited;
+    int64_t finish;
+    int rounds;
+
+    // the policies' own
+    Task* task;             // current: the server's task, while queued or running
+    struct Job* next;       // FIFO links
+    int level;              // MLFQ
+    int64_t used;           // MLFQ: run time at this level
+    int heap_index;         // EDF
+} Job;
+
+// a scheduling policy as the simulator drives it. one runs at a time, so they keep
+// their state in statics
+typedef struct Policy {
+    const char* name;
+    void (*init)(int clients);
+    void (*push)(Job* job);
+    Job* (*pop)(int64_t now);                       // NULL when nothing is queued
+    int64_t (*slice)(const Job* job);               // ns it may run this round
+    // called after each arrival while job runs: how far into its round it makes way
+    // for what is queued now, in ns (at least ran), or -1 to keep going
+    int64_t (*preempt)(const Job* job, int64_t ran);
+    void (*charge)(Job* job, int64_t ran);          // after the round, job->remaining updated
+} Policy;
+
+static Job* jobs;
+static int job_count;
+static int client_count;
+
+// --- current: the server's run queue and policy.h ---
+
+static RunQueue current_queue;
+
+static void current_init(int clients) {
+    (void)clients;
+    runqueue_init(&current_queue);
+}
+
+static void current_push(Job* job) {
+    if (!job->task) {
+        job->task = calloc(1, sizeof(Task));
+        if (!job->task) {
+            perror("calloc");
+            exit(1);
+        }
+        job->task->task_id = job->id;
+        job->task->client_id = job->client;
+        job->task->is_shell = job->shell;
+        job->task->burst_time = job->shell ? 0 : job->burst / TICK;
+        job->task->heap_index = -1;
+    }
+    job->task->remaining_time = job->shell ? 0 : (job->remaining + TICK - 1) / TICK;
+    job->task->round_count = job->rounds;
+    if (runqueue_push(&current_queue, job->task) < 0) {
+        perror("runqueue_push");
+        exit(1);
+    }
+}
+
+static Job* current_pop(int64_t now) {
+    (void)now;
+    Task* task = runqueue_pop(&current_queue);
+    return task ? &jobs[task->task_id] : NULL;
+}
+
+static int64_t current_slice(const Job* job) {
+    return policy_round_time(job->task) * NS;
+}
+
+static int64_t current_preempt(const Job* job, int64_t ran) {
+    if (!policy_preempts(&current_queue, job->task)) return -1;
+    int64_t min_slice = SHELL_MIN_SLICE_MS * 1000000LL;
+    return job->shell && ran < min_slice ? min_slice : ran;
+}
+
+static void current_charge(Job* job, int64_t ran) {
+    runqueue_charge(&current_queue, job->task, ran);
+    if (job->remaining <= 0) {
+        free(job->task);
+        job->task = NULL;
+    }
+}
+
+// --- FIFO lists for the others ---
+
+typedef struct JobList {
+    Job* head;
+    Job* tail;
+} JobList;
+
+static void list_append(JobList* list, Job* job) {
+    job->next = NULL;
+    if (list->tail) list->tail->next = job; else list->head = job;
+    list->tail = job;
+}
+
+static Job* list_take(JobList* list) {
+    Job* job = list->head;
+    if (!job) return NULL;
+    list->head = job->next;
+    if (!list->head) list->tail = NULL;
+    job->next = NULL;
+    return job;
+}
+
+// --- MLFQ: three levels, a task that uses up its level's quantum moves down, every
+// task goes back to the top every MLFQ_BOOST. a higher level preempts a lower one ---
+
+#define MLFQ_LEVELS 3
+#define MLFQ_BOOST (10 * NS)
+
+static const int64_t mlfq_quanta[MLFQ_LEVELS] = { NS / 5, NS, 5 * NS };
+static JobList mlfq_levels[MLFQ_LEVELS];
+static int64_t mlfq_boosted;
+
+static void mlfq_init(int clients) {
+    (void)clients;
+    memset(mlfq_levels, 0, sizeof(mlfq_levels));
+    mlfq_boosted = 0;
+}
+
+static void mlfq_push(Job* job) {
+    if (job->rounds == 0) {
+        job->level = 0;
+        job->used = 0;
+    }
+    list_append(&mlfq_levels[job->level], job);
+}
+
+static Job* mlfq_pop(int64_t now) {
+    if (now - mlfq_boosted >= MLFQ_BOOST) {
+        mlfq_boosted = now;
+        for (int level = 1; level < MLFQ_LEVELS; level++) {
+            Job* job;
+            while ((job = list_take(&mlfq_levels[level]))) {
+                job->level = 0;
+                job->used = 0;
+                list_append(&mlfq_levels[0], job);
+            }
+        }
+    }
+    for (int level = 0; level < MLFQ_LEVELS; level++) {
+        Job* job = list_take(&mlfq_levels[level]);
+        if (job) return job;
+    }
+    return NULL;
+}
+
+static int64_t mlfq_slice(const Job* job) {
+    return mlfq_quanta[job->level] - job->used;
+}
+
+static int64_t mlfq_preempt(const Job* job, int64_t ran) {
+    for (int level = 0; level < job->level; level++) {
+        if (mlfq_levels[level].head) return ran;
+    }
+    return -1;
+}
+
+static void mlfq_charge(Job* job, int64_t ran) {
+    job->used += ran;
+    if (job->used >= mlfq_quanta[job->level]) {
+        if (job->level < MLFQ_LEVELS - 1) job->level++;   // the bottom level is round robin
+        job->used = 0;
+    }
+}
+
+// --- DRR: the clients take turns, a turn is DRR_SLICE of run time (debt carries
+// over), and a client runs its tasks in arrival order, round robin among them ---
+
+#define DRR_SLICE NS
+
+typedef struct Flow {
+    JobList jobs;
+    int64_t deficit;
+    int active;
+    struct Flow* next;      // ring of clients with tasks queued
+} Flow;
+
+static Flow* drr_flows;
+static Flow* drr_head;
+static Flow* drr_tail;
+
+static void drr_init(int clients) {
+    free(drr_flows);
+    drr_flows = calloc(clients, sizeof(Flow));
+    if (!drr_flows) {
+        perror("calloc");
+        exit(1);
+    }
+    drr_head = drr_tail = NULL;
+}
+
+static void ring_append(Flow* flow) {
+    flow->next = NULL;
+    if (drr_tail) drr_tail->next = flow; else drr_head = flow;
+    drr_tail = flow;
+    flow->active = 1;
+}
+
+static Flow* ring_take(void) {
+    Flow* flow = drr_head;
+    drr_head = flow->next;
+    if (!drr_head) drr_tail = NULL;
+    flow->active = 0;
+    return flow;
+}
+
+static void drr_push(Job* job) {
+    Flow* flow = &drr_flows[job->client];
+    list_append(&flow->jobs, job);
+    if (!flow->active) ring_append(flow);
+}
+
+static Job* drr_pop(int64_t now) {
+    (void)now;
+    if (!drr_head) return NULL;
+    // the head's turn is over once its deficit is spent: it goes to the back with a
+    // new slice. the deficit grows every time round, so this ends
+    while (drr_head->deficit <= 0) {
+        Flow* flow = ring_take();
+        flow->deficit += DRR_SLICE;
+        ring_append(flow);
+    }
+    Flow* flow = drr_head;
+    Job* job = list_take(&flow->jobs);
+    if (!flow->jobs.head) ring_take();     // back in when this task or another is queued
+    return job;
+}
+
+static int64_t drr_slice(const Job* job) {
+    int64_t deficit = drr_flows[job->client].deficit;
+    return deficit > 0 ? deficit : DRR_SLICE;
+}
+
+static int64_t drr_preempt(const Job* job, int64_t ran) {
+    (void)job;
+    (void)ran;
+    return -1;
+}
+
+static void drr_charge(Job* job, int64_t ran) {
+    Flow* flow = &drr_flows[job->client];
+    flow->deficit -= ran;
+    // a client with nothing left to run keeps its debt but saves up no credit
+    if (!flow->active && job->remaining <= 0 && flow->deficit > 0) flow->deficit = 0;
+}
+
+// --- EDF: the earliest deadline runs, preempting a later one ---
+
+static Job** edf_heap;
+static int edf_size;
+
+static int edf_before(const Job* a, const Job* b) {
+    if (a->deadline != b->deadline) return a->deadline < b->deadline;
+    return a->id < b->id;
+}
+
+static void edf_place(int index, Job* job) {
+    edf_heap[index] = job;
+    job->heap_index = index;
+}
+
+static void edf_init(int clients) {
+    (void)clients;
+    free(edf_heap);
+    edf_heap = malloc(sizeof(Job*) * job_count);
+    if (!edf_heap) {
+        perror("malloc");
+        exit(1);
+    }
+    edf_size = 0;
+}
+
+static void edf_push(Job* job) {
+    int index = edf_size++;
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!edf_before(job, edf_heap[parent])) break;
+        edf_place(index, edf_heap[parent]);
+        index = parent;
+    }
+    edf_place(index, job);
+}
+
+static Job* edf_pop(int64_t now) {
+    (void)now;
+    if (edf_size == 0) return NULL;
+    Job* top = edf_heap[0];
+    Job* last = edf_heap[--edf_size];
+    int index = 0;
+    while (edf_size > 0) {
+        int child = 2 * index + 1;
+        if (child >= edf_size) break;
+        if (child + 1 < edf_size && edf_before(edf_heap[child + 1], edf_heap[child])) child++;
+        if (!edf_before(edf_heap[child], last)) break;
+        edf_place(index, edf_heap[child]);
+        index = child;
+    }
+    if (edf_size > 0) edf_place(index, last);
+    return top;
+}
+
+static int64_t edf_slice(const Job* job) {
+    return job->remaining;
+}
+
+static int64_t edf_preempt(const Job* job, int64_t ran) {
+    return edf_size > 0 && edf_before(edf_heap[0], job) ? ran : -1;
+}
+
+static void edf_charge(Job* job, int64_t ran) {
+    (void)job;
+    (void)ran;
+}
+
+static const Policy policies[] = {
+    { "current", current_init, current_push, current_pop, current_slice, current_preempt, current_charge },
+    { "mlfq", mlfq_init, mlfq_push, mlfq_pop, mlfq_slice, mlfq_preempt, mlfq_charge },
+    { "drr", drr_init, drr_push, drr_pop, drr_slice, drr_preempt, drr_charge },
+    { "edf", edf_init, edf_push, edf_pop, edf_slice, edf_preempt, edf_charge },
+};
+#define POLICY_COUNT (int)(sizeof(policies) / sizeof(policies[0]))
+
+// --- the simulation ---
+
+// a demo task runs whole ticks, at least one, counted from the start of its round
+static int64_t round_up(const Job* job, int64_t ns) {
+    if (job->shell) return ns;
+    int64_t ticks = (ns + TICK - 1) / TICK;
+    return (ticks > 0 ? ticks : 1) * TICK;
+}
+
+static void run(const Policy* policy) {
+    for (int i = 0; i < job_count; i++) {
+        Job* job = &jobs[i];
+        job->remaining = job->burst;
+        job->queued_at = job->arrival;
+        job->waited = 0;
+        job->finish = 0;
+        job->rounds = 0;
+        job->task = NULL;
+        job->next = NULL;
+    }
+    policy->init(client_count);
+
+    int64_t now = 0;
+    int next = 0, finished = 0;
+    while (finished < job_count) {
+        while (next < job_count && jobs[next].arrival <= now) policy->push(&jobs[next++]);
+        Job* job = policy->pop(now);
+        if (!job) {
+            if (next == job_count) {
+                fprintf(stderr, "%s: %d task(s) lost\n", policy->name, job_count - finished);
+                exit(1);
+            }
+            now = jobs[next].arrival;           // idle until the next arrival
+            continue;
+        }
+        job->waited += now - job->queued_at;
+
+        int64_t start = now;
+        int64_t end = start + round_up(job, policy->slice(job));
+        if (end > start + job->remaining) end = start + job->remaining;
+        // tasks arriving during the round are queued when they arrive, and may end it early
+        while (next < job_count && jobs[next].arrival < end) {
+            Job* arriving = &jobs[next++];
+            policy->push(arriving);
+            int64_t stop = policy->preempt(job, arriving->arrival - start);
+            if (stop >= 0 && start + round_up(job, stop) < end) end = start + round_up(job, stop);
+        }
+
+        job->remaining -= end - start;
+        job->rounds++;
+        policy->charge(job, end - start);
+        now = end;
+        if (job->remaining <= 0) {
+            job->finish = now;
+            finished++;
+        } else {
+            job->queued_at = now;
+            policy->push(job);
+        }
+    }
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(int64_t* values, int count, int pct) {
+    if (count == 0) return 0;
+    qsort(values, count, sizeof(int64_t), compare_int64);
+    return values[(long)count * pct / 100] / 1e9;
+}
+
+static void report(const Policy* policy, double wall_ms) {
+    int64_t* turnaround = malloc(sizeof(int64_t) * job_count);
+    int64_t* shell = malloc(sizeof(int64_t) * job_count);
+    double* slowdown = calloc(client_count, sizeof(double));
+    int* per_client = calloc(client_count, sizeof(int));
+    if (!turnaround || !shell || !slowdown || !per_client) {
+        perror("malloc");
+        exit(1);
+    }
+
+    int shells = 0, missed = 0;
+    int64_t last = 0;
+    double turnaround_sum = 0, wait_sum = 0;
+    for (int i = 0; i < job_count; i++) {
+        Job* job = &jobs[i];
+        int64_t t = job->finish - job->arrival;
+        turnaround[i] = t;
+        if (job->shell) shell[shells++] = t;
+        turnaround_sum += t;
+        wait_sum += job->waited;
+        if (job->finish > job->deadline) missed++;
+        if (job->finish > last) last = job->finish;
+        slowdown[job->client] += (double)t / job->burst;
+        per_client[job->client]++;
+    }
+
+    // Jain's index over the clients that sent anything: (sum x)^2 / (n * sum x^2)
+    double sum = 0, squares = 0;
+    int clients = 0;
+    for (int c = 0; c < client_count; c++) {
+        if (per_client[c] == 0) continue;
+        double mean = slowdown[c] / per_client[c];
+        sum += mean;
+        squares += mean * mean;
+        clients++;
+    }
+    double fairness = squares > 0 ? sum * sum / (clients * squares) : 1;
+    double span = (last - jobs[0].arrival) / 1e9;
+
+    printf("%-8s %8.3f %10.2f %10.2f %10.2f %10.2f %7.1f%% %9.3f %8.1f\n", policy->name,
+           span > 0 ? job_count / span : 0, turnaround_sum / job_count / 1e9, percentile(turnaround, job_count, 99),
+           percentile(shell, shells, 99), wait_sum / job_count / 1e9, 100.0 * missed / job_count, fairness,
+           wall_ms);
+    free(turnaround);
+    free(shell);
+    free(slowdown);
+    free(per_client);
+}
+
+// --- workloads ---
+
+static uint64_t rng_state;
+
+static double rng_uniform(void) {
+    // xorshift64*, the same sequence for the same seed everywhere
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double rng_exponential(double mean) {
+    return -mean * log(1 - rng_uniform());
+}
+
+// shell commands are mostly short with a few long ones, demo tasks run 1 to 20 seconds
+#define SHELL_SHORT_MEAN 0.05
+#define SHELL_LONG_MEAN 5.0
+#define SHELL_LONG_SHARE 0.05
+#define DEMO_MAX_SECONDS 20
+
+static void generate(int count, int clients, double load, double shell_share, uint64_t seed) {
+    rng_state = seed ? seed : 1;
+    double mean_service = shell_share * ((1 - SHELL_LONG_SHARE) * SHELL_SHORT_MEAN + SHELL_LONG_SHARE * SHELL_LONG_MEAN) +
+                          (1 - shell_share) * (DEMO_MAX_SECONDS + 1) / 2.0;
+    double rate = load / mean_service;
+
+    // clients by a Zipf law: the first sends the most, as with one busy user among idle ones
+    double* weights = malloc(sizeof(double) * clients);
+    double total = 0;
+    for (int c = 0; c < clients; c++) total += 1.0 / (c + 1);
+    for (int c = 0; c < clients; c++) weights[c] = 1.0 / (c + 1) / total;
+
+    double t = 0;
+    for (int i = 0; i < count; i++) {
+        Job* job = &jobs[i];
+        t += rng_exponential(1 / rate);
+        double pick = rng_uniform();
+        int c = 0;
+        while (c < clients - 1 && pick >= weights[c]) pick -= weights[c++];
+        job->client = c;
+        job->arrival = (int64_t)(t * 1e9);
+        job->shell = rng_uniform() < shell_share;
+        if (job->shell) {
+            double mean = rng_uniform() < SHELL_LONG_SHARE ? SHELL_LONG_MEAN : SHELL_SHORT_MEAN;
+            job->burst = (int64_t)(rng_exponential(mean) * 1e9) + 1000000;   // at least 1 ms
+        } else {
+            job->burst = (1 + (int)(rng_uniform() * DEMO_MAX_SECONDS)) * TICK;
+        }
+        job->deadline = -1;
+    }
+    free(weights);
+    job_count = count;
+    client_count = clients;
+}
+
+// splits a CSV line in place; the last field keeps the rest of the line
+static int split(char* line, char** fields, int max) {
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+        fields[n++] = line;
+        char* comma = n < max ? strchr(line, ',') : NULL;
+        if (!comma) break;
+        *comma = '\0';
+        line = comma + 1;
+    }
+    return n;
+}
+
+static int compare_arrival(const void* a, const void* b) {
+    const Job* x = a;
+    const Job* y = b;
+    if (x->arrival != y->arrival) return (x->arrival > y->arrival) - (x->arrival < y->arrival);
+    return x->id - y->id;
+}
+
+static int compare_int(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+// reads a workload file or a stats log. returns -1 on a bad line
+static int load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[LINE_SIZE];
+    int cap = 1024, stats = 0, lineno = 0;
+    jobs = malloc(sizeof(Job) * cap);
+    job_count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (lineno == 1 && strncmp(line, "time,task_id,", 13) == 0) {
+            stats = 1;
+            continue;
+        }
+        if (lineno == 1 && strncmp(line, "arrival", 7) == 0) continue;
+        if (line[0] == '\n' || line[0] == '#') continue;
+        if (job_count == cap) {
+            cap *= 2;
+            jobs = realloc(jobs, sizeof(Job) * cap);
+        }
+        if (!jobs) {
+            perror("realloc");
+            exit(1);
+        }
+
+        char* fields[10];
+        int n = split(line, fields, stats ? 10 : 5);
+        Job* job = &jobs[job_count];
+        memset(job, 0, sizeof(*job));
+        job->id = job_count;
+        job->deadline = -1;
+        double arrival, burst;
+        const char* kind;
+        if (stats) {
+            // time,task_id,client_id,client_ip,kind,exit,queue_ms,run_ms,total_ms,...: the
+            // line is written when the task ends, so it arrived total_ms before
+            if (n < 10) goto bad;
+            job->client = atoi(fields[2]);
+            kind = fields[4];
+            burst = atof(fields[7]) / 1e3;
+            arrival = atof(fields[0]) - atof(fields[8]) / 1e3;
+        } else {
+            if (n < 4) goto bad;
+            arrival = atof(fields[0]);
+            job->client = atoi(fields[1]);
+            kind = fields[2];
+            burst = atof(fields[3]);
+            if (n == 5) job->deadline = (int64_t)(atof(fields[4]) * 1e9);
+        }
+        if (strcmp(kind, "shell") != 0 && strcmp(kind, "demo") != 0) goto bad;
+        job->shell = kind[0] == 's';
+        job->arrival = (int64_t)(arrival * 1e9);
+        if (job->shell) {
+            job->burst = (int64_t)(burst * 1e9);
+            if (job->burst < 1000000) job->burst = 1000000;
+        } else {
+            int seconds = (int)(burst + 0.5);
+            job->burst = (seconds > 0 ? seconds : 1) * TICK;
+        }
+        job_count++;
+    }
+    fclose(f);
+    if (job_count == 0) {
+        fprintf(stderr, "%s: no tasks\n", path);
+        return -1;
+    }
+
+    // by arrival from 0, and client ids made dense
+    qsort(jobs, job_count, sizeof(Job), compare_arrival);
+    int64_t first = jobs[0].arrival;
+    int* ids = malloc(sizeof(int) * job_count);
+    for (int i = 0; i < job_count; i++) ids[i] = jobs[i].client;
+    qsort(ids, job_count, sizeof(int), compare_int);
+    client_count = 0;
+    for (int i = 0; i < job_count; i++) {
+        if (client_count == 0 || ids[client_count - 1] != ids[i]) ids[client_count++] = ids[i];
+    }
+    for (int i = 0; i < job_count; i++) {
+        Job* job = &jobs[i];
+        job->arrival -= first;
+        if (job->deadline >= 0) job->deadline -= first;
+        job->client = (int*)bsearch(&job->client, ids, client_count, sizeof(int), compare_int) - ids;
+    }
+    free(ids);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%d: expected arrival,client,kind,burst[,deadline]\n", path, lineno);
+    fclose(f);
+    return -1;
+}
+
+static int save(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "arrival,client,kind,burst,deadline\n");
+    for (int i = 0; i < job_count; i++) {
+        Job* job = &jobs[i];
+        fprintf(f, "%.6f,%d,%s,%.6f,%.6f\n", job->arrival / 1e9, job->client, job->shell ? "shell" : "demo",
+                job->burst / 1e9, job->deadline / 1e9);
+    }
+    return fclose(f);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    const char* input = NULL;
+    const char* output = NULL;
+    const char* only = NULL;
+    int count = 5000, clients = 8;
+    double load_factor = 0.9, shell_share = 0.8, slack = 3;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:o:n:c:u:f:s:d:p:")) != -1) {
+        switch (opt) {
+        case 'i': input = optarg; break;
+        case 'o': output = optarg; break;
+        case 'n': count = atoi(optarg); break;
+        case 'c': clients = atoi(optarg); break;
+        case 'u': load_factor = atof(optarg); break;
+        case 'f': shell_share = atof(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        case 'd': slack = atof(optarg); break;
+        case 'p': only = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-i workload.csv] [-o workload.csv] [-n tasks] [-c clients] [-u load] "
+                            "[-f shell_share] [-s seed] [-d deadline_slack] [-p policy,...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (input) {
+        if (load(input) < 0) return 1;
+    } else {
+        if (count <= 0 || clients <= 0 || load_factor <= 0 || shell_share < 0 || shell_share > 1) {
+            fprintf(stderr, "tasks, clients and load must be positive, the shell share within 0..1\n");
+            return 1;
+        }
+        jobs = calloc(count, sizeof(Job));
+        if (!jobs) {
+            perror("calloc");
+            return 1;
+        }
+        generate(count, clients, load_factor, shell_share, seed);
+        for (int i = 0; i < job_count; i++) jobs[i].id = i;
+    }
+
+    int shells = 0;
+    int64_t work = 0;
+    for (int i = 0; i < job_count; i++) {
+        Job* job = &jobs[i];
+        if (job->deadline < 0) {
+            int64_t allowed = (int64_t)(slack * job->burst);
+            job->deadline = job->arrival + (allowed > NS ? allowed : NS);
+        }
+        shells += job->shell;
+        work += job->burst;
+    }
+    if (output && save(output) < 0) return 1;
+
+    double span = jobs[job_count - 1].arrival / 1e9;
+    printf("%d tasks (%d shell, %d demo) from %d clients over %.0f s, offered load %.2f\n", job_count, shells,
+           job_count - shells, client_count, span, span > 0 ? work / 1e9 / span : 0);
+    printf("current quanta: %d s first round, %d s after, shell preemption after %d ms\n\n",
+           FIRST_ROUND_QUANTUM, NEXT_ROUND_QUANTUM, SHELL_MIN_SLICE_MS);
+    printf("%-8s %8s %10s %10s %10s %10s %8s %9s %8s\n", "policy", "thru/s", "mean tat", "p99 tat",
+           "shell p99", "mean wait", "missed", "fairness", "sim ms");
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        if (only && !strstr(only, policies[i].name)) continue;
+        double start = now_ms();
+        run(&policies[i]);
+        report(&policies[i], now_ms() - start);
+    }
+    return 0;
+}
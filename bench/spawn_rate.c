@@ -0,0 +1,157 @@
+// measures how many shell commands per second the server can start and finish. each
+// of C client threads keeps D commands in flight on its own connection: it sends D
+// lines up front and another one for every DONE frame, for T seconds per command.
+// the commands are tiny, so the rate is mostly the cost of starting processes.
+//
+//   ./bench/spawn_rate -c 4 -d 8 -t 5
+//
+// runs "true", "echo x" and a five stage pipeline by default; -x runs one command instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+typedef struct Client {
+    pthread_t tid;
+    const char* line;           // the command followed by a newline
+    long done;                  // DONE frames seen inside the measured window
+    int failed;
+} Client;
+
+static struct sockaddr_in server_addr;
+static int depth = 8;
+static double seconds = 5;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* client_main(void* arg) {
+    Client* c = arg;
+    static __thread char payload[1 << 16];
+    size_t line_len = strlen(c->line);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        c->failed = 1;
+        return NULL;
+    }
+
+    for (int i = 0; i < depth; i++) {
+        write_full(fd, c->line, line_len);
+    }
+
+    double end = now_s() + seconds;
+    int in_flight = depth;
+    while (in_flight > 0) {
+        unsigned char raw[FRAME_HEADER_SIZE];
+        FrameHeader header;
+        if (read_full(fd, raw, sizeof(raw)) < 0) {
+            c->failed = 1;
+            break;
+        }
+        frame_decode(raw, &header);
+        uint32_t left = header.length;
+        while (left > 0) {
+            uint32_t n = left < sizeof(payload) ? left : sizeof(payload);
+            if (read_full(fd, payload, n) < 0) {
+                c->failed = 1;
+                break;
+            }
+            left -= n;
+        }
+        if (header.type == FRAME_ERROR) {
+            c->failed = 1;              // rejected, e.g. -d above the server's -i limit
+        }
+        if (header.type != FRAME_DONE) continue;
+
+        in_flight--;
+        if (now_s() < end) {
+            c->done++;
+            write_full(fd, c->line, line_len);
+            in_flight++;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+// runs one command from every client at once and returns commands per second
+static double run_command(const char* command, int clients) {
+    char line[512];
+    snprintf(line, sizeof(line), "%s\n", command);
+
+    Client* all = calloc(clients, sizeof(Client));
+    double start = now_s();
+    for (int i = 0; i < clients; i++) {
+        all[i].line = line;
+        pthread_create(&all[i].tid, NULL, client_main, &all[i]);
+    }
+    long total = 0;
+    int failed = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(all[i].tid, NULL);
+        total += all[i].done;
+        failed |= all[i].failed;
+    }
+    double elapsed = now_s() - start;
+    free(all);
+    if (failed) fprintf(stderr, "warning: some clients saw errors running \"%s\"\n", command);
+    return total / (elapsed < seconds ? elapsed : seconds);
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    const char* only = NULL;
+    int port = 8081, clients = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:d:t:x:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': clients = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'x': only = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-c clients] [-d depth] [-t seconds] [-x command]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (clients <= 0 || depth <= 0 || seconds <= 0) {
+        fprintf(stderr, "clients, depth and seconds must be positive\n");
+        return 1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad host %s\n", host);
+        return 1;
+    }
+
+    const char* defaults[] = { "true", "echo x", "echo x | cat | cat | cat | wc -c" };
+    const char** commands = only ? &only : defaults;
+    int count = only ? 1 : 3;
+
+    printf("%-36s %12s\n", "command", "commands/s");
+    for (int i = 0; i < count; i++) {
+        printf("%-36s %12.0f\n", commands[i], run_command(commands[i], clients));
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+// compares the two ways the server forwards command output: read()/send() through a
+// user space buffer, and splice() from the pipe straight into the socket. a child
+// process writes SIZE bytes into a pipe, stream_output_until() frames them onto a
+// loopback TCP connection (flushing the output ring whenever it fills, as the event
+// loop would), and a reader thread drains and discards the frames.
+//
+//   ./bench/splice_throughput -m 512 -r 5
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "connection.h"
+#include "output.h"
+#include "config.h"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_s(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void* drain(void* arg) {
+    int fd = *(int*)arg;
+    char buf[1 << 16];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    return NULL;
+}
+
+// a loopback TCP pair: *server_fd is non-blocking like the server's client sockets
+static void tcp_pair(int* server_fd, int* client_fd) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr*)&addr, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    *client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(*client_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    *server_fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK);
+    close(lfd);
+}
+
+// waits for the socket like the event loop's EPOLLOUT and sends the output ring
+static void flush_when_writable(Connection* conn) {
+    struct pollfd pfd = { .fd = conn->fd, .events = POLLOUT };
+    struct Task* parked;
+    poll(&pfd, 1, -1);
+    conn_flush_output(conn, &parked);
+}
+
+// the worker's and the loop's part together: forward until both pipes are at EOF,
+// draining the ring whenever it is full, then send what is left in it
+static void forward_output(Connection* conn, int out_fd, int err_fd) {
+    int pipes[2] = { out_fd, err_fd };
+    OutputCount sent = { 0 };
+    while (stream_output_until(conn, 1, pipes, NULL, 0, NULL, &sent) == STREAM_OUTPUT_FULL) {
+        flush_when_writable(conn);
+    }
+    while (__atomic_load_n(&conn->out_len, __ATOMIC_RELAXED) > 0) flush_when_writable(conn);
+}
+
+// runs one transfer and returns MB/s; *cpu gets the forwarding thread's CPU seconds
+static double run_once(size_t total, int zero_copy, double* cpu) {
+    int server_fd, client_fd;
+    tcp_pair(&server_fd, &client_fd);
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, drain, &client_fd);
+
+    struct sockaddr_in peer = { .sin_family = AF_INET };
+    Connection* conn = conn_create(server_fd, 1, 0, NULL, &peer);
+
+    int outfd[2], errfd[2];
+    if (pipe2(outfd, O_CLOEXEC) < 0 || pipe2(errfd, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    enlarge_pipe(outfd[1]);
+
+    server_config.zero_copy = zero_copy;
+    double start = now_s(), cpu_start = cpu_s();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // the "command": writes total bytes of output as fast as it can
+        static char chunk[1 << 16];
+        memset(chunk, 'x', sizeof(chunk));
+        close(outfd[0]);
+        close(errfd[0]);
+        size_t left = total;
+        while (left > 0) {
+            size_t n = left < sizeof(chunk) ? left : sizeof(chunk);
+            ssize_t w = write(outfd[1], chunk, n);
+            if (w <= 0) _exit(1);
+            left -= w;
+        }
+        _exit(0);
+    }
+    close(outfd[1]);
+    close(errfd[1]);
+
+    forward_output(conn, outfd[0], errfd[0]);
+    double elapsed = now_s() - start;
+    *cpu = cpu_s() - cpu_start;
+
+    waitpid(pid, NULL, 0);
+    conn_close(conn);                    // shutdown lets the reader see EOF
+    pthread_join(reader, NULL);
+    conn_unref(conn);
+    close(client_fd);
+    return total / elapsed / (1 << 20);
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = 512;
+    int rounds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+        switch (opt) {
+        case 'm': megabytes = strtoul(optarg, NULL, 10); break;
+        case 'r': rounds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-m megabytes] [-r rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* names[2] = { "copy", "splice" };
+    printf("%-8s %10s %12s\n", "path", "MB/s", "cpu s/GB");
+    for (int mode = 0; mode < 2; mode++) {
+        double best = 0, cpu_per_gb = 0;
+        for (int r = 0; r < rounds; r++) {
+            double cpu;
+            double rate = run_once(megabytes << 20, mode, &cpu);
+            if (rate > best) {
+                best = rate;
+                cpu_per_gb = cpu / (megabytes / 1024.0);
+            }
+        }
+        printf("%-8s %10.0f %12.3f\n", names[mode], best, cpu_per_gb);
+    }
+    return 0;
+}
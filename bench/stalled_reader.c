@@ -0,0 +1,185 @@
+// what a client that stops reading does to everyone else. one client sends a command
+// with a lot of output and then doesn't read for T seconds, while a second client runs
+// a short command after another and measures how long each takes (send to DONE). at
+// the end the stalled client reads everything and checks that every byte arrived.
+//
+//   ./bench/stalled_reader -t 5 -n 200000000 -s <server pid>
+//
+// start the server with one worker (-w 1): if the stalled client could hold the worker,
+// the other client would not finish a single command. with -s the server's RSS is
+// sampled at the end of the stall, it should stay around the output limit (-b).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+#define MAX_SAMPLES 1000000
+
+static struct sockaddr_in server_addr;
+static double seconds = 5;
+static volatile int stalling = 1;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+// reads one command's replies until DONE. returns the stdout bytes, -1 on error
+static long long read_reply(int fd) {
+    static __thread char payload[1 << 16];
+    long long bytes = 0;
+    while (1) {
+        unsigned char raw[FRAME_HEADER_SIZE];
+        FrameHeader header;
+        if (read_full(fd, raw, sizeof(raw)) < 0) return -1;
+        frame_decode(raw, &header);
+        if (header.type == FRAME_STDOUT) bytes += header.length;
+        uint32_t left = header.length;
+        while (left > 0) {
+            uint32_t n = left < sizeof(payload) ? left : sizeof(payload);
+            if (read_full(fd, payload, n) < 0) return -1;
+            left -= n;
+        }
+        if (header.type == FRAME_DONE) return bytes;
+    }
+}
+
+typedef struct Victim {
+    const char* command;
+    double* latency;
+    long count;
+    int failed;
+} Victim;
+
+static void* victim_main(void* arg) {
+    Victim* v = arg;
+    char line[512];
+    snprintf(line, sizeof(line), "%s\n", v->command);
+    int fd = connect_server();
+
+    while (stalling && v->count < MAX_SAMPLES) {
+        double sent = now_s();
+        write_full(fd, line, strlen(line));
+        if (read_reply(fd) < 0) {
+            v->failed = 1;
+            break;
+        }
+        v->latency[v->count++] = now_s() - sent;
+    }
+    close(fd);
+    return NULL;
+}
+
+static long rss_kb(int pid) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    const char* victim_cmd = "echo x";
+    long long output_bytes = 200000000;
+    int port = 8081, server_pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:t:n:c:s:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'n': output_bytes = atoll(optarg); break;
+        case 'c': victim_cmd = optarg; break;
+        case 's': server_pid = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-t seconds] [-n output_bytes] "
+                            "[-c other_command] [-s server_pid]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds <= 0 || output_bytes <= 0) {
+        fprintf(stderr, "seconds and output_bytes must be positive\n");
+        return 1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad host %s\n", host);
+        return 1;
+    }
+
+    // the stalled client: asks for output_bytes and doesn't read any of it yet
+    int stalled = connect_server();
+    int rcvbuf = 64 * 1024;
+    setsockopt(stalled, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    char line[128];
+    snprintf(line, sizeof(line), "head -c %lld /dev/zero\n", output_bytes);
+    write_full(stalled, line, strlen(line));
+    usleep(200000);                      // let it fill the socket before the other client starts
+
+    Victim victim = { .command = victim_cmd };
+    victim.latency = calloc(MAX_SAMPLES, sizeof(double));
+    if (!victim.latency) {
+        perror("calloc");
+        return 1;
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, victim_main, &victim);
+    usleep((useconds_t)(seconds * 1e6));
+    long rss = server_pid > 0 ? rss_kb(server_pid) : -1;
+    stalling = 0;
+
+    // now read it all: the stalled command should resume and deliver every byte
+    double drain_start = now_s();
+    long long received = read_reply(stalled);
+    double drain = now_s() - drain_start;
+    close(stalled);
+
+    // a victim stuck behind the stalled client only returns once the stall is over
+    pthread_join(tid, NULL);
+
+    printf("other client (%s): %ld commands in %.1f s", victim_cmd, victim.count, seconds);
+    if (victim.count > 0) {
+        qsort(victim.latency, victim.count, sizeof(double), compare_double);
+        printf(", p50 %.2f ms, p99 %.2f ms, max %.2f ms", victim.latency[victim.count / 2] * 1e3,
+               victim.latency[victim.count * 99 / 100] * 1e3, victim.latency[victim.count - 1] * 1e3);
+    }
+    printf("%s\n", victim.failed ? " (connection failed)" : "");
+    printf("stalled client: %lld of %lld bytes after the stall, read in %.2f s%s\n", received < 0 ? 0 : received,
+           output_bytes, drain, received == output_bytes ? "" : "  <-- MISSING OUTPUT");
+    if (rss >= 0) printf("server RSS at the end of the stall: %ld KB\n", rss);
+    return received == output_bytes ? 0 : 1;
+}
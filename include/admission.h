@@ -0,0 +1,41 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "connection.h"
+
+// decides whether a command that needs a worker is taken or turned away with a BUSY
+// frame, so an overloaded server answers at once instead of queueing work for minutes.
+// three limits, each off at 0: commands one client has queued or running (-q),
+// commands waiting in all run queues together (-Q), and the queue wait target (-m).
+// the wait target works like CoDel: waits are measured when a task first leaves a
+// queue, and if even the shortest wait of a 100 ms interval was over the target, the
+// queue is standing rather than absorbing a burst and new commands are refused until
+// an interval comes in under it again
+//
+// the same waits feed a histogram over the last second, behind the queue wait
+// percentiles of the server-status line and the retry-after hint of BUSY replies
+
+typedef struct QueueWaitStats {
+    long samples;               // tasks that left a queue in the last full second
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+    int queued;                 // tasks waiting in the run queues right now
+    int overloaded;             // waits are over the target (-m), new commands get BUSY
+    long busy_replies;          // commands refused since the server started
+} QueueWaitStats;
+
+// a worker took a task out of a queue for the first time, wait_ns after it was queued
+void admission_record_wait(int64_t wait_ns);
+
+// on the client's event loop, before a command is handed to the scheduler. returns 0
+// to take it; otherwise fills retry_after_ms and a reason for the BUSY frame and
+// returns -1
+int admission_check(Connection* conn, uint32_t* retry_after_ms, char* reason, size_t reason_len);
+
+void admission_stats(QueueWaitStats* stats);
+
+#endif
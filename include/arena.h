@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// a bump allocator for memory that lives exactly as long as one task: the command
+// string, its token vector, and so on. allocations come out of an initial buffer the
+// owner provides (inline in the Task), and only spill into malloc'd blocks when that
+// runs out. nothing is freed individually; arena_reset drops it all at once
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+} ArenaBlock;
+
+typedef struct Arena {
+    char* ptr;                  // next free byte in the current buffer
+    size_t left;                // bytes left there
+    char* initial;              // the owner's buffer, reused after a reset
+    size_t initial_size;
+    ArenaBlock* blocks;         // overflow blocks, freed by arena_reset
+} Arena;
+
+void arena_init(Arena* arena, void* initial, size_t size);
+void* arena_alloc(Arena* arena, size_t size);            // NULL when out of memory
+char* arena_strdup(Arena* arena, const char* str);
+void arena_reset(Arena* arena);                          // frees overflow blocks, rewinds
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdint.h>
+#include "connection.h"
+#include "session.h"
+#include "plan.h"
+#include "output.h"
+
+// commands the server answers itself instead of starting a process. their output goes
+// straight into the client's frames and they report an exit status like any command
+
+// cd and export change the client's session, so they run as soon as the line arrives:
+// later lines see the change even while earlier ones are still queued. they only
+// count as builtins on their own, without pipes or redirections (those still spawn,
+// and like in a subshell change nothing). returns 1 if the line was one of them and
+// its reply (output, EXIT, DONE) has been sent, 0 otherwise
+int builtin_session(Connection* conn, uint32_t tag, char* argv[], int argc);
+
+// echo, pwd, true and cat of small files, run by the worker that would have spawned a
+// single stage without redirections. returns the wait status, or -1 when the stage is
+// not one of them or asks for something the builtin doesn't do (a big file, an option).
+// the frames sent also go into capture, unless that is NULL, and their payload bytes
+// are added to *sent
+int builtin_run(const Stage* stage, const Session* session, Connection* conn, uint32_t tag,
+                OutputCapture* capture, uint64_t* sent);
+
+#endif
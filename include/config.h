@@ -0,0 +1,32 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// runtime settings for the server, filled in from the command line at startup
+typedef struct ServerConfig {
+    int port;                 // TCP port the event loops listen on
+    int loops;                // number of epoll event loops (defaults to one per core)
+    int workers;              // scheduler worker threads, each with its own run queue
+    int max_inflight;         // commands a client may have queued or running at once
+    int zero_copy;            // forward large output chunks with splice() (on by default)
+    int spawners;             // helper processes that start commands, 0 = workers spawn them
+    const char* cache_allowlist;  // programs whose results may be cached, NULL = no result cache
+    int cache_ttl_ms;         // how long a cached result is served, unless the allowlist says
+    const char* weights;      // file of per-address client weights, NULL = everyone weighs 1
+    int max_client_queue;     // commands per client before BUSY replies, 0 = no limit
+    int max_queued;           // commands waiting in all run queues before BUSY replies, 0 = no limit
+    int max_wait_ms;          // queue wait target, BUSY replies while waits stay over it, 0 = off
+    int output_buffer_kb;     // output waiting for a client before its tasks are stopped
+    int log_level;            // LOG_LEVEL_* from log.h, lines above it are not logged
+    const char* stats_log;    // CSV file getting a line per finished task, NULL = none
+    int metrics_port;         // Prometheus metrics on 127.0.0.1, 0 = off
+    const char* trace_file;   // where server-trace writes the scheduler trace, NULL = tracing off
+} ServerConfig;
+
+extern ServerConfig server_config;
+
+void parse_config(int argc, char* argv[]);   // exits with a usage message on bad options
+
+// the scheduling weight of clients connecting from ip (from -W, default 1)
+int client_weight(const char* ip);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+struct Connection;
+struct Task;
+struct Session;
+
+// lets other threads hand a connection back to the event loop that owns it. each
+// loop has one; the loop drains it when its eventfd fires
+typedef struct LoopNotifier {
+    int efd;                           // eventfd registered with the loop's epoll
+    pthread_mutex_t lock;
+    struct Connection* pending;        // connections waiting for the loop, linked by notify_next
+} LoopNotifier;
+
+// one of these per connected client, owned by the event loop that accepted it.
+// tasks take a reference so the socket stays valid until the last task is freed
+typedef struct Connection {
+    int fd;                        // non-blocking client socket
+    int client_id;                 // client number used in the logs and by the scheduler
+    int loop_id;                   // event loop that owns this connection
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    char* inbuf;                   // unprocessed command bytes, NULL while idle
+    size_t inlen;
+    size_t incap;
+    uint32_t next_tag;             // tag for the next command line (loop thread only)
+    int inflight;                  // commands queued or running, read with atomics
+    int paused;                    // reading stopped until a command finishes, atomics
+    int closed;                    // set once the client is gone, read with atomics
+    int refcount;
+    int weight;                    // share of the workers against other clients (see taskqueue.h)
+    long long run_ns;              // worker time spent on this client's tasks, atomics
+    long long cpu_ns;              // CPU its commands used (reaped processes, demo loops), atomics
+    pthread_mutex_t send_mutex;    // keeps writes from different threads from interleaving
+    char* outbuf;                  // output the socket didn't take yet, a ring (under send_mutex)
+    size_t out_head;               // where the oldest byte is
+    size_t out_len;                // bytes waiting, may be read with atomics
+    size_t out_cap;
+    struct Task* parked;           // tasks stopped until outbuf drains (scheduler owned, under send_mutex)
+    int output_held;               // reading stopped until outbuf drains (loop thread only)
+    int hung_up;                   // the client sent its FIN, maybe while unread (loop thread only)
+    pthread_mutex_t task_lock;     // protects the task list below
+    struct Task* tasks;            // this client's tasks, queued or running (scheduler owned)
+    struct Session* session;       // cwd and env from cd/export, NULL until changed (loop thread only)
+    LoopNotifier* notifier;        // owning loop's notifier
+    struct Connection* notify_next;
+    int notify_queued;             // already on the notifier list (under notifier->lock)
+} Connection;
+
+Connection* conn_create(int fd, int client_id, int loop_id, LoopNotifier* notifier,
+                        const struct sockaddr_in* addr);
+void conn_ref(Connection* conn);
+void conn_unref(Connection* conn);       // closes the socket when the last reference goes
+void conn_close(Connection* conn);       // marks the client gone and shuts the socket down
+int conn_is_closed(Connection* conn);
+
+// appends len bytes to the unfinished line buffer, growing it only when needed
+int conn_buffer_append(Connection* conn, const char* data, size_t len);
+void conn_buffer_consume(Connection* conn, size_t len);
+
+// in-flight accounting for pipelined commands. the loop calls conn_should_pause before
+// taking another command line and conn_command_started when it enqueues one; the
+// scheduler calls conn_command_finished, which wakes the loop if it was paused
+int conn_should_pause(Connection* conn, int limit);
+void conn_command_started(Connection* conn);
+void conn_command_finished(Connection* conn);
+
+int notifier_init(LoopNotifier* notifier);
+void conn_notify_loop(Connection* conn);              // queues conn for its loop (takes a reference)
+void notifier_drain(LoopNotifier* notifier);           // resets the eventfd before popping
+Connection* notifier_pop(LoopNotifier* notifier);      // next queued connection or NULL, caller unrefs it
+
+// output never blocks the caller. a frame goes straight to the socket while nothing is
+// buffered; what the socket doesn't take is kept in the connection's output ring, which
+// the event loop drains when the socket becomes writable again (conn_flush_output).
+// the ring is bounded: past the -b limit producers should stop (conn_output_full) and
+// the scheduler parks their tasks, and a client that lets it grow to several times the
+// limit anyway is disconnected
+
+// sends one protocol frame. header and payload are never interleaved with other
+// writers. returns 0, or -1 if the client is gone
+int conn_send_frame(Connection* conn, uint8_t type, uint8_t flags, uint32_t tag,
+                    const void* payload, uint32_t len);
+
+// sends a frame whose len byte payload is spliced straight from pipe_fd, which must
+// already hold at least len bytes. whatever the socket can't take right away is copied
+// from the pipe into the output ring. returns 0, or -1 if the client went away
+int conn_splice_frame(Connection* conn, uint8_t type, uint8_t flags, uint32_t tag,
+                      int pipe_fd, uint32_t len);
+
+// about how many bytes the socket would take right now without blocking, 0 while
+// output is waiting in the ring. sizes spliced frames so they don't spill into the ring
+size_t conn_send_room(Connection* conn);
+
+// does the client have at least the output limit waiting? always 0 once it is closed
+int conn_output_full(Connection* conn);
+
+// the loop calls this when the socket is writable: sends buffered output until the
+// socket is full again. once the ring is down to half the limit, *parked is set to the
+// tasks that were waiting for room (the caller requeues them), else NULL. a worker
+// streaming output may flush too, with parked NULL: the parked tasks then stay and the
+// loop is notified to come and requeue them. returns -1 if the client is gone
+int conn_flush_output(Connection* conn, struct Task** parked);
+
+#endif
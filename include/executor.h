@@ -1,12 +1,24 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
-void noArgCommand(char *command[]);
-void handleRedirect(char *command[]);
-void inputRedirect(char *command[]);
-void handlePipes(char *command[]);
-void handleMultiplePipes(char *command[]);
-void handlePipeRedirect(char *command[]);
-void handleCombinedRedirect(char *command[]);
+#include <sys/types.h>
+#include "plan.h"
+
+// starts every stage of a plan straight from the calling process with posix_spawnp,
+// so no copy of the server is ever forked. the stages share one new process group and
+// are chained with pipes; the first reads in_fd, and the pipeline writes out_fd and
+// err_fd unless a redirection says otherwise. redirections are file actions applied
+// in order after the pipes. a stage that can't start (missing program, unreadable
+// file) gets its error written to err_fd, the way the child would have printed it.
+// the stages run in cwd with envp as their environment (NULL for either: the server's).
+// pids[i] is stage i's pid or -1. stages that didn't start are counted in *failures by
+// why. returns the process group id, or 0 if no stage started
+typedef struct SpawnFailures {
+    int fork;       // no process for it: out of processes or memory (EAGAIN, ENOMEM)
+    int exec;       // the process couldn't run the program: not found, not executable
+} SpawnFailures;
+
+pid_t spawnPlan(const Plan *plan, const char *cwd, char *const envp[],
+                int in_fd, int out_fd, int err_fd, pid_t *pids, SpawnFailures *failures);
 
 #endif // EXECUTOR_H
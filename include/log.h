@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+// the server's log. every thread formats its lines into a ring of its own (one
+// producer, one consumer, no lock), and a background thread drains the rings in
+// batches, in time order, with one write() per batch. a thread that logs never takes
+// a lock or makes a system call, and never waits: when its ring is full the line is
+// dropped and counted, and the drain thread reports how many were lost. stats lines
+// (-S, below) are the exception
+//
+// levels, from quiet to chatty: errors, warnings (BUSY replies, admission, stalled
+// clients), info (connections, startup) and debug (a line per step of every command).
+// -L picks one; lines above it cost one compare
+
+enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+extern int log_level;
+
+// sets the level and starts the drain thread. lines logged before are kept and
+// written once it runs; log_flush is registered with atexit
+void log_init(int level);
+
+// the level called name ("error", "warn", "info", "debug"), -1 if there is none
+int log_level_parse(const char* name);
+
+// formats a line into the calling thread's ring. callers go through the macros below,
+// which skip the formatting for lines above the level
+void log_write(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// writes out everything logged so far, from any thread
+void log_flush(void);
+
+// the per-task stats log (-S), a CSV file for capacity planning. its lines take the
+// same rings and drain thread as the log, but are never dropped: a thread whose ring
+// is full waits for the drain thread to make room. lines a failed write() loses are
+// counted and reported in the log.
+// log_open_stats appends to path and writes the column names to a new file; returns
+// -1 with errno set if it can't be opened
+int log_open_stats(const char* path, const char* columns);
+int log_stats_enabled(void);
+void log_stats(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define log_at(level, ...) do { if ((level) <= log_level) log_write(__VA_ARGS__); } while (0)
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif
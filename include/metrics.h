@@ -0,0 +1,44 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+// latency histograms and counters for every step a command goes through, served in
+// the Prometheus text format on a port of their own (-M, on 127.0.0.1 only). every
+// event loop and worker records into a block of its own (one writer, no lock, no
+// atomic read-modify-write), and a scrape adds the blocks up. the queue depths come
+// from the run queues' length fields, so a scrape never takes a queue lock either
+//
+// the histograms are log-linear like HDR histograms: exact below 8 ns, then eight
+// buckets per power of two (12.5% wide), up to about ten hours
+
+// the steps of a command, each timed from the end of the one before
+enum {
+    STAGE_RECEIVE,          // its line read from the socket -> queued for a worker
+    STAGE_QUEUE,            // queued -> a worker picks it up, first round only
+    STAGE_SPAWN,            // picked up -> its processes started
+    STAGE_FIRST_OUTPUT,     // processes started -> the first output byte sent
+    STAGE_TOTAL,            // queued -> DONE sent, over all its rounds
+    STAGES,
+};
+
+enum {
+    COUNT_CONNECTIONS_OPENED,
+    COUNT_CONNECTIONS_CLOSED,
+    COUNT_COMMANDS,             // command lines received
+    COUNT_BUSY,                 // refused with BUSY
+    COUNT_CACHE_HITS,           // answered from the result cache or joined a running command
+    COUNT_COMPLETED,            // tasks that ran to the end and sent DONE
+    COUNT_FORK_FAILURES,        // stages without a process (EAGAIN, ENOMEM)
+    COUNT_EXEC_FAILURES,        // stages whose program couldn't run (not found, not executable)
+    COUNT_OUTPUT_BYTES,         // stdout and stderr sent, added when a task ends
+    COUNTS,
+};
+
+void metrics_observe(int stage, int64_t ns);
+void metrics_count(int counter, uint64_t n);
+
+// serves GET /metrics on 127.0.0.1:port from a thread of its own
+void metrics_start(int port);
+
+#endif
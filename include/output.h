@@ -0,0 +1,54 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "connection.h"
+
+// a copy of the frames a command sent, kept for the result cache: records of
+// [type:1][length:4][payload] in the order they went out. once more than limit bytes
+// were seen the capture gives up (overflow) and output streams as usual. while it has
+// listeners every frame is also handed to fanout, which sends it on to other clients
+// sharing the command; lock orders that against a listener joining and reading data
+typedef struct OutputCapture {
+    pthread_mutex_t lock;
+    char* data;
+    size_t len;
+    size_t cap;
+    size_t limit;
+    int overflow;
+    int listeners;              // written under lock, read with atomics
+    void (*fanout)(struct OutputCapture* capture, uint8_t type, const void* data, size_t len);
+} OutputCapture;
+
+void capture_init(OutputCapture* capture, size_t limit,
+                  void (*fanout)(OutputCapture* capture, uint8_t type, const void* data, size_t len));
+void capture_release(OutputCapture* capture);        // frees the data, if it wasn't taken
+void capture_append(OutputCapture* capture, uint8_t type, const void* data, size_t len);
+
+// what a command's output came to so far: payload bytes sent, and when the first bytes
+// from its pipes went out (CLOCK_MONOTONIC ns, 0 until then)
+typedef struct OutputCount {
+    uint64_t bytes;
+    int64_t first_ns;
+} OutputCount;
+
+// moves a command's output from its stdout/stderr pipes (pipes[0] and pipes[1]) to the
+// client as frames. chunks of at least SPLICE_MIN_BYTES go to the socket with splice()
+// so the data never enters user space; smaller ones (and every chunk when zero copy is
+// off) take the read()/send() copy path. returns -1 once both pipes reached EOF, the
+// index of one of wait_fds once it becomes readable (the caller reads it), or
+// STREAM_OUTPUT_FULL when the client's output ring is full and it should stop reading
+// the pipes for now. pipes that hit EOF are closed and set to -1 in place, so the next
+// call picks up where this one stopped. with a capture (else NULL) every frame also
+// goes into it, and the copy path is used until it overflows. what was sent is added
+// to *count
+#define STREAM_MAX_WAIT_FDS 4
+#define STREAM_OUTPUT_FULL -2
+int stream_output_until(Connection* conn, uint32_t tag, int pipes[2], const int* wait_fds,
+                        int wait_count, OutputCapture* capture, OutputCount* count);
+
+// grows a pipe so the splice path can move larger frames per header
+void enlarge_pipe(int pipe_fd);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+// command needs room for countTokens(userInput) + 1 entries (the list ends with NULL)
+int countTokens(const char *userInput);
 void parseInput(char *userInput, char *command[], int *argCount);
 
 #endif
@@ -0,0 +1,29 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stddef.h>
+
+// remembers which executable a command name resolves to on a given PATH, so starting
+// a command doesn't walk the PATH directories (one failed execve or stat per entry)
+// every time. entries are kept per PATH string, so clients that export a different
+// PATH get their own answers. every PATH directory is watched with inotify, and any
+// change in one (a file created, removed, renamed, chmod'ed) drops the cache. a thread
+// of its own reads the watch queue, so a hit takes no system call and only a shared
+// lock; a miss searches the directories without holding any lock
+
+typedef struct PathCacheStats {
+    unsigned long hits;
+    unsigned long misses;           // lookups that had to search the directories
+    unsigned long invalidations;    // times the cache was dropped
+    int entries;
+} PathCacheStats;
+
+// copies the absolute path name resolves to on path_env into buf and returns buf, or
+// returns NULL if it isn't found, or the PATH has relative entries (those depend on
+// the command's cwd; the caller then lets the spawn search the PATH itself)
+const char* pathcache_lookup(const char* name, const char* path_env, char* buf, size_t size);
+
+void pathcache_stats(PathCacheStats* stats);
+void pathcache_flush(void);
+
+#endif
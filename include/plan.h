@@ -0,0 +1,40 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "arena.h"
+
+// a shell command compiled once, when it is queued: the pipeline stages in order,
+// each with its argv and its redirections. the executor runs it without looking at
+// the command string again
+
+typedef enum RedirectKind {
+    REDIRECT_IN,           // < path
+    REDIRECT_OUT,          // > path
+    REDIRECT_ERR,          // 2> path
+    REDIRECT_ERR_TO_OUT,   // 2>&1, no path
+} RedirectKind;
+
+typedef struct Redirect {
+    RedirectKind kind;
+    const char* path;
+} Redirect;
+
+typedef struct Stage {
+    char** argv;           // NULL terminated, argv[0] is the program
+    int argc;
+    Redirect* redirects;   // applied in the order they were written
+    int redirect_count;
+    const char* program;   // absolute path from the PATH cache, NULL to let the spawn search PATH
+} Stage;
+
+typedef struct Plan {
+    Stage* stages;
+    int stage_count;       // 0 for a blank command
+    const char* error;     // syntax error for the client (newline terminated), or NULL
+} Plan;
+
+// compiles command into plan, allocating everything from arena. a syntax error is not
+// a failure: it is reported through plan->error. returns -1 only when out of memory
+int plan_build(Plan* plan, const char* command, Arena* arena);
+
+#endif
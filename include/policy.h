@@ -0,0 +1,33 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "taskqueue.h"
+
+// the timing rules a worker schedules by, next to the run queue's order (taskqueue.h):
+// how long a task may run and what ends its round early. they look at nothing but the
+// task and the queue, no clock or socket, so bench/sim.c runs the same rules against a
+// virtual clock. the quanta can be set at build time to try others there
+#ifndef FIRST_ROUND_QUANTUM
+#define FIRST_ROUND_QUANTUM 3   // first time a task runs, it gets 3 seconds
+#endif
+#ifndef NEXT_ROUND_QUANTUM
+#define NEXT_ROUND_QUANTUM 7    // subsequent rounds get 7 seconds
+#endif
+#ifndef SHELL_MIN_SLICE_MS
+#define SHELL_MIN_SLICE_MS 100  // a new shell command can preempt a running one after this long
+#endif
+
+// seconds the task may run this round: the quantum, demo tasks no more than they have left
+static inline int policy_round_time(const Task* task) {
+    int quantum = task->round_count == 0 ? FIRST_ROUND_QUANTUM : NEXT_ROUND_QUANTUM;
+    return !task->is_shell && task->remaining_time < quantum ? task->remaining_time : quantum;
+}
+
+// should the running task make way for what waits in its worker's queue? a demo
+// (checked at its next tick) for any shell task, a shell command only for one that
+// never ran, and not before it had SHELL_MIN_SLICE_MS. the caller holds queue->lock
+static inline int policy_preempts(const RunQueue* queue, const Task* running) {
+    return running->is_shell ? runqueue_has_fresh_shell(queue) : runqueue_has_shell(queue);
+}
+
+#endif
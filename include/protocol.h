@@ -0,0 +1,68 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// every reply from the server is a frame: a fixed 12 byte header followed by
+// `length` bytes of payload. all header fields are in network byte order.
+//
+//   0      1      2             4                  8                 12
+//   +------+------+-------------+------------------+-----------------+
+//   | type | flags|  reserved   |       tag        |     length      |
+//   +------+------+-------------+------------------+-----------------+
+//
+// the tag says which request a frame belongs to: command lines are numbered 1, 2, 3...
+// in the order they arrive on the connection (blank lines included). replies for
+// different tags may interleave and finish in any order.
+#define FRAME_HEADER_SIZE 12
+#define FRAME_MAX_PAYLOAD (16u * 1024 * 1024)   // receivers reject anything bigger
+
+typedef enum FrameType {
+    FRAME_STDOUT = 1,      // payload: raw bytes the command wrote to stdout
+    FRAME_STDERR = 2,      // payload: raw bytes the command wrote to stderr
+    FRAME_EXIT = 3,        // payload: 4 byte exit code (or signal number, see flags)
+    FRAME_DONE = 4,        // no payload, the task is finished and nothing else follows for it
+    FRAME_ERROR = 5,       // payload: error message from the server itself
+    FRAME_BUSY = 6,        // payload: 4 byte retry-after in ms, then a message. the command
+                           // was not taken (server overloaded), DONE follows
+    FRAME_STATS = 7,       // payload: a TaskStats record, between EXIT and DONE of every
+                           // command a worker ran
+} FrameType;
+
+// flags for FRAME_EXIT
+#define FRAME_FLAG_SIGNALED 0x01   // the command was killed, payload holds the signal number
+
+// what a command cost, sent as TASK_STATS_SIZE bytes: the fields below in this order,
+// each an unsigned 64 bit integer in network byte order. queue + run is how long the
+// server took; total - queue - run is time stopped because the client didn't read
+typedef struct TaskStats {
+    uint64_t queue_us;         // waiting in run queues, all rounds together
+    uint64_t run_us;           // on a worker
+    uint64_t total_us;         // from the line arriving to the command's exit
+    uint64_t user_us;          // CPU time of the command's processes
+    uint64_t sys_us;
+    uint64_t max_rss_kb;       // peak memory of its biggest process
+    uint64_t output_bytes;     // stdout and stderr sent
+} TaskStats;
+#define TASK_STATS_SIZE 56
+
+void stats_encode(unsigned char out[TASK_STATS_SIZE], const TaskStats* stats);
+void stats_decode(const unsigned char in[TASK_STATS_SIZE], TaskStats* stats);
+
+typedef struct FrameHeader {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t tag;
+    uint32_t length;
+} FrameHeader;
+
+void frame_encode(unsigned char out[FRAME_HEADER_SIZE], uint8_t type, uint8_t flags,
+                  uint32_t tag, uint32_t length);
+void frame_decode(const unsigned char in[FRAME_HEADER_SIZE], FrameHeader* header);
+
+// blocking helpers for clients: read or write exactly len bytes. return 0, or -1 on error/EOF
+int read_full(int fd, void* buf, size_t len);
+int write_full(int fd, const void* buf, size_t len);
+
+#endif
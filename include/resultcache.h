@@ -0,0 +1,58 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <stdint.h>
+#include "connection.h"
+#include "output.h"
+
+// remembers what read-only commands printed, so a line a client already ran a moment
+// ago (cat /proc/loadavg, df, ls -l dir) is answered from memory by the event loop
+// without going through the scheduler or starting a process. off unless the server
+// gets an allowlist (-C): only pipelines whose every program is on it are cached, and
+// never ones that write files (> or 2>). an entry is keyed by the command's words,
+// the client's cwd and its environment, and lives for its TTL (-T, or per program in
+// the allowlist). files read through < are checked on every hit and the entry is
+// dropped once one of them changed (mtime, size or inode)
+//
+// the same allowlist turns on single-flight: when a command is submitted while an
+// identical one (same key, same state of its < files) is still queued or running, the
+// new client doesn't get a task of its own. it joins the running one as a subscriber,
+// is sent what that command printed so far and then each frame as it is produced,
+// and gets the same exit status. a command whose output outgrew the cache limit can't
+// be joined any more, there is nothing to catch up from
+
+// a miss that is being run: collects the output so it can become an entry
+typedef struct CacheFill CacheFill;
+
+// reads the allowlist, one program per line with an optional TTL in milliseconds
+// ("df 5000"), # starts a comment. exits with a message if the file is unreadable
+void resultcache_init(const char* allowlist_path, int default_ttl_ms);
+
+int resultcache_enabled(void);
+
+// on a client's event loop, for a parsed command line. returns 1 when the result was
+// in the cache and has been sent (output, EXIT, DONE), 2 when the line joined a running
+// command (which now counts as in flight for conn and ends like one). otherwise returns
+// 0 and, if the command may be cached, sets *fill for the task that runs it (else NULL)
+int resultcache_serve(Connection* conn, uint32_t tag, char* argv[], int argc, CacheFill** fill);
+
+// where the task copies its output to; NULL for a NULL fill
+OutputCapture* resultcache_capture(CacheFill* fill);
+
+// does another client wait for this command's output? then it has to run to the end
+// even if its own client left
+int resultcache_shared(CacheFill* fill);
+
+// the result depends on more than the command (a failed spawn): share it with the
+// subscribers, but don't store it
+void resultcache_no_store(CacheFill* fill);
+
+// the command finished with wait status: store the entry (unless the output was too
+// big or the command was killed) and free the fill
+void resultcache_complete(CacheFill* fill, int status);
+
+// the command didn't run to the end: subscribers get an error, the fill is freed.
+// NULL is fine
+void resultcache_abandon(CacheFill* fill);
+
+#endif
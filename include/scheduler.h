@@ -2,32 +2,83 @@
 #define SCHEDULER_H
 
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "connection.h"
+#include "arena.h"
+#include "plan.h"
+#include "session.h"
+#include "resultcache.h"
+#include "spawner.h"
+#include "output.h"
+
+#define TASK_ARENA_SIZE 768   // inline arena space, enough for the command and its plan for most commands
 
 // this struct represents a task in our scheduler, could be either a demo program or shell command
 typedef struct Task {
     int task_id;              // unique identifier for each task
+    uint32_t tag;             // request tag the client sees on every reply frame
     int client_id;            // to track which client submitted this task
     int burst_time;           // total time needed to complete the task
     int remaining_time;       // how much time is left for this task to finish
     int is_shell;            // flag to differentiate between demo (0) and shell commands (1)
     int round_count;         // keeps track of how many rounds this task has been scheduled
-    int socket_fd;           // socket to send output back to the client
+    Connection* conn;        // client connection to send output back to (holds a reference)
     int current_iteration;   // for demo tasks: tracks which iteration we're on (0/N, 1/N, etc)
-    char command[1024];      // the actual command string to execute
-    struct Task* next;       // pointer to next task in our linked list queue
+    char* command;           // the actual command string to execute (in the arena)
+    Plan plan;               // shell tasks: the command compiled into stages (in the arena)
+
+    // shell tasks keep their child between quanta
+    pid_t pid;               // process group of the pipeline, 0 until the command starts
+    pid_t* pids;             // one per plan stage (in the arena), -1 for a stage that didn't start
+    int status_fd;           // status pipe from a spawner helper, -1 when the worker spawned the pipeline
+    Session* session;        // cwd and env the command runs with, NULL for the server's
+    CacheFill* fill;         // collects the output for the result cache, NULL if not cached
+    int out_fd;              // read ends of the child's stdout/stderr pipes, -1 once at EOF
+    int err_fd;
+    int running_on;          // worker running the task, -1 while it waits in a queue
+    struct timespec queued_at;  // CLOCK_MONOTONIC when it was last queued, for the queue wait
+
+    // what it cost, reported in the STATS frame and the stats log
+    struct timespec received_at;  // CLOCK_MONOTONIC when its line arrived
+    int64_t wait_ns;         // in run queues, all rounds
+    int64_t run_ns;          // on a worker, all rounds
+    OutputCount output;      // stdout and stderr sent
+    int64_t started_ns;      // shell tasks: when the pipeline started, 0 once its first output was timed
+    PipelineResult usage;    // shell tasks: CPU and memory of the pipeline, once it exited
+
+    // intrusive run queue handle, only touched under the owning queue's lock
+    struct RunQueue* queue;  // queue this task is waiting in, NULL while it runs
+    struct Task* next;       // shell FIFO links
+    struct Task* prev;
+    int heap_index;          // slot in the flow's demo heap
+    uint64_t seq;            // enqueue order, breaks ties between equal remaining times
+    struct ClientFlow* flow; // client flow it was popped from, until its run time is charged
+    int run_class;           // the class it was popped from (see taskqueue.h)
+
+    // links in the client's task list, under conn->task_lock
+    struct Task* client_next;
+    struct Task* client_prev;
+    struct Task* parked_next;   // conn->parked, while it waits for the client to read (under send_mutex)
+
+    // per-task memory: everything allocated here goes away when the task does
+    Arena arena;
+    char arena_space[TASK_ARENA_SIZE];
 } Task;
 
 // core functions for our scheduler implementation
-void init_scheduler();                        // starts up the scheduler thread to process tasks
+void init_scheduler();                        // starts the worker threads (server_config.workers of them)
 void shutdown_scheduler();                    // cleanup when we're done (not really used but good practice)
 
 // helper functions to manage tasks
 void add_task(const char* command, int client_id, int burst_time, int is_shell);  // basic task addition
-void remove_tasks_by_client(int client_id);   // removes all tasks when a client disconnects
-void add_task_with_socket(const char* command, int client_id, int burst_time, int is_shell, int socket_fd);  // adds task with socket info
-
-// these need to be accessible from other files
-extern pthread_mutex_t queue_mutex;           // mutex to protect our task queue from concurrent access
-extern Task* task_queue;                      // head of our task queue linked list
+void remove_tasks_by_client(Connection* conn); // removes a client's queued tasks when it disconnects
+int scheduler_queued_tasks(void);              // tasks waiting in all run queues, without taking their locks
+int scheduler_worker_state(int worker, int* busy);  // a worker's queue length and whether it is busy, lock free;
+                                                    // -1 past the last worker
+void resume_parked_tasks(Task* parked);        // queues tasks again that waited for their client's output to drain
+void add_task_with_conn(const char* command, int client_id, int burst_time, int is_shell, Connection* conn, uint32_t tag,
+                        CacheFill* fill);  // adds task that reports to a client, fill (or NULL) now belongs to it
 
 #endif
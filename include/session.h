@@ -0,0 +1,36 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a client's shell state: working directory and environment, changed by the cd and
+// export builtins and inherited by every command the client runs afterwards. a
+// session is never modified once made; cd and export build a new one and the
+// connection switches to it, while tasks queued earlier keep a reference to the old
+// one. NULL stands for the server's own cwd and environment, so clients that never
+// use cd or export cost nothing
+typedef struct Session {
+    int refcount;
+    char* cwd;                  // absolute path
+    char** env;                 // "NAME=value" strings, NULL terminated
+    int env_count;
+    uint64_t env_hash;          // of every env string, see session_env_hash
+} Session;
+
+Session* session_ref(Session* session);          // NULL passes through
+void session_unref(Session* session);
+
+// the session's value for name, or NULL when unset
+const char* session_getenv(const Session* session, const char* name);
+const char* session_cwd(const Session* session, char* buf, size_t size);
+
+// a hash of the whole environment, equal for sessions whose commands see the same
+// variables (the result cache keys on it)
+uint64_t session_env_hash(const Session* session);
+
+// copies of base with one thing changed (PWD follows the cwd). NULL when out of memory
+Session* session_with_cwd(const Session* base, const char* cwd);
+Session* session_with_env(const Session* base, const char* assignment);
+
+#endif
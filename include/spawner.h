@@ -0,0 +1,46 @@
+#ifndef SPAWNER_H
+#define SPAWNER_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "plan.h"
+#include "executor.h"
+
+// a pool of small single-threaded helper processes, forked at boot before the server
+// starts any thread or opens any socket, that start commands on the workers' behalf.
+// a worker sends the compiled command (each stage's argv, program and redirects) over a
+// unix socket; the helper spawns it and hands back the read ends of its stdout/stderr pipes with SCM_RIGHTS. the cost
+// of starting a process then no longer depends on how big the server has grown
+
+// how a pipeline ended and what its processes used, over all stages
+typedef struct PipelineResult {
+    int status;                 // wait status of the last stage, 1 << 8 if it never started
+    long user_us;               // CPU time of every stage together
+    long sys_us;
+    long max_rss_kb;            // the peak of the biggest stage
+} PipelineResult;
+
+// adds one reaped stage's rusage (from wait4) to result
+void pipeline_add_usage(PipelineResult* result, const struct rusage* usage);
+
+// what a helper hands back for one command
+typedef struct SpawnedJob {
+    pid_t group;                // process group of the pipeline, 0 if no stage started
+    int out_fd;                 // read ends of the pipeline's stdout/stderr pipes
+    int err_fd;
+    int status_fd;              // yields a PipelineResult once every stage exited
+    SpawnFailures failures;     // stages that didn't start, and why
+} SpawnedJob;
+
+// forks count helpers (0 leaves the pool off). must run before any other thread exists
+void spawner_init(int count);
+
+int spawner_enabled(void);
+
+// starts plan through one of the helpers, in cwd with envp (NULL for either: the
+// server's), running the programs its stages were resolved to. the helper rebuilds the
+// plan from the request without parsing the command again. returns 0, or -1 if no
+// helper answered or the request is too big (the caller can still spawn it itself)
+int spawner_launch(const Plan* plan, const char* cwd, char* const envp[], SpawnedJob* job);
+
+#endif
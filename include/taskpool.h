@@ -0,0 +1,12 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include "scheduler.h"
+
+// Task objects come from slabs of TASKS_PER_SLAB and go back on a free list when the
+// task ends, so a command costs no malloc/free pair once the pool has warmed up.
+// slabs are never returned to the system; the pool stays as big as the busiest moment
+Task* taskpool_get(void);          // NULL when a new slab cannot be allocated
+void taskpool_put(Task* task);     // resets the task's arena too
+
+#endif
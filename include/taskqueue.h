@@ -0,0 +1,83 @@
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "scheduler.h"
+
+#define RUN_CLASSES 3           // shell tasks that never ran, stopped shell tasks, demo tasks
+#define FLOW_BUCKETS 64
+#define DRR_QUANTUM_NS 10000000LL   // run time a flow of weight 1 gets per round (10 ms)
+
+// a FIFO of tasks linked through Task.prev/next
+typedef struct TaskList {
+    Task* head;
+    Task* tail;
+} TaskList;
+
+// demo tasks by remaining time, heap[0] has the least
+typedef struct TaskHeap {
+    Task** items;
+    int size;
+    int cap;
+} TaskHeap;
+
+// one client's tasks in one run queue, split by class like the queue itself
+typedef struct ClientFlow {
+    int client_id;
+    int weight;                 // share of run time against other clients, 1 by default
+    struct RunQueue* queue;
+    struct ClientFlow* hash_next;
+    TaskList fresh_shell;
+    TaskList stopped_shell;
+    TaskHeap demos;
+    int64_t deficit[RUN_CLASSES];               // ns it may still run this round, < 0 is debt
+    struct ClientFlow* ring_next[RUN_CLASSES];  // active flows of a class, served in turn
+    struct ClientFlow* ring_prev[RUN_CLASSES];
+    int in_ring[RUN_CLASSES];
+    int refs;                   // tasks queued here, plus ones popped and not charged yet
+} ClientFlow;
+
+typedef struct FlowRing {
+    ClientFlow* head;
+    ClientFlow* tail;
+} FlowRing;
+
+// the run queue of one worker. shell tasks go first: commands that never ran before
+// the ones that were stopped at the end of a quantum, which keeps short interactive
+// commands ahead of long jobs, and demo tasks last. inside each of those classes the
+// clients take turns by deficit round robin: every client has a flow with its own
+// tasks, the flows of a class sit in a ring, and the one at the head runs tasks until
+// the run time they took (charged afterwards, see runqueue_charge) uses up its
+// deficit; then it moves to the back and every flow's deficit grows by a quantum
+// times its weight. a client with many commands queued thus gets the same share of
+// the worker as one with a single command, not a share per command. within a flow
+// shell tasks keep arrival order and demo tasks run shortest remaining time first
+typedef struct RunQueue {
+    pthread_mutex_t lock;       // taken by the scheduler, the functions below don't lock
+    ClientFlow* flows[FLOW_BUCKETS];
+    FlowRing rings[RUN_CLASSES];
+    int fresh_count;            // shell tasks that never ran
+    int shell_count;            // all shell tasks
+    int length;                 // shell + demo tasks, may be peeked without the lock
+    uint64_t next_seq;
+} RunQueue;
+
+void runqueue_init(RunQueue* queue);
+int runqueue_push(RunQueue* queue, Task* task);     // returns -1 when out of memory
+Task* runqueue_pop(RunQueue* queue);                // next task by policy, or NULL; sets task->flow
+void runqueue_remove(RunQueue* queue, Task* task);  // task must be queued in this queue
+
+// bills the run time a popped task used to the flow it came from. queue is
+// task->flow->queue, whose lock the caller holds; clears task->flow
+void runqueue_charge(RunQueue* queue, Task* task, int64_t cost_ns);
+
+static inline int runqueue_has_shell(const RunQueue* queue) {
+    return queue->shell_count > 0;
+}
+
+static inline int runqueue_has_fresh_shell(const RunQueue* queue) {
+    return queue->fresh_count > 0;
+}
+
+#endif
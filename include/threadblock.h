@@ -0,0 +1,37 @@
+#ifndef THREADBLOCK_H
+#define THREADBLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// per-thread blocks, what the log rings, the metrics, the trace rings and the queue
+// wait histograms are kept in: each thread writes only its own block, without a lock,
+// and a reader walks the list of all of them. a block starts with a ThreadBlock
+typedef struct ThreadBlock {
+    struct ThreadBlock* next;
+    int id;                     // 1 for the list's first block, then counting up
+} ThreadBlock;
+
+typedef struct ThreadBlockList {
+    ThreadBlock* first;         // newest first; blocks are never freed
+    int count;
+    pthread_mutex_t lock;       // adding a block takes it
+} ThreadBlockList;
+
+#define THREAD_BLOCK_LIST { NULL, 0, PTHREAD_MUTEX_INITIALIZER }
+
+// a thread's first record sets up its block, the only time recording takes a lock:
+// size zeroed bytes, handed to init (if any) before anyone else can see them, then
+// added to list. returns NULL if there is no memory
+void* thread_block_register(ThreadBlockList* list, size_t size, void (*init)(void* block));
+
+// the newest block; blocks added meanwhile are missed, not half seen
+static inline void* thread_blocks(ThreadBlockList* list) {
+    return __atomic_load_n(&list->first, __ATOMIC_ACQUIRE);
+}
+
+// CLOCK_MONOTONIC in ns, the clock everything the server times is timed with
+int64_t monotonic_ns(void);
+
+#endif
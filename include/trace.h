@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "connection.h"
+
+// a flight recorder of scheduling decisions, for latency spikes the log lines are too
+// coarse for. with -t file every event loop and worker keeps its last TRACE_EVENTS task
+// events in a ring of its own (one writer, no lock, nanosecond timestamps), and the
+// "server-trace" command writes all rings to file as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open. each worker is a track with its quanta as
+// slices, and each task an async span from its first enqueue to its DONE
+//
+// with tracing off every call site is one predictable branch on trace_on
+
+#define TRACE_EVENTS 65536              // per thread, a power of two
+
+enum {
+    TRACE_ENQUEUE,          // into a run queue (again, after round 0)
+    TRACE_SELECT,           // a worker took it, arg = queue wait in us
+    TRACE_QUANTUM_START,    // arg = the quantum in seconds
+    TRACE_QUANTUM_END,      // arg = demo iterations run, shell: 1 if it finished
+    TRACE_PREEMPT,          // quantum over, back into a queue
+    TRACE_PARK,             // stopped until its client reads its output
+    TRACE_SPAWN,            // pipeline started, arg = process group
+    TRACE_FIRST_BYTE,       // first output from its pipes sent
+    TRACE_EXIT,             // arg = exit code, or -signal
+    TRACE_DONE,             // DONE sent, arg = 1 if it was dropped because its client left
+    TRACE_EVENT_TYPES,
+};
+
+extern int trace_on;
+
+// turns tracing on; server-trace writes to path
+void trace_init(const char* path);
+
+// names the calling thread's track ("worker", 3 -> worker-3)
+void trace_name_thread(const char* kind, int id);
+
+// ns 0 means now
+void trace_record(int type, int64_t ns, int task_id, int client_id, int round, int remaining,
+                  int shell, int arg);
+
+#define trace_task_at(type, task, arg, ns) do { \
+        if (__builtin_expect(trace_on, 0)) \
+            trace_record((type), (ns), (task)->task_id, (task)->client_id, (task)->round_count, \
+                         (task)->remaining_time, (task)->is_shell, (arg)); \
+    } while (0)
+#define trace_task(type, task, arg) trace_task_at(type, task, arg, 0)
+
+// answers server-trace: the rings go to the trace file on a thread of its own, and the
+// client gets a line saying how many events were written (or why not) when it is done
+void trace_dump(Connection* conn, uint32_t tag);
+
+#endif
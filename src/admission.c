@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "admission.h"
+#include "scheduler.h"
+#include "config.h"
+#include "log.h"
+#include "threadblock.h"
+
+#define WINDOW_NS 1000000000LL      // percentiles are over the last full second
+#define INTERVAL_NS 100000000LL     // the wait target is checked every 100 ms
+#define WAIT_BUCKETS 160            // 4 per power of two of microseconds, up to ~2^40 us
+#define MIN_RETRY_MS 100
+#define MAX_RETRY_MS 10000
+
+// what one worker recorded: the waits of the current and the previous second, and the
+// shortest wait of the current and the previous interval. only the owning thread
+// writes a block; readers merge every block and see each word old or new. slots are
+// picked by the parity of the second (interval) and tagged with it, so a slot whose
+// tag is stale holds nothing for the one asked about
+typedef struct WaitSlot {
+    int64_t second;
+    long counts[WAIT_BUCKETS];
+    long samples;
+    int64_t max;
+} WaitSlot;
+
+typedef struct IntervalSlot {
+    int64_t interval;
+    long samples;
+    int64_t min;
+} IntervalSlot;
+
+typedef struct WaitBlock {
+    ThreadBlock block;
+    WaitSlot seconds[2];
+    IntervalSlot intervals[2];
+} WaitBlock;
+
+static ThreadBlockList blocks = THREAD_BLOCK_LIST;
+static __thread WaitBlock* my_block;
+
+// the CoDel verdict: the shortest wait since the last check decides whether we are
+// overloaded. whoever first gets past next_check works it out for everyone
+static int64_t next_check;
+static int overloaded;
+static int64_t standing_wait;       // the shortest wait of the last interval over target
+
+static long busy_replies;           // atomics
+
+// log-linear buckets: exact below 4 us, then four per power of two (25% wide)
+static int bucket_of(int64_t wait_ns) {
+    uint64_t us = wait_ns > 0 ? (uint64_t)wait_ns / 1000 : 0;
+    if (us < 4) return (int)us;
+    int e = 63 - __builtin_clzll(us);
+    int index = 4 * (e - 1) + (int)((us >> (e - 2)) & 3);
+    return index < WAIT_BUCKETS ? index : WAIT_BUCKETS - 1;
+}
+
+// the upper edge of a bucket, in ms
+static double bucket_ms(int index) {
+    if (index < 4) return (index + 1) / 1000.0;
+    int e = index / 4 + 1;
+    uint64_t low = (uint64_t)(4 + index % 4) << (e - 2);
+    return (low + (1ULL << (e - 2))) / 1000.0;
+}
+
+// nearest rank: the bucket holding the ceil(p * samples)-th smallest wait
+static double percentile_ms(const long* counts, long samples, double p) {
+    if (samples == 0) return 0;
+    long rank = (long)ceil(p * samples) - 1;
+    if (rank < 0) rank = 0;
+    if (rank >= samples) rank = samples - 1;
+    long seen = 0;
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank) return bucket_ms(i);
+    }
+    return bucket_ms(WAIT_BUCKETS - 1);
+}
+
+// a plain store: the block has one writer, it only has to be whole for a reader
+#define store(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define load(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+void admission_record_wait(int64_t wait_ns) {
+    WaitBlock* block = my_block ? my_block : (my_block = thread_block_register(&blocks, sizeof(WaitBlock), NULL));
+    if (!block) return;
+    int64_t now = monotonic_ns();
+
+    int64_t second = now / WINDOW_NS;
+    WaitSlot* slot = &block->seconds[second & 1];
+    if (slot->second != second) {
+        for (int i = 0; i < WAIT_BUCKETS; i++) store(slot->counts[i], 0);
+        store(slot->samples, 0);
+        store(slot->max, 0);
+        store(slot->second, second);
+    }
+    int bucket = bucket_of(wait_ns);
+    store(slot->counts[bucket], slot->counts[bucket] + 1);
+    store(slot->samples, slot->samples + 1);
+    if (wait_ns > slot->max) store(slot->max, wait_ns);
+
+    int64_t interval = now / INTERVAL_NS;
+    IntervalSlot* in = &block->intervals[interval & 1];
+    if (in->interval != interval) {
+        store(in->samples, 0);
+        store(in->min, INT64_MAX);
+        store(in->interval, interval);
+    }
+    store(in->samples, in->samples + 1);
+    if (wait_ns < in->min) store(in->min, wait_ns);
+}
+
+// adds up every worker's waits of one second
+static void collect(int64_t second, WaitSlot* totals) {
+    memset(totals, 0, sizeof(*totals));
+    for (WaitBlock* block = thread_blocks(&blocks); block; block = (WaitBlock*)block->block.next) {
+        WaitSlot* slot = &block->seconds[second & 1];
+        if (load(slot->second) != second) continue;
+        for (int i = 0; i < WAIT_BUCKETS; i++) totals->counts[i] += load(slot->counts[i]);
+        totals->samples += load(slot->samples);
+        int64_t max = load(slot->max);
+        if (max > totals->max) totals->max = max;
+    }
+}
+
+// once per interval, the first caller past it decides for everyone whether the waits
+// of the intervals since the last check stood over the target
+static void check_interval(int64_t now) {
+    int64_t due = __atomic_load_n(&next_check, __ATOMIC_RELAXED);
+    int64_t interval = now / INTERVAL_NS;
+    if (now < due || !__atomic_compare_exchange_n(&next_check, &due, (interval + 1) * INTERVAL_NS, 0,
+                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // the intervals that ended since the last check, what a worker kept of them
+    int64_t since = due / INTERVAL_NS - 1;
+    long samples = 0;
+    int64_t min = INT64_MAX;
+    for (WaitBlock* block = thread_blocks(&blocks); block; block = (WaitBlock*)block->block.next) {
+        for (int k = 0; k < 2; k++) {
+            IntervalSlot* in = &block->intervals[k];
+            int64_t tag = load(in->interval);
+            if (tag < since || tag >= interval) continue;
+            samples += load(in->samples);
+            int64_t shortest = load(in->min);
+            if (shortest < min) min = shortest;
+        }
+    }
+
+    int was_overloaded = __atomic_load_n(&overloaded, __ATOMIC_RELAXED);
+    int now_overloaded = was_overloaded;
+    int64_t target = server_config.max_wait_ms * 1000000LL;
+    if (samples > 0) {
+        now_overloaded = target > 0 && min > target;
+        __atomic_store_n(&standing_wait, min, __ATOMIC_RELAXED);
+    } else if (scheduler_queued_tasks() == 0) {
+        now_overloaded = 0;              // idle, not stuck: nothing is waiting
+    }
+    // with tasks queued and none dispatched the workers are all busy, keep the verdict
+    if (now_overloaded == was_overloaded) return;
+    __atomic_store_n(&overloaded, now_overloaded, __ATOMIC_RELAXED);
+    if (now_overloaded) {
+        log_warn("[ADMISSION] Queue wait %.1f ms is over the %d ms target, refusing new commands\n",
+                 min / 1e6, server_config.max_wait_ms);
+    } else {
+        log_warn("[ADMISSION] Queue wait back under the %d ms target, taking new commands\n",
+                 server_config.max_wait_ms);
+    }
+}
+
+// how long a refused client should wait before trying again: about what a queued
+// command waits right now
+static uint32_t retry_hint_ms(int64_t now) {
+    WaitSlot waits;
+    collect(now / WINDOW_NS - 1, &waits);
+    if (waits.samples == 0) collect(now / WINDOW_NS, &waits);
+    double ms = percentile_ms(waits.counts, waits.samples, 0.5);
+    double standing = __atomic_load_n(&standing_wait, __ATOMIC_RELAXED) / 1e6;
+    if (__atomic_load_n(&overloaded, __ATOMIC_RELAXED) && standing > ms) ms = standing;
+    if (ms < MIN_RETRY_MS) return MIN_RETRY_MS;
+    if (ms > MAX_RETRY_MS) return MAX_RETRY_MS;
+    return (uint32_t)ms;
+}
+
+int admission_check(Connection* conn, uint32_t* retry_after_ms, char* reason, size_t reason_len) {
+    int client_limit = server_config.max_client_queue;
+    int global_limit = server_config.max_queued;
+    int inflight = __atomic_load_n(&conn->inflight, __ATOMIC_SEQ_CST);
+    int queued = global_limit > 0 ? scheduler_queued_tasks() : 0;
+    int64_t now = monotonic_ns();
+    if (server_config.max_wait_ms > 0) check_interval(now);
+
+    if (client_limit > 0 && inflight >= client_limit) {
+        snprintf(reason, reason_len, "Busy: you have %d commands queued or running (limit %d)\n",
+                 inflight, client_limit);
+    } else if (global_limit > 0 && queued >= global_limit) {
+        snprintf(reason, reason_len, "Busy: %d commands are waiting for a worker (limit %d)\n",
+                 queued, global_limit);
+    } else if (__atomic_load_n(&overloaded, __ATOMIC_RELAXED)) {
+        snprintf(reason, reason_len, "Busy: commands wait %.0f ms for a worker (target %d ms)\n",
+                 __atomic_load_n(&standing_wait, __ATOMIC_RELAXED) / 1e6, server_config.max_wait_ms);
+    } else {
+        return 0;
+    }
+    *retry_after_ms = retry_hint_ms(now);
+    __atomic_add_fetch(&busy_replies, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+static double at_most(double value, double limit) {
+    return value < limit ? value : limit;
+}
+
+void admission_stats(QueueWaitStats* stats) {
+    WaitSlot waits;
+    int64_t now = monotonic_ns();
+    if (server_config.max_wait_ms > 0) check_interval(now);
+    collect(now / WINDOW_NS - 1, &waits);
+    stats->samples = waits.samples;
+    stats->max_ms = waits.max / 1e6;
+    // a bucket's upper edge can be past the largest wait that landed in it
+    stats->p50_ms = at_most(percentile_ms(waits.counts, waits.samples, 0.5), stats->max_ms);
+    stats->p90_ms = at_most(percentile_ms(waits.counts, waits.samples, 0.9), stats->max_ms);
+    stats->p99_ms = at_most(percentile_ms(waits.counts, waits.samples, 0.99), stats->max_ms);
+    stats->overloaded = __atomic_load_n(&overloaded, __ATOMIC_RELAXED);
+    stats->queued = scheduler_queued_tasks();
+    stats->busy_replies = __atomic_load_n(&busy_replies, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+#define ARENA_ALIGN sizeof(void*)
+#define ARENA_BLOCK_SIZE 4096      // smallest overflow block; bigger requests get their own
+
+void arena_init(Arena* arena, void* initial, size_t size) {
+    arena->initial = initial;
+    arena->initial_size = size;
+    arena->blocks = NULL;
+    arena->ptr = initial;
+    arena->left = size;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    // keep every allocation pointer aligned
+    size_t pad = (ARENA_ALIGN - (uintptr_t)arena->ptr % ARENA_ALIGN) % ARENA_ALIGN;
+
+    if (pad + size > arena->left) {
+        size_t need = size + sizeof(ArenaBlock) + ARENA_ALIGN;
+        size_t block_size = need > ARENA_BLOCK_SIZE ? need : ARENA_BLOCK_SIZE;
+        ArenaBlock* block = malloc(block_size);
+        if (!block) return NULL;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->ptr = (char*)(block + 1);
+        arena->left = block_size - sizeof(ArenaBlock);
+        pad = (ARENA_ALIGN - (uintptr_t)arena->ptr % ARENA_ALIGN) % ARENA_ALIGN;
+    }
+
+    void* p = arena->ptr + pad;
+    arena->ptr += pad + size;
+    arena->left -= pad + size;
+    return p;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+    size_t len = strlen(str) + 1;
+    char* copy = arena_alloc(arena, len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
+
+void arena_reset(Arena* arena) {
+    while (arena->blocks) {
+        ArenaBlock* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->ptr = arena->initial;
+    arena->left = arena->initial_size;
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "builtins.h"
+#include "pathcache.h"
+
+extern char **environ;
+
+#define CAT_MAX_BYTES (64 * 1024)   // anything bigger is left to /bin/cat
+#define CAT_MAX_FILES 16            // so are more files than this
+
+typedef struct BuiltinCall {
+    Connection* conn;
+    uint32_t tag;
+    int argc;
+    char** argv;
+    const Session* session;
+    Session* changed;               // the new session after cd/export, NULL if unchanged
+    OutputCapture* capture;         // gets a copy of the output for the result cache, or NULL
+    uint64_t* sent;                 // counts the output bytes sent, or NULL
+} BuiltinCall;
+
+typedef struct Builtin {
+    const char* name;
+    int changes_session;            // runs at submit time (cd, export) rather than on a worker
+    int (*run)(BuiltinCall* call);  // exit code, or -1 to spawn the command after all
+} Builtin;
+
+static void send_output(BuiltinCall* call, uint8_t type, const void* data, size_t len) {
+    conn_send_frame(call->conn, type, 0, call->tag, data, len);
+    capture_append(call->capture, type, data, len);
+    if (call->sent) *call->sent += len;
+}
+
+// collects small writes into one STDOUT frame per 4 KB instead of a frame each
+typedef struct OutBuf {
+    BuiltinCall* call;
+    size_t len;
+    char data[4096];
+} OutBuf;
+
+static void out_flush(OutBuf* out) {
+    if (out->len > 0) {
+        send_output(out->call, FRAME_STDOUT, out->data, out->len);
+    }
+    out->len = 0;
+}
+
+static void out_write(OutBuf* out, const char* data, size_t len) {
+    while (len > 0) {
+        size_t n = sizeof(out->data) - out->len;
+        if (n > len) n = len;
+        memcpy(out->data + out->len, data, n);
+        out->len += n;
+        data += n;
+        len -= n;
+        if (out->len == sizeof(out->data)) out_flush(out);
+    }
+}
+
+static void report(BuiltinCall* call, const char* fmt, ...) {
+    char msg[PATH_MAX + 128];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    if (len > (int)sizeof(msg) - 1) len = sizeof(msg) - 1;
+    send_output(call, FRAME_STDERR, msg, len);
+}
+
+// path as the client means it: relative ones start at the session's cwd
+static const char* resolve_path(const Session* session, const char* path, char* buf, size_t size) {
+    if (path[0] == '/') return path;
+    char cwd_buf[PATH_MAX];
+    const char* cwd = session_cwd(session, cwd_buf, sizeof(cwd_buf));
+    if (!cwd || snprintf(buf, size, "%s/%s", cwd, path) >= (int)size) return NULL;
+    return buf;
+}
+
+static int builtin_true(BuiltinCall* call) {
+    return 0;
+}
+
+static int builtin_echo(BuiltinCall* call) {
+    int first = 1, newline = 1;
+    if (call->argc > 1 && call->argv[1][0] == '-' && call->argv[1][1] != '\0' &&
+        strspn(call->argv[1] + 1, "neE") == strlen(call->argv[1] + 1)) {
+        if (strcmp(call->argv[1], "-n") != 0) return -1;   // -e and friends: /bin/echo does those
+        newline = 0;
+        first = 2;
+    }
+
+    OutBuf out = { .call = call };
+    for (int i = first; i < call->argc; i++) {
+        if (i > first) out_write(&out, " ", 1);
+        out_write(&out, call->argv[i], strlen(call->argv[i]));
+    }
+    if (newline) out_write(&out, "\n", 1);
+    out_flush(&out);
+    return 0;
+}
+
+static int builtin_pwd(BuiltinCall* call) {
+    if (call->argc > 1) return -1;
+    char buf[PATH_MAX];
+    const char* cwd = session_cwd(call->session, buf, sizeof(buf));
+    if (!cwd) {
+        report(call, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    OutBuf out = { .call = call };
+    out_write(&out, cwd, strlen(cwd));
+    out_write(&out, "\n", 1);
+    out_flush(&out);
+    return 0;
+}
+
+// a file cat opened, or why it couldn't
+typedef struct CatFile {
+    int fd;                     // -1 if it couldn't be opened
+    int error;
+    off_t size;                 // as checked, no more is read
+} CatFile;
+
+static void cat_close(CatFile* files, int count) {
+    for (int i = 0; i < count; i++) {
+        if (files[i].fd >= 0) close(files[i].fd);
+    }
+}
+
+static int builtin_cat(BuiltinCall* call) {
+    char path_buf[PATH_MAX];
+    CatFile files[CAT_MAX_FILES];
+    off_t total = 0;
+    if (call->argc - 1 > CAT_MAX_FILES) return -1;
+
+    // decide before any output whether this is small enough to do here. the checks are
+    // on the open file, so what is read is what was checked, even if the path is swapped
+    // meanwhile; O_NONBLOCK keeps a fifo's open from waiting for a writer
+    for (int i = 1; i < call->argc; i++) {
+        CatFile* file = &files[i - 1];
+        const char* arg = call->argv[i];
+        *file = (CatFile){ .fd = -1 };
+        if (arg[0] == '-' && arg[1] != '\0') {
+            cat_close(files, i - 1);
+            return -1;                                          // options are /bin/cat's job
+        }
+        if (strcmp(arg, "-") == 0) continue;                   // stdin is /dev/null
+        const char* path = resolve_path(call->session, arg, path_buf, sizeof(path_buf));
+        file->fd = path ? open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC) : -1;
+        file->error = path ? errno : ENAMETOOLONG;
+        if (file->fd < 0) continue;                            // reported below
+        struct stat st;
+        if (fstat(file->fd, &st) < 0 || !S_ISREG(st.st_mode) || (total += st.st_size) > CAT_MAX_BYTES) {
+            cat_close(files, i);
+            return -1;
+        }
+        file->size = st.st_size;
+    }
+
+    int status = 0;
+    for (int i = 1; i < call->argc; i++) {
+        CatFile* file = &files[i - 1];
+        if (strcmp(call->argv[i], "-") == 0) continue;
+        if (file->fd < 0) {
+            report(call, "cat: %s: %s\n", call->argv[i], strerror(file->error));
+            status = 1;
+            continue;
+        }
+        char buf[16384];
+        ssize_t n = 0;
+        off_t left = file->size;
+        while (left > 0 && (n = read(file->fd, buf, left < (off_t)sizeof(buf) ? (size_t)left : sizeof(buf))) > 0) {
+            send_output(call, FRAME_STDOUT, buf, n);
+            left -= n;
+        }
+        if (n < 0) {
+            report(call, "cat: %s: %s\n", call->argv[i], strerror(errno));
+            status = 1;
+        }
+    }
+    cat_close(files, call->argc - 1);
+    return status;
+}
+
+// "hash" shows the PATH cache counters, "hash -r" empties it
+static int builtin_hash(BuiltinCall* call) {
+    if (call->argc == 2 && strcmp(call->argv[1], "-r") == 0) {
+        pathcache_flush();
+        return 0;
+    }
+    if (call->argc > 1) {
+        report(call, "hash: usage: hash [-r]\n");
+        return 2;
+    }
+
+    PathCacheStats stats;
+    pathcache_stats(&stats);
+    char text[256];
+    int len = snprintf(text, sizeof(text), "hits %lu\nmisses %lu\ninvalidations %lu\nentries %d\n",
+                       stats.hits, stats.misses, stats.invalidations, stats.entries);
+    send_output(call, FRAME_STDOUT, text, len);
+    return 0;
+}
+
+static int builtin_cd(BuiltinCall* call) {
+    if (call->argc > 2) {
+        report(call, "cd: too many arguments\n");
+        return 1;
+    }
+    const char* target = call->argc == 2 ? call->argv[1] : session_getenv(call->session, "HOME");
+    if (!target || !*target) {
+        report(call, "cd: HOME not set\n");
+        return 1;
+    }
+
+    char path_buf[PATH_MAX], resolved[PATH_MAX];
+    const char* path = resolve_path(call->session, target, path_buf, sizeof(path_buf));
+    struct stat st;
+    if (!path) errno = ENAMETOOLONG;
+    if (!path || !realpath(path, resolved) || stat(resolved, &st) < 0) {
+        report(call, "cd: %s: %s\n", target, strerror(errno));
+        return 1;
+    }
+    if (!S_ISDIR(st.st_mode) || access(resolved, X_OK) < 0) {
+        report(call, "cd: %s: %s\n", target, strerror(S_ISDIR(st.st_mode) ? errno : ENOTDIR));
+        return 1;
+    }
+
+    call->changed = session_with_cwd(call->session, resolved);
+    if (!call->changed) {
+        report(call, "cd: out of memory\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int valid_name(const char* s, size_t len) {
+    if (len == 0 || (s[0] >= '0' && s[0] <= '9')) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int builtin_export(BuiltinCall* call) {
+    if (call->argc == 1) {
+        // no arguments: list what commands will get
+        OutBuf out = { .call = call };
+        for (char** env = call->session ? call->session->env : environ; *env; env++) {
+            out_write(&out, *env, strlen(*env));
+            out_write(&out, "\n", 1);
+        }
+        out_flush(&out);
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; i < call->argc; i++) {
+        const char* arg = call->argv[i];
+        size_t name_len = strcspn(arg, "=");
+        if (!valid_name(arg, name_len)) {
+            report(call, "export: `%s': not a valid identifier\n", arg);
+            status = 1;
+            continue;
+        }
+        if (arg[name_len] != '=') continue;      // every variable is already exported
+
+        const Session* base = call->changed ? call->changed : call->session;
+        Session* next = session_with_env(base, arg);
+        if (!next) {
+            report(call, "export: out of memory\n");
+            return 1;
+        }
+        session_unref(call->changed);
+        call->changed = next;
+    }
+    return status;
+}
+
+static const Builtin builtins[] = {
+    { "cd", 1, builtin_cd },
+    { "export", 1, builtin_export },
+    { "echo", 0, builtin_echo },
+    { "pwd", 0, builtin_pwd },
+    { "true", 0, builtin_true },
+    { "cat", 0, builtin_cat },
+    { "hash", 0, builtin_hash },
+};
+
+static const Builtin* find_builtin(const char* name, int changes_session) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (builtins[i].changes_session == changes_session && strcmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+int builtin_session(Connection* conn, uint32_t tag, char* argv[], int argc) {
+    const Builtin* builtin = argc > 0 ? find_builtin(argv[0], 1) : NULL;
+    if (!builtin) return 0;
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (strcmp(a, "|") == 0 || strcmp(a, "<") == 0 || strcmp(a, ">") == 0 ||
+            strcmp(a, "2>") == 0 || strcmp(a, "2>&1") == 0) {
+            return 0;
+        }
+    }
+
+    BuiltinCall call = { .conn = conn, .tag = tag, .argc = argc, .argv = argv, .session = conn->session };
+    int status = builtin->run(&call);
+    if (call.changed) {
+        // tasks queued before this line keep their reference to the old session
+        session_unref(conn->session);
+        conn->session = call.changed;
+    }
+
+    uint32_t code = htonl(status);
+    conn_send_frame(conn, FRAME_EXIT, 0, tag, &code, sizeof(code));
+    conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+    return 1;
+}
+
+int builtin_run(const Stage* stage, const Session* session, Connection* conn, uint32_t tag,
+                OutputCapture* capture, uint64_t* sent) {
+    const Builtin* builtin = find_builtin(stage->argv[0], 0);
+    if (!builtin || stage->redirect_count > 0) return -1;
+
+    BuiltinCall call = { .conn = conn, .tag = tag, .argc = stage->argc, .argv = stage->argv, .session = session,
+                          .capture = capture, .sent = sent };
+    int status = builtin->run(&call);
+    return status < 0 ? -1 : status << 8;
+}
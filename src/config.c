@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "log.h"
+
+#define DEFAULT_PORT 8081
+#define DEFAULT_MAX_INFLIGHT 32
+#define DEFAULT_SPAWNERS 1
+#define MAX_SPAWNERS 64
+#define DEFAULT_CACHE_TTL_MS 2000
+#define MAX_WEIGHTS 256
+#define MAX_WEIGHT 1000
+#define DEFAULT_MAX_QUEUED 10000
+#define DEFAULT_OUTPUT_BUFFER_KB 256
+
+ServerConfig server_config = {
+    .port = DEFAULT_PORT,
+    .loops = 0,               // 0 = one per online core, resolved in parse_config
+    .workers = 0,             // 0 = one per online core as well
+    .max_inflight = DEFAULT_MAX_INFLIGHT,
+    .zero_copy = 1,
+    .spawners = DEFAULT_SPAWNERS,
+    .cache_allowlist = NULL,
+    .cache_ttl_ms = DEFAULT_CACHE_TTL_MS,
+    .weights = NULL,
+    .max_client_queue = 0,
+    .max_queued = DEFAULT_MAX_QUEUED,
+    .max_wait_ms = 0,
+    .output_buffer_kb = DEFAULT_OUTPUT_BUFFER_KB,
+    .log_level = LOG_LEVEL_DEBUG,
+    .stats_log = NULL,
+    .metrics_port = 0,
+    .trace_file = NULL,
+};
+
+typedef struct ClientWeight {
+    char ip[16];
+    int weight;
+} ClientWeight;
+
+static ClientWeight weights[MAX_WEIGHTS];
+static int weight_count = 0;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-p port] [-l event_loops] [-w workers] [-i max_inflight] [-z spawners] [-Z]\n"
+            "          [-C cache_allowlist] [-T cache_ttl_ms] [-W weights] [-q client_queue]\n"
+            "          [-Q max_queued] [-m max_wait_ms] [-b output_buffer_kb] [-L log_level]\n"
+            "          [-S stats_log] [-M metrics_port] [-t trace_file]\n"
+            "  -p port         TCP port to listen on (default %d)\n"
+            "  -l event_loops  number of epoll loops (default: one per core)\n"
+            "  -w workers      scheduler threads running tasks (default: one per core)\n"
+            "  -i max_inflight commands one client may have queued or running (default %d)\n"
+            "  -z spawners     helper processes that start commands, 0 = none (default %d)\n"
+            "  -Z              copy command output through user space instead of splice()\n"
+            "  -C file         cache results of the programs listed in file (one per line,\n"
+            "                  optionally followed by a TTL in ms)\n"
+            "  -T ttl_ms       how long a cached result is served (default %d)\n"
+            "  -W file         scheduling weights, one \"ip weight\" per line (default weight 1)\n"
+            "  -q client_queue commands one client may have queued or running before the\n"
+            "                  server answers BUSY instead of pausing it; below -i,\n"
+            "                  0 = off (default 0)\n"
+            "  -Q max_queued   commands waiting for a worker before the server answers\n"
+            "                  BUSY, 0 = off (default %d)\n"
+            "  -m max_wait_ms  answer BUSY while commands wait longer than this for a\n"
+            "                  worker, 0 = off (default 0)\n"
+            "  -b kb           output buffered for a client that doesn't read before its\n"
+            "                  commands are stopped (default %d)\n"
+            "  -L level        error, warn, info or debug (default debug, a line per step\n"
+            "                  of every command)\n"
+            "  -S file         append a CSV line per finished command to file: queue wait,\n"
+            "                  run time, CPU, peak memory and output bytes\n"
+            "  -M port         serve Prometheus metrics on 127.0.0.1:port/metrics, 0 = off\n"
+            "                  (default 0)\n"
+            "  -t file         record scheduling events per thread; the server-trace command\n"
+            "                  writes them to file as Chrome trace JSON\n",
+            prog, DEFAULT_PORT, DEFAULT_MAX_INFLIGHT, DEFAULT_SPAWNERS, DEFAULT_CACHE_TTL_MS,
+            DEFAULT_MAX_QUEUED, DEFAULT_OUTPUT_BUFFER_KB);
+    exit(1);
+}
+
+// reads a positive integer option value or bails out with the usage message
+static int positive_arg(const char* prog, const char* value) {
+    char* end;
+    long n = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || n <= 0 || n > 1000000) {
+        usage(prog);
+    }
+    return (int)n;
+}
+
+// like positive_arg, but 0 is allowed too (it turns a limit off)
+static int limit_arg(const char* prog, const char* value) {
+    return strcmp(value, "0") == 0 ? 0 : positive_arg(prog, value);
+}
+
+// reads "ip weight" lines, # starts a comment
+static void load_weights(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char ip[64];
+        int weight;
+        int fields = sscanf(line, "%63s %d", ip, &weight);
+        if (fields <= 0) continue;
+        if (fields != 2 || weight <= 0 || weight > MAX_WEIGHT || strlen(ip) >= sizeof(weights[0].ip) ||
+            weight_count == MAX_WEIGHTS) {
+            fprintf(stderr, "%s: bad line \"%s\" (want \"ip weight\", weight 1-%d)\n", path, ip, MAX_WEIGHT);
+            exit(1);
+        }
+        strcpy(weights[weight_count].ip, ip);
+        weights[weight_count++].weight = weight;
+    }
+    fclose(f);
+}
+
+int client_weight(const char* ip) {
+    for (int i = 0; i < weight_count; i++) {
+        if (strcmp(weights[i].ip, ip) == 0) return weights[i].weight;
+    }
+    return 1;
+}
+
+void parse_config(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:w:i:z:ZC:T:W:q:Q:m:b:L:S:M:t:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            server_config.port = positive_arg(argv[0], optarg);
+            if (server_config.port > 65535) usage(argv[0]);
+            break;
+        case 'l':
+            server_config.loops = positive_arg(argv[0], optarg);
+            break;
+        case 'w':
+            server_config.workers = positive_arg(argv[0], optarg);
+            break;
+        case 'i':
+            server_config.max_inflight = positive_arg(argv[0], optarg);
+            break;
+        case 'z':
+            // 0 is allowed here: the workers then spawn commands themselves
+            server_config.spawners = limit_arg(argv[0], optarg);
+            if (server_config.spawners > MAX_SPAWNERS) usage(argv[0]);
+            break;
+        case 'Z':
+            server_config.zero_copy = 0;
+            break;
+        case 'C':
+            server_config.cache_allowlist = optarg;
+            break;
+        case 'T':
+            server_config.cache_ttl_ms = positive_arg(argv[0], optarg);
+            break;
+        case 'W':
+            server_config.weights = optarg;
+            load_weights(optarg);
+            break;
+        case 'q':
+            server_config.max_client_queue = limit_arg(argv[0], optarg);
+            break;
+        case 'Q':
+            server_config.max_queued = limit_arg(argv[0], optarg);
+            break;
+        case 'm':
+            server_config.max_wait_ms = limit_arg(argv[0], optarg);
+            break;
+        case 'b':
+            server_config.output_buffer_kb = positive_arg(argv[0], optarg);
+            break;
+        case 'L':
+            server_config.log_level = log_level_parse(optarg);
+            if (server_config.log_level < 0) usage(argv[0]);
+            break;
+        case 'S':
+            server_config.stats_log = optarg;
+            break;
+        case 't':
+            server_config.trace_file = optarg;
+            break;
+        case 'M':
+            server_config.metrics_port = limit_arg(argv[0], optarg);
+            if (server_config.metrics_port > 65535) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // a client is paused at max_inflight, so a BUSY limit at or past it would never be reached
+    if (server_config.max_client_queue >= server_config.max_inflight) {
+        fprintf(stderr, "%s: -q %d must be below -i %d, clients are paused at %d commands\n", argv[0],
+                server_config.max_client_queue, server_config.max_inflight, server_config.max_inflight);
+        exit(1);
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 0) cores = 1;
+    if (server_config.loops == 0) server_config.loops = (int)cores;
+    if (server_config.workers == 0) server_config.workers = (int)cores;
+}
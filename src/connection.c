@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include "connection.h"
+#include "session.h"
+#include "config.h"
+#include "log.h"
+
+#define INBUF_INITIAL 256       // first allocation for a split command line
+#define SMALL_FRAME 4096        // payloads up to this size are copied behind the header
+#define OUTBUF_INITIAL 16384    // first allocation of the output ring
+#define OUTPUT_HARD_FACTOR 8    // a client this many limits behind is disconnected
+
+Connection* conn_create(int fd, int client_id, int loop_id, LoopNotifier* notifier,
+                        const struct sockaddr_in* addr) {
+    Connection* conn = calloc(1, sizeof(Connection));
+    if (!conn) return NULL;
+
+    conn->fd = fd;
+    conn->client_id = client_id;
+    conn->loop_id = loop_id;
+    conn->notifier = notifier;
+    conn->next_tag = 1;
+    inet_ntop(AF_INET, &addr->sin_addr, conn->ip, sizeof(conn->ip));
+    conn->port = ntohs(addr->sin_port);
+    conn->refcount = 1;                      // the event loop's reference
+    conn->weight = 1;
+    pthread_mutex_init(&conn->send_mutex, NULL);
+    pthread_mutex_init(&conn->task_lock, NULL);
+    return conn;
+}
+
+void conn_ref(Connection* conn) {
+    __atomic_add_fetch(&conn->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void conn_unref(Connection* conn) {
+    if (!conn) return;
+    if (__atomic_sub_fetch(&conn->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    // its last task is gone too, so the totals are final. clients that never got a
+    // worker (cache hits only, or no commands) have nothing to report
+    if (conn->run_ns > 0) {
+        log_info("[FAIR] Client #%d used %.1f ms of worker time, its commands %.1f ms of CPU (weight %d)\n",
+                 conn->client_id, conn->run_ns / 1e6, conn->cpu_ns / 1e6, conn->weight);
+    }
+
+    // nobody can send on it anymore, so the fd number is safe to reuse now
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->send_mutex);
+    pthread_mutex_destroy(&conn->task_lock);
+    free(conn->inbuf);
+    free(conn->outbuf);
+    session_unref(conn->session);
+    free(conn);
+}
+
+void conn_close(Connection* conn) {
+    if (__atomic_exchange_n(&conn->closed, 1, __ATOMIC_ACQ_REL)) return;
+    shutdown(conn->fd, SHUT_RDWR);           // wakes up anyone still sending to it
+}
+
+int conn_is_closed(Connection* conn) {
+    return __atomic_load_n(&conn->closed, __ATOMIC_ACQUIRE);
+}
+
+int conn_buffer_append(Connection* conn, const char* data, size_t len) {
+    if (conn->inlen + len > conn->incap) {
+        size_t cap = conn->incap ? conn->incap : INBUF_INITIAL;
+        while (cap < conn->inlen + len) cap *= 2;
+        char* grown = realloc(conn->inbuf, cap);
+        if (!grown) return -1;
+        conn->inbuf = grown;
+        conn->incap = cap;
+    }
+    memcpy(conn->inbuf + conn->inlen, data, len);
+    conn->inlen += len;
+    return 0;
+}
+
+void conn_buffer_consume(Connection* conn, size_t len) {
+    if (len >= conn->inlen) {
+        // give the memory back so idle connections cost only the struct
+        free(conn->inbuf);
+        conn->inbuf = NULL;
+        conn->inlen = 0;
+        conn->incap = 0;
+        return;
+    }
+    memmove(conn->inbuf, conn->inbuf + len, conn->inlen - len);
+    conn->inlen -= len;
+}
+
+int conn_should_pause(Connection* conn, int limit) {
+    if (__atomic_load_n(&conn->inflight, __ATOMIC_SEQ_CST) < limit) return 0;
+
+    __atomic_store_n(&conn->paused, 1, __ATOMIC_SEQ_CST);
+    // a command may have finished between the check and setting the flag. if we can
+    // still take the flag back ourselves there is no wakeup coming, so carry on
+    if (__atomic_load_n(&conn->inflight, __ATOMIC_SEQ_CST) < limit &&
+        __atomic_exchange_n(&conn->paused, 0, __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+    return 1;
+}
+
+void conn_command_started(Connection* conn) {
+    __atomic_add_fetch(&conn->inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+void conn_command_finished(Connection* conn) {
+    if (!conn) return;
+    __atomic_sub_fetch(&conn->inflight, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&conn->paused, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&conn->paused, 0, __ATOMIC_SEQ_CST)) {
+        conn_notify_loop(conn);                // the loop picks up the buffered commands
+    }
+}
+
+int notifier_init(LoopNotifier* notifier) {
+    notifier->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notifier->efd < 0) return -1;
+    pthread_mutex_init(&notifier->lock, NULL);
+    notifier->pending = NULL;
+    return 0;
+}
+
+void conn_notify_loop(Connection* conn) {
+    LoopNotifier* notifier = conn->notifier;
+
+    pthread_mutex_lock(&notifier->lock);
+    if (!conn->notify_queued) {
+        conn->notify_queued = 1;
+        conn_ref(conn);                        // the list holds a reference until the loop is done
+        conn->notify_next = notifier->pending;
+        notifier->pending = conn;
+    }
+    pthread_mutex_unlock(&notifier->lock);
+
+    uint64_t one = 1;
+    if (write(notifier->efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("[ERROR] eventfd write failed");
+    }
+}
+
+void notifier_drain(LoopNotifier* notifier) {
+    uint64_t count;
+    while (read(notifier->efd, &count, sizeof(count)) > 0) {
+        // just resets the counter, the pending list is what matters
+    }
+}
+
+Connection* notifier_pop(LoopNotifier* notifier) {
+    pthread_mutex_lock(&notifier->lock);
+    Connection* conn = notifier->pending;
+    if (conn) {
+        notifier->pending = conn->notify_next;
+        conn->notify_queued = 0;               // may be queued again from here on
+    }
+    pthread_mutex_unlock(&notifier->lock);
+    return conn;
+}
+
+static size_t output_limit(void) {
+    return (size_t)server_config.output_buffer_kb * 1024;
+}
+
+size_t conn_send_room(Connection* conn) {
+    if (__atomic_load_n(&conn->out_len, __ATOMIC_RELAXED) > 0) return 0;
+    int sndbuf = 0, queued = 0;
+    socklen_t len = sizeof(sndbuf);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0 ||
+        ioctl(conn->fd, SIOCOUTQ, &queued) < 0) {
+        return 0;
+    }
+    // SO_SNDBUF counts the kernel's overhead too, leave it a quarter. the estimate has
+    // to be about where poll() calls the socket writable again, or a worker waiting
+    // for room would wake to find too little of it
+    size_t room = sndbuf > queued ? (size_t)(sndbuf - queued) : 0;
+    return room - room / 4;
+}
+
+int conn_output_full(Connection* conn) {
+    return !conn_is_closed(conn) && __atomic_load_n(&conn->out_len, __ATOMIC_RELAXED) >= output_limit();
+}
+
+// copies the ring's contents to dst in order
+static void ring_copy_out(Connection* conn, char* dst) {
+    size_t first = conn->out_cap - conn->out_head;
+    if (first > conn->out_len) first = conn->out_len;
+    memcpy(dst, conn->outbuf + conn->out_head, first);
+    memcpy(dst + first, conn->outbuf, conn->out_len - first);
+}
+
+// queues len bytes behind what is buffered. the caller holds send_mutex
+static int ring_append(Connection* conn, const void* data, size_t len) {
+    if (len == 0) return 0;
+    size_t need = conn->out_len + len;
+    if (need > output_limit() * OUTPUT_HARD_FACTOR) {
+        log_error("[ERROR] Client #%d is not reading its output (%zu bytes waiting), disconnecting.\n",
+                  conn->client_id, conn->out_len);
+        conn_close(conn);
+        return -1;
+    }
+    if (need > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : OUTBUF_INITIAL;
+        while (cap < need) cap *= 2;
+        char* grown = malloc(cap);
+        if (!grown) {
+            conn_close(conn);                // the stream would have a hole, end it
+            return -1;
+        }
+        if (conn->outbuf) ring_copy_out(conn, grown);
+        free(conn->outbuf);
+        conn->outbuf = grown;
+        conn->out_cap = cap;
+        conn->out_head = 0;
+    }
+
+    size_t tail = (conn->out_head + conn->out_len) % conn->out_cap;
+    size_t first = conn->out_cap - tail;
+    if (first > len) first = len;
+    memcpy(conn->outbuf + tail, data, first);
+    memcpy(conn->outbuf, (const char*)data + first, len - first);
+    __atomic_store_n(&conn->out_len, need, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// sends what the ring holds until the socket is full. the caller holds send_mutex
+static int ring_flush(Connection* conn) {
+    while (conn->out_len > 0) {
+        struct iovec iov[2];
+        size_t first = conn->out_cap - conn->out_head;
+        if (first > conn->out_len) first = conn->out_len;
+        iov[0].iov_base = conn->outbuf + conn->out_head;
+        iov[0].iov_len = first;
+        iov[1].iov_base = conn->outbuf;
+        iov[1].iov_len = conn->out_len - first;
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iov[1].iov_len > 0 ? 2 : 1 };
+
+        ssize_t sent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;  // EPOLLOUT brings us back
+        if (sent <= 0) return -1;
+        conn->out_head = (conn->out_head + sent) % conn->out_cap;
+        __atomic_store_n(&conn->out_len, conn->out_len - sent, __ATOMIC_RELAXED);
+    }
+    // drained: give the memory back so idle connections cost only the struct
+    free(conn->outbuf);
+    conn->outbuf = NULL;
+    conn->out_cap = 0;
+    conn->out_head = 0;
+    return 0;
+}
+
+// sends data, or queues it behind output that is already waiting. never blocks: the
+// socket is non-blocking and a send that would block leaves the rest in the ring, with
+// EPOLLOUT armed by that EAGAIN. the caller holds send_mutex
+static int send_locked(Connection* conn, const void* data, size_t len) {
+    const char* p = data;
+
+    while (conn->out_len == 0 && len > 0) {
+        ssize_t sent = send(conn->fd, p, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            p += sent;
+            len -= sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        // peer reset or shut down. its loop hears of it by EPOLLHUP, even if it stopped reading
+        if (!conn_is_closed(conn)) {
+            log_info("[INFO] Client #%d - %s:%d disconnected.\n", conn->client_id, conn->ip, conn->port);
+            conn_close(conn);
+        }
+        return -1;
+    }
+    return ring_append(conn, p, len);
+}
+
+int conn_flush_output(Connection* conn, struct Task** parked) {
+    if (parked) *parked = NULL;
+    if (__atomic_load_n(&conn->out_len, __ATOMIC_RELAXED) == 0) return 0;  // nothing parks on an empty ring
+
+    pthread_mutex_lock(&conn->send_mutex);
+    int result = conn_is_closed(conn) ? -1 : ring_flush(conn);
+    if (result < 0) conn_close(conn);
+    int notify = 0;
+    if (result == 0 && conn->out_len <= output_limit() / 2 && conn->parked) {
+        if (parked) {
+            *parked = conn->parked;
+            conn->parked = NULL;
+        } else {
+            notify = 1;                      // the ring may be empty now, no EPOLLOUT is coming
+        }
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    if (notify) conn_notify_loop(conn);
+    return result;
+}
+
+int conn_send_frame(Connection* conn, uint8_t type, uint8_t flags, uint32_t tag,
+                    const void* payload, uint32_t len) {
+    if (!conn || conn_is_closed(conn)) return -1;
+
+    unsigned char frame[FRAME_HEADER_SIZE + SMALL_FRAME];
+    frame_encode(frame, type, flags, tag, len);
+
+    pthread_mutex_lock(&conn->send_mutex);
+    int result;
+    if (len <= SMALL_FRAME) {
+        // one send for the common case of a short chunk
+        if (len > 0) memcpy(frame + FRAME_HEADER_SIZE, payload, len);
+        result = send_locked(conn, frame, FRAME_HEADER_SIZE + len);
+    } else {
+        result = send_locked(conn, frame, FRAME_HEADER_SIZE);
+        if (result == 0) result = send_locked(conn, payload, len);
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    return result;
+}
+
+int conn_splice_frame(Connection* conn, uint8_t type, uint8_t flags, uint32_t tag,
+                      int pipe_fd, uint32_t len) {
+    if (!conn || conn_is_closed(conn)) return -1;
+
+    unsigned char header[FRAME_HEADER_SIZE];
+    frame_encode(header, type, flags, tag, len);
+
+    pthread_mutex_lock(&conn->send_mutex);
+    int result = send_locked(conn, header, sizeof(header));
+    size_t remaining = len;
+
+    // splice only while nothing is buffered, the payload has to go out after the header
+    while (result == 0 && remaining > 0 && conn->out_len == 0) {
+        ssize_t moved = splice(pipe_fd, NULL, conn->fd, NULL, remaining,
+                               SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            remaining -= moved;
+            continue;
+        }
+        if (moved < 0 && errno == EINTR) continue;
+        if (moved < 0 && conn_is_closed(conn)) result = -1;
+        // EAGAIN: the pipe holds `remaining` bytes, so it is the socket that is full.
+        // anything else: this socket/pipe pair cannot splice. either way the rest is copied
+        break;
+    }
+
+    // the socket didn't take the whole payload: move the rest of it into the ring
+    char buffer[4096];
+    while (result == 0 && remaining > 0) {
+        ssize_t bytes = read(pipe_fd, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer));
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) {
+            result = -1;                     // cannot happen with bytes still in the pipe
+            break;
+        }
+        result = send_locked(conn, buffer, bytes);
+        remaining -= bytes;
+    }
+
+    if (result < 0 && remaining > 0 && !conn_is_closed(conn)) {
+        // the frame is cut short and the stream can no longer be parsed
+        conn_close(conn);
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    return result;
+}
@@ -0,0 +1,678 @@
+// load generator: N connections send a weighted mix of commands for T seconds and the
+// run is reported as throughput and latency percentiles per command, to the terminal
+// and optionally as CSV and JSON.
+//
+//   ./loadgen -c 8 -d 4 -t 10 -m mix.txt              closed loop: D commands in flight per connection
+//   ./loadgen -c 8 -r 500 -t 10 -m mix.txt            open loop: 500 commands/s over all connections
+//   ./loadgen -x "echo x" -o run.csv -j run.json
+//
+// a mix file has one command per line, optionally after a weight ("3 echo x" is sent
+// three times as often as a weight 1 line); blank lines and lines starting with # are
+// skipped. which command goes next is drawn from a seeded generator (-s), so two runs
+// with the same mix and seed send the same sequence on each connection.
+//
+// latency is from sending a line to its DONE frame, time to first byte from sending it
+// to the first frame of its reply (output, or EXIT for a command that prints nothing).
+// in open loop mode a command is sent at a fixed interval whatever the replies do, and
+// both are counted from when it was due to go out, so a stalled server shows up as
+// latency instead of as fewer commands sent. commands refused with BUSY or answered
+// with ERROR are counted apart and not in the percentiles; in closed loop mode the
+// connection waits out BUSY's retry-after hint before it sends the next one. nothing
+// is sent after T seconds; the replies still outstanding then get up to DRAIN_SECONDS
+// and count in the percentiles, but only DONEs inside the T seconds count in the
+// throughput.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+#define PORT 8081
+#define DRAIN_SECONDS 10
+#define READ_CHUNK 65536
+#define LINE_SIZE 4096
+#define SLOTS_INITIAL 64
+
+typedef struct Samples {
+    int64_t* values;            // ns
+    long count;
+    long cap;
+} Samples;
+
+// one command of the mix and what happened to it
+typedef struct MixEntry {
+    char* line;                 // the command followed by a newline
+    size_t len;
+    double weight;
+    long sent;                  // during the run
+    long completed;             // DONE (not BUSY or ERROR) inside the run, for the throughput
+    long errors;
+    long failed;                // exited non-zero or killed
+    long busy;
+    Samples latency;
+    Samples ttfb;
+} MixEntry;
+
+// a command in flight, in the slot its tag hashes to
+typedef struct Request {
+    uint32_t tag;
+    int live;
+    int entry;
+    int64_t sent_ns;            // when it was due to be sent
+    int64_t first_ns;           // its first reply frame, 0 until then
+    int error;
+    int busy;
+    int failed;
+} Request;
+
+typedef struct Conn {
+    int fd;
+    int closed;
+    uint32_t next_tag;          // the server numbers our lines 1, 2, 3...
+    int in_flight;
+    int deferred;               // closed loop: commands to send once resume_at has passed
+    int64_t resume_at;
+    Request* slots;
+    uint32_t slot_count;        // a power of two
+    uint64_t rng;               // picks this connection's commands
+
+    char* out;                  // lines the socket didn't take yet
+    size_t out_len;
+    size_t out_cap;
+    int want_out;               // EPOLLOUT is on
+
+    unsigned char header[FRAME_HEADER_SIZE];
+    size_t header_have;
+    FrameHeader frame;
+    uint32_t payload_left;
+    unsigned char word[4];      // first payload bytes: EXIT's code, BUSY's retry-after
+} Conn;
+
+static MixEntry* mix;
+static int mix_count;
+static double weight_total;
+static Conn* conns;
+static int conn_count = 4;
+static int epoll_fd;
+static int64_t run_start, run_end;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void* xrealloc(void* ptr, size_t size) {
+    void* grown = realloc(ptr, size);
+    if (!grown) {
+        perror("realloc");
+        exit(1);
+    }
+    return grown;
+}
+
+static void samples_add(Samples* s, int64_t value) {
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->values = xrealloc(s->values, sizeof(int64_t) * s->cap);
+    }
+    s->values[s->count++] = value;
+}
+
+// xorshift64*, a uniform double in [0, 1)
+static double rng_uniform(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static int pick_entry(Conn* c) {
+    double pick = rng_uniform(&c->rng) * weight_total;
+    for (int i = 0; i < mix_count - 1; i++) {
+        if (pick < mix[i].weight) return i;
+        pick -= mix[i].weight;
+    }
+    return mix_count - 1;
+}
+
+static void add_entry(const char* command, double weight) {
+    mix = xrealloc(mix, sizeof(MixEntry) * (mix_count + 1));
+    MixEntry* e = &mix[mix_count++];
+    memset(e, 0, sizeof(*e));
+    e->len = strlen(command) + 1;
+    e->line = malloc(e->len + 1);
+    if (!e->line) {
+        perror("malloc");
+        exit(1);
+    }
+    snprintf(e->line, e->len + 1, "%s\n", command);
+    e->weight = weight;
+    weight_total += weight;
+}
+
+// reads "[weight] command" lines. returns -1 if the file is unreadable or has no command
+static int load_mix(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[LINE_SIZE];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* command = line + strspn(line, " \t");
+        if (*command == '\0' || *command == '#') continue;
+        char* end;
+        double weight = strtod(command, &end);
+        if (end != command && (*end == ' ' || *end == '\t')) {
+            command = end + strspn(end, " \t");
+        } else {
+            weight = 1;                 // no weight, the whole line is the command
+        }
+        if (weight <= 0 || *command == '\0') continue;
+        add_entry(command, weight);
+    }
+    fclose(f);
+    if (mix_count == 0) {
+        fprintf(stderr, "%s: no commands\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static Request* find_request(Conn* c, uint32_t tag) {
+    Request* r = &c->slots[tag & (c->slot_count - 1)];
+    return r->live && r->tag == tag ? r : NULL;
+}
+
+// makes room for tag: the table doubles until every live request has a slot of its own
+static Request* claim_slot(Conn* c, uint32_t tag) {
+    while (c->slots[tag & (c->slot_count - 1)].live) {
+        uint32_t count = c->slot_count;
+        Request* grown = NULL;
+        int clash = 1;
+        while (clash) {
+            count *= 2;
+            free(grown);
+            grown = calloc(count, sizeof(Request));
+            if (!grown) {
+                perror("calloc");
+                exit(1);
+            }
+            clash = 0;
+            for (uint32_t i = 0; i < c->slot_count && !clash; i++) {
+                Request* r = &c->slots[i];
+                if (!r->live) continue;
+                if (grown[r->tag & (count - 1)].live) clash = 1;
+                else grown[r->tag & (count - 1)] = *r;
+            }
+        }
+        free(c->slots);
+        c->slots = grown;
+        c->slot_count = count;
+    }
+    return &c->slots[tag & (c->slot_count - 1)];
+}
+
+static void set_want_out(Conn* c, int want) {
+    if (c->want_out == want) return;
+    struct epoll_event ev = { .events = EPOLLIN | (want ? EPOLLOUT : 0), .data.ptr = c };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want;
+}
+
+static void close_conn(Conn* c, const char* why) {
+    if (c->closed) return;
+    fprintf(stderr, "connection %ld: %s, %d command(s) lost\n", (long)(c - conns), why, c->in_flight);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->closed = 1;
+}
+
+static void flush_out(Conn* c) {
+    size_t done = 0;
+    while (done < c->out_len) {
+        ssize_t n = send(c->fd, c->out + done, c->out_len - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        if (n < 0) {
+            close_conn(c, strerror(errno));
+            return;
+        }
+        done += n;
+    }
+    memmove(c->out, c->out + done, c->out_len - done);
+    c->out_len -= done;
+    set_want_out(c, c->out_len > 0);
+}
+
+// sends the next command of the mix on c, due at due_ns
+static void send_command(Conn* c, int64_t due_ns) {
+    if (c->closed) return;
+    int index = pick_entry(c);
+    MixEntry* e = &mix[index];
+    uint32_t tag = ++c->next_tag;
+    Request* r = claim_slot(c, tag);
+    memset(r, 0, sizeof(*r));
+    r->tag = tag;
+    r->live = 1;
+    r->entry = index;
+    r->sent_ns = due_ns;
+    c->in_flight++;
+    e->sent++;
+
+    if (c->out_len + e->len > c->out_cap) {
+        c->out_cap = (c->out_len + e->len) * 2;
+        c->out = xrealloc(c->out, c->out_cap);
+    }
+    memcpy(c->out + c->out_len, e->line, e->len);
+    c->out_len += e->len;
+    flush_out(c);
+}
+
+// a DONE arrived: the request is counted, and in closed loop mode replaced
+static void finish_request(Conn* c, Request* r, int64_t now, int closed_loop) {
+    MixEntry* e = &mix[r->entry];
+    if (r->busy) {
+        e->busy++;
+    } else if (r->error) {
+        e->errors++;
+    } else {
+        if (now < run_end) e->completed++;
+        if (r->failed) e->failed++;
+        samples_add(&e->latency, now - r->sent_ns);
+        samples_add(&e->ttfb, (r->first_ns ? r->first_ns : now) - r->sent_ns);
+    }
+    int busy = r->busy;
+    r->live = 0;
+    c->in_flight--;
+    if (!closed_loop || now >= run_end) return;
+    // a refused command is sent again after the server's retry-after hint, not right away
+    if (busy || c->resume_at > now) c->deferred++;
+    else send_command(c, now);
+}
+
+static void handle_frame(Conn* c, int64_t now, int closed_loop) {
+    Request* r = find_request(c, c->frame.tag);
+    if (!r) return;                     // not ours, e.g. a blank line in the mix
+    if (!r->first_ns) r->first_ns = now;
+    switch (c->frame.type) {
+    case FRAME_ERROR: r->error = 1; break;
+    case FRAME_BUSY:
+        r->busy = 1;
+        if (c->frame.length >= 4) {
+            uint32_t retry_ms = (uint32_t)c->word[0] << 24 | c->word[1] << 16 | c->word[2] << 8 | c->word[3];
+            int64_t resume = now + retry_ms * 1000000LL;
+            if (resume > c->resume_at) c->resume_at = resume;
+        }
+        break;
+    case FRAME_EXIT:
+        if (c->frame.length >= 4 &&
+            ((c->frame.flags & FRAME_FLAG_SIGNALED) || memcmp(c->word, "\0\0\0\0", 4) != 0)) {
+            r->failed = 1;
+        }
+        break;
+    case FRAME_DONE: finish_request(c, r, now, closed_loop); break;
+    }
+}
+
+// parses whatever the socket has: headers, then payloads, which are skipped
+static void read_replies(Conn* c, int closed_loop) {
+    static unsigned char buf[READ_CHUNK];
+    while (!c->closed) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) {
+            close_conn(c, n == 0 ? "closed by the server" : strerror(errno));
+            return;
+        }
+        int64_t now = now_ns();
+        size_t pos = 0;
+        while (pos < (size_t)n) {
+            if (c->header_have < FRAME_HEADER_SIZE) {
+                size_t take = FRAME_HEADER_SIZE - c->header_have;
+                if (take > n - pos) take = n - pos;
+                memcpy(c->header + c->header_have, buf + pos, take);
+                c->header_have += take;
+                pos += take;
+                if (c->header_have < FRAME_HEADER_SIZE) break;
+                frame_decode(c->header, &c->frame);
+                c->payload_left = c->frame.length;
+                memset(c->word, 0, sizeof(c->word));
+            }
+            size_t take = c->payload_left < n - pos ? c->payload_left : n - pos;
+            if (c->frame.type == FRAME_EXIT || c->frame.type == FRAME_BUSY) {
+                size_t offset = c->frame.length - c->payload_left;
+                for (size_t i = 0; i < take && offset + i < sizeof(c->word); i++) {
+                    c->word[offset + i] = buf[pos + i];
+                }
+            }
+            c->payload_left -= take;
+            pos += take;
+            if (c->payload_left == 0) {
+                handle_frame(c, now, closed_loop);
+                c->header_have = 0;
+            }
+        }
+    }
+}
+
+static int open_conn(Conn* c, const struct sockaddr_in* addr, uint64_t seed) {
+    memset(c, 0, sizeof(*c));
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        close(c->fd);
+        return -1;
+    }
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    c->slot_count = SLOTS_INITIAL;
+    c->slots = calloc(c->slot_count, sizeof(Request));
+    if (!c->slots) return -1;
+    c->rng = seed ? seed : 1;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank on sorted samples, in ms: the ceil(q * count)-th smallest
+static double percentile(const Samples* s, double q) {
+    if (s->count == 0) return 0;
+    long index = (long)ceil(q * s->count) - 1;
+    if (index < 0) index = 0;
+    if (index >= s->count) index = s->count - 1;
+    return s->values[index] / 1e6;
+}
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+#define QUANTILES 5
+
+// a row of the report: one mix entry, or all of them together
+typedef struct Row {
+    const char* command;
+    double weight;
+    long sent, done, errors, failed, busy, unfinished;
+    double throughput;          // DONEs inside the run per second
+    double latency[QUANTILES];
+    double ttfb[QUANTILES];
+} Row;
+
+static void fill_row(Row* row, const char* command, double weight, MixEntry* e, double seconds) {
+    qsort(e->latency.values, e->latency.count, sizeof(int64_t), compare_int64);
+    qsort(e->ttfb.values, e->ttfb.count, sizeof(int64_t), compare_int64);
+    row->command = command;
+    row->weight = weight;
+    row->sent = e->sent;
+    row->done = e->latency.count;
+    row->errors = e->errors;
+    row->failed = e->failed;
+    row->busy = e->busy;
+    row->unfinished = e->sent - e->latency.count - e->errors - e->busy;
+    row->throughput = e->completed / seconds;
+    for (int q = 0; q < QUANTILES; q++) {
+        row->latency[q] = percentile(&e->latency, quantiles[q]);
+        row->ttfb[q] = percentile(&e->ttfb, quantiles[q]);
+    }
+}
+
+// the entries' counters and samples added up, as one more entry
+static void merge_all(MixEntry* all) {
+    memset(all, 0, sizeof(*all));
+    for (int i = 0; i < mix_count; i++) {
+        MixEntry* e = &mix[i];
+        all->sent += e->sent;
+        all->completed += e->completed;
+        all->errors += e->errors;
+        all->failed += e->failed;
+        all->busy += e->busy;
+        for (long k = 0; k < e->latency.count; k++) samples_add(&all->latency, e->latency.values[k]);
+        for (long k = 0; k < e->ttfb.count; k++) samples_add(&all->ttfb, e->ttfb.values[k]);
+    }
+}
+
+static void print_rows(const Row* rows, int count, int ttfb) {
+    printf("\n%s\n%-32s %7s %8s %9s %7s %7s %6s %9s %9s %9s %9s %9s\n",
+           ttfb ? "time to first byte (ms)" : "latency (ms)", "command", "weight", "done", "cmds/s", "errors",
+           "failed", "busy", "p50", "p90", "p99", "p99.9", "max");
+    for (int i = 0; i < count; i++) {
+        const Row* row = &rows[i];
+        const double* v = ttfb ? row->ttfb : row->latency;
+        printf("%-32.32s %7.1f %8ld %9.1f %7ld %7ld %6ld %9.3f %9.3f %9.3f %9.3f %9.3f\n", row->command,
+               row->weight, row->done, row->throughput, row->errors, row->failed, row->busy,
+               v[0], v[1], v[2], v[3], v[4]);
+    }
+}
+
+static void csv_field(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"') fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int write_csv(const char* path, const Row* rows, int count) {
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "command,weight,sent,done,errors,failed,busy,unfinished,throughput,"
+               "latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_p999_ms,latency_max_ms,"
+               "ttfb_p50_ms,ttfb_p90_ms,ttfb_p99_ms,ttfb_p999_ms,ttfb_max_ms\n");
+    for (int i = 0; i < count; i++) {
+        const Row* row = &rows[i];
+        csv_field(f, row->command);
+        fprintf(f, ",%g,%ld,%ld,%ld,%ld,%ld,%ld,%.3f", row->weight, row->sent, row->done, row->errors,
+                row->failed, row->busy, row->unfinished, row->throughput);
+        for (int q = 0; q < QUANTILES; q++) fprintf(f, ",%.3f", row->latency[q]);
+        for (int q = 0; q < QUANTILES; q++) fprintf(f, ",%.3f", row->ttfb[q]);
+        fputc('\n', f);
+    }
+    return fclose(f);
+}
+
+static void json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void json_quantiles(FILE* f, const char* name, const double* v) {
+    fprintf(f, "\"%s\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}",
+            name, v[0], v[1], v[2], v[3], v[4]);
+}
+
+static int write_json(const char* path, const Row* rows, int count, double seconds, int depth, double rate) {
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "{\"mode\":\"%s\",\"connections\":%d,\"depth\":%d,\"rate\":%g,\"duration_s\":%g,\"results\":[",
+            rate > 0 ? "open" : "closed", conn_count, rate > 0 ? 0 : depth, rate, seconds);
+    for (int i = 0; i < count; i++) {
+        const Row* row = &rows[i];
+        fprintf(f, "%s\n{\"command\":", i ? "," : "");
+        json_string(f, row->command);
+        fprintf(f, ",\"weight\":%g,\"sent\":%ld,\"done\":%ld,\"errors\":%ld,\"failed\":%ld,\"busy\":%ld,"
+                   "\"unfinished\":%ld,\"throughput\":%.3f,", row->weight, row->sent, row->done,
+                row->errors, row->failed, row->busy, row->unfinished, row->throughput);
+        json_quantiles(f, "latency_ms", row->latency);
+        fputc(',', f);
+        json_quantiles(f, "ttfb_ms", row->ttfb);
+        fputc('}', f);
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f);
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    const char* mix_file = NULL;
+    const char* command = NULL;
+    const char* csv_path = NULL;
+    const char* json_path = NULL;
+    int port = PORT, depth = 1;
+    double seconds = 10, rate = 0;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:c:d:r:t:m:x:s:o:j:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': conn_count = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'm': mix_file = optarg; break;
+        case 'x': command = optarg; break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        case 'o': csv_path = optarg; break;
+        case 'j': json_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-d depth | -r rate] [-t seconds] "
+                            "[-m mix_file | -x command] [-s seed] [-o results.csv] [-j results.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (conn_count <= 0 || depth <= 0 || seconds <= 0 || rate < 0) {
+        fprintf(stderr, "connections, depth and seconds must be positive, the rate not negative\n");
+        return 1;
+    }
+    if (mix_file) {
+        if (load_mix(mix_file) < 0) return 1;
+    } else {
+        add_entry(command ? command : "echo x", 1);
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad host %s\n", host);
+        return 1;
+    }
+    epoll_fd = epoll_create1(0);
+    conns = calloc(conn_count, sizeof(Conn));
+    if (epoll_fd < 0 || !conns) {
+        perror("setup");
+        return 1;
+    }
+    for (int i = 0; i < conn_count; i++) {
+        // each connection draws from a sequence of its own, the same one every run
+        if (open_conn(&conns[i], &addr, seed * 1000003 + i) < 0) {
+            perror("connect");
+            return 1;
+        }
+    }
+
+    int closed_loop = rate == 0;
+    int64_t interval = closed_loop ? 0 : (int64_t)(1e9 / rate);
+    if (!closed_loop && interval < 1) interval = 1;
+    run_start = now_ns();
+    run_end = run_start + (int64_t)(seconds * 1e9);
+    int64_t give_up = run_end + DRAIN_SECONDS * 1000000000LL;
+    int64_t next_send = run_start;
+    int next_conn = 0;
+    if (closed_loop) {
+        for (int i = 0; i < conn_count; i++) {
+            for (int k = 0; k < depth; k++) send_command(&conns[i], run_start);
+        }
+    }
+
+    struct epoll_event events[64];
+    while (1) {
+        int64_t now = now_ns();
+        // open loop: whatever is due goes out, each on the next connection in turn
+        while (!closed_loop && next_send <= now && next_send < run_end) {
+            for (int tries = 0; tries < conn_count && conns[next_conn].closed; tries++) {
+                next_conn = (next_conn + 1) % conn_count;
+            }
+            send_command(&conns[next_conn], next_send);
+            next_conn = (next_conn + 1) % conn_count;
+            next_send += interval;
+        }
+
+        int64_t wake = now < run_end ? (closed_loop ? run_end : next_send) : give_up;
+        int in_flight = 0, open = 0;
+        for (int i = 0; i < conn_count; i++) {
+            Conn* c = &conns[i];
+            if (c->closed) continue;
+            open++;
+            if (c->deferred > 0 && now >= run_end) c->deferred = 0;
+            while (c->deferred > 0 && c->resume_at <= now) {
+                c->deferred--;
+                send_command(c, now);
+            }
+            if (c->deferred > 0 && c->resume_at < wake) wake = c->resume_at;
+            in_flight += c->in_flight;
+        }
+        if (open == 0 || now >= give_up || (now >= run_end && in_flight == 0)) break;
+
+        int timeout = wake > now ? (int)((wake - now + 999999) / 1000000) : 0;
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            Conn* c = events[i].data.ptr;
+            if (events[i].events & EPOLLOUT) flush_out(c);
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read_replies(c, closed_loop);
+        }
+    }
+
+    // the report: one row per command, then all of them together when there are several
+    int rows_count = mix_count > 1 ? mix_count + 1 : 1;
+    Row* rows = calloc(rows_count, sizeof(Row));
+    MixEntry all;
+    if (!rows) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < mix_count; i++) {
+        mix[i].line[mix[i].len - 1] = '\0';
+        fill_row(&rows[i], mix[i].line, mix[i].weight, &mix[i], seconds);
+    }
+    if (mix_count > 1) {
+        merge_all(&all);
+        fill_row(&rows[mix_count], "all", weight_total, &all, seconds);
+    }
+    const Row* total = &rows[rows_count - 1];
+    if (closed_loop) {
+        printf("closed loop, %d connection(s) x %d in flight, %.1f s", conn_count, depth, seconds);
+    } else {
+        printf("open loop, %d connection(s) at %.1f commands/s, %.1f s", conn_count, rate, seconds);
+    }
+    printf(": %ld sent, %ld done (%.1f/s), %ld errors, %ld failed, %ld busy, %ld unfinished\n", total->sent,
+           total->done, total->throughput, total->errors, total->failed, total->busy, total->unfinished);
+    print_rows(rows, rows_count, 0);
+    print_rows(rows, rows_count, 1);
+
+    if (csv_path && write_csv(csv_path, rows, rows_count) != 0) {
+        perror(csv_path);
+        return 1;
+    }
+    if (json_path && write_json(json_path, rows, rows_count, seconds, depth, rate) != 0) {
+        perror(json_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "threadblock.h"
+
+#define RING_SIZE (256 * 1024)      // per thread, a power of two
+#define LINE_MAX_BYTES 1024         // longer lines are cut
+#define BATCH_SIZE (64 * 1024)      // bytes per write()
+#define DRAIN_INTERVAL_MS 20        // how long a line may wait in its ring
+#define WAKE_FILL (RING_SIZE / 4)   // a ring this full wakes the drain thread early
+#define ROOM_WAIT_NS 1000000        // how long a stats line waits for room between checks
+
+enum { SINK_LOG, SINK_STATS, SINKS };
+
+// a line in a ring: this header, then len bytes of text
+typedef struct LineHeader {
+    uint32_t len;
+    uint32_t sink;                  // SINK_LOG or SINK_STATS
+    int64_t ns;                     // when it was logged, the drain merges rings by it
+} LineHeader;
+
+typedef struct LogRing {
+    ThreadBlock block;
+    // producer side: only the owning thread writes these
+    uint64_t head;                  // bytes ever written
+    unsigned long dropped;          // lines that didn't fit
+    char pad[64 - sizeof(ThreadBlock) - sizeof(uint64_t) - sizeof(unsigned long)];
+    // consumer side
+    uint64_t tail;                  // bytes ever read
+    unsigned long reported;         // drops already reported
+    char data[RING_SIZE];
+} LogRing;
+
+int log_level = LOG_LEVEL_DEBUG;
+
+static ThreadBlockList rings = THREAD_BLOCK_LIST;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;  // one consumer at a time
+static __thread LogRing* my_ring;
+static int wake_fd = -1;
+static int sink_fds[SINKS] = { STDOUT_FILENO, -1 };
+static int drain_sleeping;
+static unsigned long stats_lost;    // stats lines a failed write() lost, drain_lock guards it
+
+static void ring_put(LogRing* ring, uint64_t pos, const void* src, size_t len) {
+    size_t offset = pos & (RING_SIZE - 1);
+    size_t first = RING_SIZE - offset < len ? RING_SIZE - offset : len;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, (const char*)src + first, len - first);
+}
+
+static void ring_get(const LogRing* ring, uint64_t pos, void* dst, size_t len) {
+    size_t offset = pos & (RING_SIZE - 1);
+    size_t first = RING_SIZE - offset < len ? RING_SIZE - offset : len;
+    memcpy(dst, ring->data + offset, first);
+    memcpy((char*)dst + first, ring->data, len - first);
+}
+
+static void wake_drain(void) {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // EAGAIN: the counter is saturated, it is awake anyway
+    }
+}
+
+// a stats line is never dropped: with its ring full, the thread wakes the drain thread
+// and waits for room. returns the new tail, or the old one if there is nobody to drain
+static uint64_t wait_for_room(LogRing* ring, uint64_t head, size_t need) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (wake_fd < 0) return tail;
+    struct timespec pause = { 0, ROOM_WAIT_NS };
+    while (RING_SIZE - (head - tail) < need) {
+        wake_drain();
+        nanosleep(&pause, NULL);
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+    return tail;
+}
+
+static void write_line(int sink, const char* fmt, va_list args) {
+    LogRing* ring = my_ring ? my_ring : (my_ring = thread_block_register(&rings, sizeof(LogRing), NULL));
+    if (!ring) return;
+
+    char line[LINE_MAX_BYTES];
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    if (len < 0) return;
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    LineHeader header = { .len = len, .sink = sink, .ns = monotonic_ns() };
+    size_t need = sizeof(header) + len;
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (RING_SIZE - (head - tail) < need && sink == SINK_STATS) tail = wait_for_room(ring, head, need);
+    if (RING_SIZE - (head - tail) < need) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    ring_put(ring, head, &header, sizeof(header));
+    ring_put(ring, head + sizeof(header), line, len);
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+
+    // the drain thread comes by on its own every DRAIN_INTERVAL_MS; only a ring filling
+    // up faster than that is worth a system call, and then only one until it wakes
+    if (head + need - tail >= WAKE_FILL && __atomic_load_n(&drain_sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&drain_sleeping, 0, __ATOMIC_RELAXED)) {
+        wake_drain();
+    }
+}
+
+void log_write(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    write_line(SINK_LOG, fmt, args);
+    va_end(args);
+}
+
+void log_stats(const char* fmt, ...) {
+    if (sink_fds[SINK_STATS] < 0) return;
+    va_list args;
+    va_start(args, fmt);
+    write_line(SINK_STATS, fmt, args);
+    va_end(args);
+}
+
+int log_stats_enabled(void) {
+    return sink_fds[SINK_STATS] >= 0;
+}
+
+int log_open_stats(const char* path, const char* columns) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) == 0 && st.st_size == 0 && write(fd, columns, strlen(columns)) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    sink_fds[SINK_STATS] = fd;
+    return 0;
+}
+
+typedef struct Batch {
+    char data[BATCH_SIZE];
+    size_t len;
+} Batch;
+
+// returns how many lines were lost because fd took no more
+static unsigned long batch_write(Batch* batch, int fd) {
+    size_t done = 0;
+    unsigned long lost = 0;
+    while (done < batch->len) {
+        ssize_t n = write(fd, batch->data + done, batch->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;                  // nowhere to write, the lines are lost
+        done += n;
+    }
+    for (size_t i = done; i < batch->len; i++) {
+        if (batch->data[i] == '\n') lost++;
+    }
+    batch->len = 0;
+    return lost;
+}
+
+static void batch_flush(Batch* batches, int sink) {
+    unsigned long lost = batch_write(&batches[sink], sink_fds[sink]);
+    if (sink == SINK_STATS) stats_lost += lost;
+}
+
+static void batch_append(Batch* batches, int sink, const LogRing* ring, uint64_t pos, size_t len) {
+    Batch* batch = &batches[sink];
+    if (batch->len + len > sizeof(batch->data)) batch_flush(batches, sink);
+    ring_get(ring, pos, batch->data + batch->len, len);
+    batch->len += len;
+}
+
+// one ring's next unread line during a drain
+typedef struct Cursor {
+    LogRing* ring;
+    uint64_t pos;
+    uint64_t end;
+    LineHeader header;
+} Cursor;
+
+// writes out every line committed so far, oldest first across all rings, one batch
+// per sink. the caller holds drain_lock
+static void drain(Batch* batches) {
+    LogRing* first = thread_blocks(&rings);     // rings added meanwhile wait for the next drain
+    int count = 0;
+    for (LogRing* ring = first; ring; ring = (LogRing*)ring->block.next) count++;
+    if (count == 0) return;
+    Cursor* cursors = calloc(count, sizeof(Cursor));
+    if (!cursors) return;
+
+    int live = 0;
+    unsigned long dropped = 0;
+    for (LogRing* ring = first; ring; ring = (LogRing*)ring->block.next) {
+        unsigned long lost = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        dropped += lost - ring->reported;
+        ring->reported = lost;
+
+        Cursor* c = &cursors[live];
+        c->ring = ring;
+        c->pos = ring->tail;
+        c->end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (c->pos == c->end) continue;
+        ring_get(ring, c->pos, &c->header, sizeof(c->header));
+        live++;
+    }
+
+    // a k-way merge by timestamp, so lines about one command from the event loop and
+    // the worker come out in the order they happened
+    while (live > 0) {
+        int oldest = 0;
+        for (int i = 1; i < live; i++) {
+            if (cursors[i].header.ns < cursors[oldest].header.ns) oldest = i;
+        }
+        Cursor* c = &cursors[oldest];
+        int sink = c->header.sink;
+        batch_append(batches, sink, c->ring, c->pos + sizeof(LineHeader), c->header.len);
+        c->pos += sizeof(LineHeader) + c->header.len;
+        __atomic_store_n(&c->ring->tail, c->pos, __ATOMIC_RELEASE);   // the space is free again
+        if (c->pos == c->end) {
+            cursors[oldest] = cursors[--live];
+        } else {
+            ring_get(c->ring, c->pos, &c->header, sizeof(c->header));
+        }
+    }
+    free(cursors);
+
+    // the stats go first, so a row lost writing them is reported in this drain's log batch
+    batch_flush(batches, SINK_STATS);
+    Batch* log = &batches[SINK_LOG];
+    char note[128];
+    int len = 0;
+    if (dropped > 0) {
+        len += snprintf(note, sizeof(note), "[LOG] %lu line(s) dropped, the log could not keep up\n", dropped);
+    }
+    if (stats_lost > 0) {
+        len += snprintf(note + len, sizeof(note) - len, "[LOG] %lu stats line(s) lost, the stats log could not be written\n", stats_lost);
+        stats_lost = 0;
+    }
+    if (len > 0) {
+        if (log->len + len > sizeof(log->data)) batch_flush(batches, SINK_LOG);
+        memcpy(log->data + log->len, note, len);
+        log->len += len;
+    }
+    batch_flush(batches, SINK_LOG);
+}
+
+void log_flush(void) {
+    static Batch batches[SINKS];            // drain_lock guards them
+    pthread_mutex_lock(&drain_lock);
+    drain(batches);
+    pthread_mutex_unlock(&drain_lock);
+}
+
+static void* drain_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        log_flush();
+        __atomic_store_n(&drain_sleeping, 1, __ATOMIC_RELAXED);
+        struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, DRAIN_INTERVAL_MS) > 0) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0) {
+                // EAGAIN: someone else's wakeup was already read
+            }
+        }
+        __atomic_store_n(&drain_sleeping, 0, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+int log_level_parse(const char* name) {
+    static const char* names[] = { "error", "warn", "info", "debug" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+void log_init(int level) {
+    log_level = level;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("[ERROR] eventfd failed");
+        exit(1);
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, drain_thread, NULL) != 0) {
+        perror("[ERROR] pthread_create failed");
+        exit(1);
+    }
+    pthread_detach(tid);
+    atexit(log_flush);
+}
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "scheduler.h"
+#include "protocol.h"
+#include "log.h"
+#include "threadblock.h"
+
+#define SUB_BUCKETS 8               // per power of two
+#define MAX_EXPONENT 44             // 2^45 ns is about ten hours, longer lands in the last bucket
+#define BUCKETS (SUB_BUCKETS * (MAX_EXPONENT - 1))
+#define FIRST_EDGE 10               // exported buckets start at 2^10 ns, about 1 us
+#define REQUEST_MAX 4096
+#define SCRAPE_TIMEOUT_S 2          // a scraper slower than this is dropped
+
+// what one thread recorded. only the owning thread writes it, a scrape reads it while
+// it changes: every field is a whole word, so a scrape sees each one old or new
+typedef struct MetricsBlock {
+    ThreadBlock block;
+    uint64_t counts[STAGES][BUCKETS];
+    uint64_t sum_ns[STAGES];
+    uint64_t counters[COUNTS];
+} MetricsBlock;
+
+static ThreadBlockList blocks = THREAD_BLOCK_LIST;
+static __thread MetricsBlock* my_block;
+static int listen_fd = -1;
+
+static const char* stage_names[STAGES] = { "receive", "queue", "spawn", "first_output", "total" };
+
+static const struct {
+    const char* name;
+    const char* help;
+} counter_info[COUNTS] = {
+    { "rshell_connections_opened_total", "Client connections accepted." },
+    { "rshell_connections_closed_total", "Client connections closed." },
+    { "rshell_commands_total", "Command lines received." },
+    { "rshell_busy_total", "Commands refused with BUSY." },
+    { "rshell_cache_hits_total", "Commands answered from the result cache or joined to a running one." },
+    { "rshell_completed_total", "Tasks that ran to the end." },
+    { "rshell_fork_failures_total", "Pipeline stages that got no process (EAGAIN, ENOMEM)." },
+    { "rshell_exec_failures_total", "Pipeline stages whose program could not run." },
+    { "rshell_output_bytes_total", "Command output sent to clients, in bytes." },
+};
+
+static MetricsBlock* my_metrics(void) {
+    return my_block ? my_block : (my_block = thread_block_register(&blocks, sizeof(MetricsBlock), NULL));
+}
+
+// log-linear buckets: exact below 8 ns, then SUB_BUCKETS per power of two
+static int bucket_of(int64_t ns) {
+    uint64_t v = ns > 0 ? (uint64_t)ns : 0;
+    if (v < SUB_BUCKETS) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int index = SUB_BUCKETS * (e - 2) + (int)((v >> (e - 3)) & (SUB_BUCKETS - 1));
+    return index < BUCKETS ? index : BUCKETS - 1;
+}
+
+// the first value past a bucket, in ns
+static uint64_t bucket_end(int index) {
+    if (index < SUB_BUCKETS) return index + 1;
+    int e = index / SUB_BUCKETS + 2;
+    uint64_t low = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << (e - 3);
+    return low + (1ULL << (e - 3));
+}
+
+// a plain add: the block has one writer, the store only has to be whole for a scrape
+static void bump(uint64_t* field, uint64_t n) {
+    __atomic_store_n(field, *field + n, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(int stage, int64_t ns) {
+    MetricsBlock* block = my_metrics();
+    if (!block) return;
+    bump(&block->counts[stage][bucket_of(ns)], 1);
+    bump(&block->sum_ns[stage], ns > 0 ? ns : 0);
+}
+
+void metrics_count(int counter, uint64_t n) {
+    MetricsBlock* block = my_metrics();
+    if (!block) return;
+    bump(&block->counters[counter], n);
+}
+
+// the response body, grown as it is written
+typedef struct Text {
+    char* data;
+    size_t len;
+    size_t cap;
+} Text;
+
+static void text_printf(Text* text, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void text_printf(Text* text, const char* fmt, ...) {
+    while (1) {
+        va_list args;
+        va_start(args, fmt);
+        size_t room = text->cap - text->len;
+        int n = vsnprintf(text->data ? text->data + text->len : NULL, room, fmt, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t)n < room) {
+            text->len += n;
+            return;
+        }
+        size_t cap = text->cap ? text->cap * 2 : 16384;
+        while (cap - text->len <= (size_t)n) cap *= 2;
+        char* grown = realloc(text->data, cap);
+        if (!grown) return;
+        text->data = grown;
+        text->cap = cap;
+    }
+}
+
+// adds up every thread's block into totals
+static void collect(MetricsBlock* totals) {
+    memset(totals, 0, sizeof(*totals));
+    for (MetricsBlock* block = thread_blocks(&blocks); block; block = (MetricsBlock*)block->block.next) {
+        for (int s = 0; s < STAGES; s++) {
+            for (int i = 0; i < BUCKETS; i++) {
+                totals->counts[s][i] += __atomic_load_n(&block->counts[s][i], __ATOMIC_RELAXED);
+            }
+            totals->sum_ns[s] += __atomic_load_n(&block->sum_ns[s], __ATOMIC_RELAXED);
+        }
+        for (int c = 0; c < COUNTS; c++) {
+            totals->counters[c] += __atomic_load_n(&block->counters[c], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// the exposition: Prometheus buckets are cumulative, and only every half power of two
+// from 1 us up is exported (2^k and 1.5 * 2^k ns, both edges of our own buckets)
+static void render(Text* text) {
+    static MetricsBlock totals;             // only the metrics thread renders
+    collect(&totals);
+
+    text_printf(text, "# HELP rshell_stage_seconds Time a command spends in each step on its way through the server.\n"
+                      "# TYPE rshell_stage_seconds histogram\n");
+    for (int s = 0; s < STAGES; s++) {
+        uint64_t seen = 0;
+        int i = 0;
+        for (int e = FIRST_EDGE; e <= MAX_EXPONENT; e++) {
+            uint64_t edges[2] = { 1ULL << e, 3ULL << (e - 1) };
+            for (int k = 0; k < 2; k++) {
+                while (i < BUCKETS && bucket_end(i) <= edges[k]) seen += totals.counts[s][i++];
+                text_printf(text, "rshell_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                            stage_names[s], edges[k] / 1e9, (unsigned long long)seen);
+            }
+        }
+        while (i < BUCKETS) seen += totals.counts[s][i++];
+        text_printf(text, "rshell_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                    stage_names[s], (unsigned long long)seen);
+        text_printf(text, "rshell_stage_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[s], totals.sum_ns[s] / 1e9);
+        text_printf(text, "rshell_stage_seconds_count{stage=\"%s\"} %llu\n", stage_names[s], (unsigned long long)seen);
+    }
+
+    for (int c = 0; c < COUNTS; c++) {
+        text_printf(text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_info[c].name, counter_info[c].help,
+                    counter_info[c].name, counter_info[c].name, (unsigned long long)totals.counters[c]);
+    }
+
+    // the two counters are read a moment apart, a connection may have come and gone between
+    uint64_t opened = totals.counters[COUNT_CONNECTIONS_OPENED];
+    uint64_t closed = totals.counters[COUNT_CONNECTIONS_CLOSED];
+    text_printf(text, "# HELP rshell_connections_active Client connections open now.\n"
+                      "# TYPE rshell_connections_active gauge\nrshell_connections_active %llu\n",
+                (unsigned long long)(opened > closed ? opened - closed : 0));
+
+    text_printf(text, "# HELP rshell_queue_depth Tasks waiting in a worker's run queue.\n"
+                      "# TYPE rshell_queue_depth gauge\n");
+    int busy_workers = 0, busy;
+    for (int w = 0; ; w++) {
+        int depth = scheduler_worker_state(w, &busy);
+        if (depth < 0) break;
+        busy_workers += busy;
+        text_printf(text, "rshell_queue_depth{worker=\"%d\"} %d\n", w, depth);
+    }
+    text_printf(text, "# HELP rshell_workers_busy Workers running a task or looking for one.\n"
+                      "# TYPE rshell_workers_busy gauge\nrshell_workers_busy %d\n", busy_workers);
+}
+
+// answers one scrape: GET /metrics gets the exposition, anything else a 404
+static void handle_scrape(int fd) {
+    struct timeval timeout = { .tv_sec = SCRAPE_TIMEOUT_S };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // the request line and headers; the body of a GET, if any, is not read
+    char request[REQUEST_MAX + 1];
+    size_t len = 0;
+    while (len < REQUEST_MAX) {
+        ssize_t n = recv(fd, request + len, REQUEST_MAX - len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    request[len] = '\0';
+
+    Text body = { 0 };
+    const char* status = "404 Not Found";
+    const char* type = "text/plain";
+    if (strncmp(request, "GET /metrics", 12) == 0 && (request[12] == ' ' || request[12] == '?')) {
+        status = "200 OK";
+        type = "text/plain; version=0.0.4";
+        render(&body);
+    } else {
+        text_printf(&body, "try GET /metrics\n");
+    }
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                              status, type, body.len);
+    if (write_full(fd, header, header_len) == 0 && body.len > 0) write_full(fd, body.data, body.len);
+    free(body.data);
+}
+
+// scrapes are rare and small: one at a time, blocking, on this thread alone
+static void* metrics_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                log_error("[ERROR] metrics accept failed: %s\n", strerror(errno));
+                sleep(1);                    // EMFILE and friends: don't spin
+            }
+            continue;
+        }
+        handle_scrape(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+void metrics_start(int port) {
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),   // for the local agent only
+    };
+    int opt = 1;
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+        perror("[ERROR] metrics socket failed");
+        exit(1);
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, metrics_thread, NULL) != 0) {
+        perror("[ERROR] pthread_create failed");
+        exit(1);
+    }
+    pthread_detach(tid);
+    log_info("[INFO] Metrics on http://127.0.0.1:%d/metrics\n", port);
+}
@@ -6,16 +6,316 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include "protocol.h"
 
 #define PORT 8081
 #define BUFFER_SIZE 32767
 
-int main()
+static int show_stats = 0; // -s: print what each command cost, from its stats frame
+
+// turns a stats frame payload into a line for stderr, returns its length
+static int format_stats(const unsigned char *payload, char *out, size_t size)
+{
+    TaskStats stats;
+    stats_decode(payload, &stats);
+    return snprintf(out, size, "[queue %.1f ms, run %.1f ms, total %.1f ms, cpu %.1f ms user %.1f ms sys, "
+                    "rss %llu KB, %llu bytes]\n",
+                    stats.queue_us / 1e3, stats.run_us / 1e3, stats.total_us / 1e3, stats.user_us / 1e3,
+                    stats.sys_us / 1e3, (unsigned long long)stats.max_rss_kb,
+                    (unsigned long long)stats.output_bytes);
+}
+
+// copies length bytes of frame payload from the socket straight to out_fd
+static int forward_payload(int sock, int out_fd, uint32_t length)
+{
+    char buffer[BUFFER_SIZE];
+    while (length > 0)
+    {
+        ssize_t n = recv(sock, buffer, length < sizeof(buffer) ? length : sizeof(buffer), 0);
+        if (n <= 0)
+            return (int)n;
+        if (write_full(out_fd, buffer, n) < 0)
+            return -1;
+        length -= n;
+    }
+    return 1;
+}
+
+// reads frames until the server marks the command as done.
+// returns 1 when done, 0 if the server closed the connection, -1 on error
+static int receive_replies(int sock)
+{
+    unsigned char raw[FRAME_HEADER_SIZE];
+    FrameHeader header;
+
+    while (1)
+    {
+        ssize_t n = recv(sock, raw, sizeof(raw), MSG_WAITALL);
+        if (n <= 0)
+            return (int)n;
+        if (n != sizeof(raw))
+            return 0;
+        frame_decode(raw, &header);
+        if (header.length > FRAME_MAX_PAYLOAD)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+
+        int result = 1;
+        uint32_t code;
+        switch (header.type)
+        {
+        case FRAME_STDOUT:
+            result = forward_payload(sock, STDOUT_FILENO, header.length);
+            break;
+        case FRAME_STDERR:
+        case FRAME_ERROR:
+            result = forward_payload(sock, STDERR_FILENO, header.length);
+            break;
+        case FRAME_EXIT:
+            if (header.length != sizeof(code) || read_full(sock, &code, sizeof(code)) < 0)
+                return -1;
+            code = ntohl(code);
+            if (header.flags & FRAME_FLAG_SIGNALED)
+                fprintf(stderr, "[killed by signal %u]\n", code);
+            break;
+        case FRAME_BUSY:
+            // the command was not run: retry-after hint, then the server's reason
+            if (header.length < sizeof(code) || read_full(sock, &code, sizeof(code)) < 0)
+                return -1;
+            fprintf(stderr, "[server busy, retry in %u ms] ", ntohl(code));
+            result = forward_payload(sock, STDERR_FILENO, header.length - sizeof(code));
+            break;
+        case FRAME_STATS:
+            if (show_stats && header.length == TASK_STATS_SIZE)
+            {
+                unsigned char payload[TASK_STATS_SIZE];
+                char line[256];
+                if (read_full(sock, payload, sizeof(payload)) < 0)
+                    return -1;
+                int n = format_stats(payload, line, sizeof(line));
+                write_full(STDERR_FILENO, line, n);
+                break;
+            }
+            // not wanted: skipped like any other frame
+        default:
+            // unknown frame type from a newer server, skip its payload
+            while (header.length > 0)
+            {
+                char skip[256];
+                ssize_t got = recv(sock, skip, header.length < sizeof(skip) ? header.length : sizeof(skip), 0);
+                if (got <= 0)
+                    return (int)got;
+                header.length -= got;
+            }
+            break;
+        }
+        if (result <= 0)
+            return result;
+    }
+}
+
+// output of one pipelined command, held back until every earlier command has printed
+typedef struct PendingReply
+{
+    char *data; // records of [1 byte stream][4 byte length][bytes]
+    size_t len;
+    size_t cap;
+    int done;
+} PendingReply;
+
+static void append_bytes(char **buf, size_t *len, size_t *cap, const void *data, size_t n)
+{
+    if (*len + n > *cap)
+    {
+        size_t grown = *cap ? *cap : 4096;
+        while (grown < *len + n)
+            grown *= 2;
+        *buf = realloc(*buf, grown);
+        if (!*buf)
+        {
+            perror("Out of memory");
+            exit(1);
+        }
+        *cap = grown;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+static void flush_pending(PendingReply *reply)
+{
+    size_t pos = 0;
+    while (pos < reply->len)
+    {
+        uint32_t n;
+        int out_fd = reply->data[pos];
+        memcpy(&n, reply->data + pos + 1, sizeof(n));
+        write_full(out_fd, reply->data + pos + 5, n);
+        pos += 5 + n;
+    }
+    free(reply->data);
+    reply->data = NULL;
+    reply->len = reply->cap = 0;
+}
+
+// non-interactive mode: streams every command from stdin without waiting for replies,
+// then prints each command's output in input order as the results come in
+static int run_batch(int sock)
+{
+    char *outgoing = NULL;
+    size_t out_len = 0, out_cap = 0, out_sent = 0;
+    uint32_t commands = 0;
+    char line[BUFFER_SIZE];
+
+    while (fgets(line, sizeof(line), stdin))
+    {
+        line[strcspn(line, "\n")] = 0;
+        if (strlen(line) == 0)
+            continue;
+        // exit would make the server drop the commands still running, so just stop here
+        if (strcmp(line, "exit") == 0)
+            break;
+        append_bytes(&outgoing, &out_len, &out_cap, line, strlen(line));
+        append_bytes(&outgoing, &out_len, &out_cap, "\n", 1);
+        commands++;
+    }
+
+    PendingReply *replies = calloc(commands + 1, sizeof(PendingReply));
+    char *rx = NULL;
+    size_t rx_len = 0, rx_cap = 0;
+    uint32_t next_print = 1; // tags start at 1
+    int result = 1;
+
+    while (next_print <= commands && result > 0)
+    {
+        struct pollfd pfd = {.fd = sock, .events = POLLIN};
+        if (out_sent < out_len)
+            pfd.events |= POLLOUT; // keep reading while we write, the server may be pushing back
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            result = -1;
+            break;
+        }
+
+        if ((pfd.revents & POLLOUT) && out_sent < out_len)
+        {
+            ssize_t n = send(sock, outgoing + out_sent, out_len - out_sent, MSG_DONTWAIT);
+            if (n > 0)
+                out_sent += n;
+            else if (n < 0 && errno != EAGAIN && errno != EINTR)
+                result = -1;
+        }
+
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        char chunk[BUFFER_SIZE];
+        ssize_t n = recv(sock, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (n <= 0)
+        {
+            result = (int)n;
+            break;
+        }
+        append_bytes(&rx, &rx_len, &rx_cap, chunk, n);
+
+        // handle every complete frame we have
+        size_t pos = 0;
+        while (rx_len - pos >= FRAME_HEADER_SIZE)
+        {
+            FrameHeader header;
+            frame_decode((unsigned char *)rx + pos, &header);
+            if (header.length > FRAME_MAX_PAYLOAD)
+            {
+                errno = EPROTO;
+                result = -1;
+                break;
+            }
+            if (rx_len - pos < FRAME_HEADER_SIZE + header.length)
+                break;
+
+            const char *payload = rx + pos + FRAME_HEADER_SIZE;
+            pos += FRAME_HEADER_SIZE + header.length;
+            if (header.tag < next_print || header.tag > commands)
+                continue;
+            if (header.type == FRAME_BUSY && header.length >= 4)
+            {
+                // print the reason like an error, without the retry-after hint
+                header.type = FRAME_ERROR;
+                payload += 4;
+                header.length -= 4;
+            }
+
+            char line[256];
+            if (header.type == FRAME_STATS && show_stats && header.length == TASK_STATS_SIZE)
+            {
+                // printed in order with the command's output, like its stderr
+                header.length = format_stats((const unsigned char *)payload, line, sizeof(line));
+                header.type = FRAME_STDERR;
+                payload = line;
+            }
+
+            PendingReply *reply = &replies[header.tag];
+            int out_fd = (header.type == FRAME_STDOUT) ? STDOUT_FILENO : STDERR_FILENO;
+            if (header.type == FRAME_STDOUT || header.type == FRAME_STDERR || header.type == FRAME_ERROR)
+            {
+                if (header.tag == next_print)
+                {
+                    write_full(out_fd, payload, header.length);
+                }
+                else
+                {
+                    char stream = (char)out_fd;
+                    append_bytes(&reply->data, &reply->len, &reply->cap, &stream, 1);
+                    append_bytes(&reply->data, &reply->len, &reply->cap, &header.length, sizeof(header.length));
+                    append_bytes(&reply->data, &reply->len, &reply->cap, payload, header.length);
+                }
+            }
+            else if (header.type == FRAME_DONE)
+            {
+                reply->done = 1;
+                // print everything that was waiting on this command
+                while (next_print <= commands && replies[next_print].done)
+                {
+                    flush_pending(&replies[next_print]);
+                    next_print++;
+                }
+                if (next_print <= commands)
+                    flush_pending(&replies[next_print]);
+            }
+        }
+        memmove(rx, rx + pos, rx_len - pos);
+        rx_len -= pos;
+    }
+
+    if (result < 0)
+        perror("Receive failed");
+    else if (result == 0)
+        printf("[INFO] Server closed the connection.\n");
+
+    for (uint32_t i = 0; i <= commands; i++)
+        free(replies[i].data);
+    free(replies);
+    free(rx);
+    free(outgoing);
+    return result > 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
 {
     int sock;
     struct sockaddr_in serv_addr;
     char userInput[500];
-    char serverResponse[1024];
+
+    if (argc > 1 && strcmp(argv[1], "-s") == 0)
+        show_stats = 1;
 
     // Create socket
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
@@ -36,6 +336,14 @@ int main()
         exit(1);
     }
 
+    // commands piped in are sent all at once instead of one round trip each
+    if (!isatty(STDIN_FILENO))
+    {
+        int status = run_batch(sock);
+        close(sock);
+        return status;
+    }
+
     printf("Connected to server.\n");
 
     while (1)
@@ -51,8 +359,12 @@ int main()
             continue; // Skip sending empty commands
         }
 
-        // Send command to server
-        if (send(sock, userInput, strlen(userInput), 0) == -1)
+        // Send command to server, one command per line
+        size_t len = strlen(userInput);
+        userInput[len] = '\n';
+        ssize_t sent = send(sock, userInput, len + 1, 0);
+        userInput[len] = '\0';
+        if (sent == -1)
         {
             perror("Send failed");
             break;
@@ -66,36 +378,17 @@ int main()
         }
 
         // Receive server response
-        memset(serverResponse, 0, sizeof(serverResponse));
-        ssize_t bytesReceived;
-
-        while ((bytesReceived = recv(sock, serverResponse, sizeof(serverResponse) - 1, 0)) > 0) {
-        serverResponse[bytesReceived] = '\0';
-
-        // Look for task completion marker
-        if (strstr(serverResponse, "__TASK_DONE__")) {
-            serverResponse[strstr(serverResponse, "__TASK_DONE__") - serverResponse] = '\0';
-            printf("%s", serverResponse);
-            break;
-        }
-
-        printf("%s", serverResponse);
-    }
-
-
-        // Properly handle server disconnection
-        if (bytesReceived == -1)
+        int result = receive_replies(sock);
+        if (result < 0)
         {
             perror("Receive failed");
             break;
         }
-        else if (bytesReceived == 0)
+        else if (result == 0)
         {
             printf("[INFO] Server closed the connection.\n");
             break;
         }
-
-        serverResponse[bytesReceived] = '\0'; // Ensure null termination
     }
 
     // Close socket before exiting
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "output.h"
+#include "config.h"
+#include "threadblock.h"
+
+#define COPY_BUFFER_SIZE 4096      // chunk size of the copy path
+#define SPLICE_MIN_BYTES 4096      // smaller chunks are cheaper to copy behind the header
+#define PIPE_BUFFER_SIZE (1 << 20) // asked for with F_SETPIPE_SZ, the kernel may cap it
+#define SOCKET_WAIT_MS 10          // how long output waits for a full socket before it is buffered
+
+void enlarge_pipe(int pipe_fd) {
+    // best effort, a default 64 KB pipe works too, just with more frames
+    fcntl(pipe_fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+}
+
+void capture_init(OutputCapture* capture, size_t limit,
+                  void (*fanout)(OutputCapture* capture, uint8_t type, const void* data, size_t len)) {
+    memset(capture, 0, sizeof(*capture));
+    pthread_mutex_init(&capture->lock, NULL);
+    capture->limit = limit;
+    capture->fanout = fanout;
+}
+
+void capture_release(OutputCapture* capture) {
+    free(capture->data);
+    capture->data = NULL;
+    pthread_mutex_destroy(&capture->lock);
+}
+
+static void give_up(OutputCapture* capture) {
+    capture->overflow = 1;
+    free(capture->data);
+    capture->data = NULL;
+    capture->len = capture->cap = 0;
+}
+
+// lock is held
+static void store(OutputCapture* capture, uint8_t type, const void* data, size_t len) {
+    size_t need = capture->len + 5 + len;
+    if (need > capture->limit) {
+        give_up(capture);
+        return;
+    }
+    if (need > capture->cap) {
+        size_t cap = capture->cap ? capture->cap : 256;
+        while (cap < need) cap *= 2;
+        char* grown = realloc(capture->data, cap);
+        if (!grown) {
+            give_up(capture);                // same as too big: just don't keep it
+            return;
+        }
+        capture->data = grown;
+        capture->cap = cap;
+    }
+    uint32_t len32 = (uint32_t)len;
+    capture->data[capture->len] = type;
+    memcpy(capture->data + capture->len + 1, &len32, 4);
+    memcpy(capture->data + capture->len + 5, data, len);
+    capture->len = need;
+}
+
+void capture_append(OutputCapture* capture, uint8_t type, const void* data, size_t len) {
+    if (!capture) return;
+    pthread_mutex_lock(&capture->lock);
+    if (!capture->overflow) store(capture, type, data, len);
+    if (capture->listeners > 0) capture->fanout(capture, type, data, len);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+static void count_output(OutputCount* count, size_t bytes) {
+    if (count->first_ns == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        count->first_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+    count->bytes += bytes;
+}
+
+// forwards whatever is ready on fd. returns 0 at EOF, 2 when it left the data in the
+// pipe because the socket has no room for a splice (only while patient), 1 otherwise
+static int forward_ready(Connection* conn, uint32_t tag, uint8_t type, int fd, OutputCapture* capture,
+                         int patient, OutputCount* count) {
+    int available = 0;
+    // the bytes have to pass through us while someone keeps or shares them. no listener
+    // joins an overflowed capture, so once the count is read as 0 here it stays 0
+    int capturing = capture && (!__atomic_load_n(&capture->overflow, __ATOMIC_RELAXED) ||
+                                __atomic_load_n(&capture->listeners, __ATOMIC_RELAXED) > 0);
+
+    if (server_config.zero_copy && !capturing && !conn_is_closed(conn) &&
+        ioctl(fd, FIONREAD, &available) == 0 && available >= SPLICE_MIN_BYTES) {
+        // the pipe already holds `available` bytes, so the frame length is known up front.
+        // no more than the socket takes now, or the rest would be copied into the ring
+        size_t room = conn_send_room(conn);
+        if (room >= SPLICE_MIN_BYTES) {
+            if ((size_t)available > room) available = (int)room;
+            if (conn_splice_frame(conn, type, 0, tag, fd, available) == 0) {
+                count_output(count, available);
+                return 1;
+            }
+            // the client is gone; fall through and drain the pipe so the child can finish
+        } else if (patient) {
+            return 2;
+        }
+    }
+
+    char buffer[COPY_BUFFER_SIZE];
+    ssize_t bytes = read(fd, buffer, sizeof(buffer));
+    if (bytes > 0) {
+        conn_send_frame(conn, type, 0, tag, buffer, bytes);
+        count_output(count, bytes);
+        if (capturing) capture_append(capture, type, buffer, bytes);
+        return 1;
+    }
+    if (bytes < 0 && errno == EINTR) return 1;
+    return 0;
+}
+
+int stream_output_until(Connection* conn, uint32_t tag, int pipes[2], const int* wait_fds,
+                        int wait_count, OutputCapture* capture, OutputCount* count) {
+    struct pollfd fds[2 + STREAM_MAX_WAIT_FDS + 1];
+    const uint8_t types[2] = { FRAME_STDOUT, FRAME_STDERR };
+
+    if (wait_count > STREAM_MAX_WAIT_FDS) wait_count = STREAM_MAX_WAIT_FDS;
+    for (int i = 0; i < wait_count; i++) {
+        fds[2 + i].fd = wait_fds[i];
+        fds[2 + i].events = POLLIN;
+    }
+    struct pollfd* sock = &fds[2 + wait_count];
+    sock->events = POLLOUT;
+
+    // when the socket is behind, the pipes wait a moment for it rather than being read
+    // into the output ring: a client that keeps up makes room again within microseconds,
+    // and the splice path stays zero copy. a client that doesn't is found out by the
+    // deadline; from then on output is copied ahead until the ring is full. the pipes are
+    // left out of the poll while they wait, or a finished command's POLLHUP would wake it
+    // over and over
+    int socket_full = 0;                     // a splice found no room in the socket
+    int patient = 1;
+    int64_t deadline = 0;                    // when waiting for the socket stops, 0 while not waiting
+    while (pipes[0] >= 0 || pipes[1] >= 0) {
+        int waiting = patient && !conn_is_closed(conn) &&
+                      (socket_full || __atomic_load_n(&conn->out_len, __ATOMIC_RELAXED) > 0);
+        int timeout = -1;
+        if (waiting) {
+            int64_t now = monotonic_ns();
+            if (deadline == 0) deadline = now + SOCKET_WAIT_MS * 1000000LL;
+            timeout = now < deadline ? (int)((deadline - now + 999999) / 1000000) : 0;
+        } else {
+            deadline = 0;
+        }
+        for (int i = 0; i < 2; i++) {
+            fds[i].fd = waiting ? -1 : pipes[i];
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        sock->fd = waiting ? conn->fd : -1;
+
+        int ready = poll(fds, 3 + wait_count, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (waiting && monotonic_ns() >= deadline && !(sock->revents & POLLOUT)) {
+            patient = 0;
+            socket_full = 0;
+            continue;
+        }
+        if (waiting && sock->revents) {
+            conn_flush_output(conn, NULL);   // the loop would too, we are here first
+            socket_full = 0;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+            int result = forward_ready(conn, tag, types[i], pipes[i], capture, patient, count);
+            if (result == 2) {
+                socket_full = 1;
+            } else if (result == 0) {
+                close(pipes[i]);
+                pipes[i] = -1;
+            }
+        }
+        for (int i = 0; i < wait_count; i++) {
+            if (fds[2 + i].revents & POLLIN) return i;
+        }
+        if (conn_output_full(conn)) return STREAM_OUTPUT_FULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (pipes[i] >= 0) close(pipes[i]);   // only after a poll failure
+        pipes[i] = -1;
+    }
+    return -1;
+}
@@ -4,6 +4,39 @@
 #include <ctype.h>
 #include "parser.h"
 
+// isspace() in the C locale, without the per character table lookup call
+static int isSeparator(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// how many tokens parseInput will split this input into, so callers can size the vector
+int countTokens(const char *userInput)
+{
+    int count = 0;
+    int inQuote = 0;
+    int inToken = 0;
+
+    for (; *userInput; userInput++)
+    {
+        if (*userInput == '"')
+        {
+            inQuote = !inQuote;
+        }
+        else if (isSeparator(*userInput) && !inQuote)
+        {
+            inToken = 0;
+            continue;
+        }
+        if (!inToken)
+        {
+            inToken = 1;
+            count++;
+        }
+    }
+    return count;
+}
+
 void parseInput(char *userInput, char *command[], int *argCount)
 {
     *argCount = 0;
@@ -16,7 +49,7 @@ void parseInput(char *userInput, char *command[], int *argCount)
         {
             inQuote = !inQuote;
         }
-        else if (isspace(*userInput) && !inQuote)
+        else if (isSeparator(*userInput) && !inQuote)
         {
             *userInput = '\0';
             if (*start)
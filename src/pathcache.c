@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "pathcache.h"
+
+#define CACHE_BUCKETS 1024
+#define MAX_ENTRIES 8192        // dropped wholesale when it gets this big
+#define MAX_PATH_SETS 32        // distinct PATH values we keep watches for
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+// one PATH value, split into its directories
+typedef struct PathSet {
+    struct PathSet* next;
+    char* path_env;
+    int dir_count;
+    char** dirs;
+    int* wds;                   // inotify watch per directory, -1 if it couldn't be watched
+    int* on_parent;             // the directory doesn't exist, wds[i] watches its parent
+    int relative;               // has an entry like "." or "": answers depend on the cwd
+} PathSet;
+
+typedef struct Entry {
+    struct Entry* next;
+    const PathSet* set;
+    uint32_t hash;
+    char* name;
+    char* resolved;             // NULL: not found on this PATH
+} Entry;
+
+// the table, the PATH sets and their watches. lookups share it, the watcher thread and
+// inserts take it for writing. searching the directories happens outside it
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t watcher_once = PTHREAD_ONCE_INIT;
+static int inotify_fd = -1;     // -1 if there is no watcher, and then no cache
+static PathSet* path_sets = NULL;           // never freed, so a search may use one unlocked
+static int path_set_count = 0;
+static Entry* buckets[CACHE_BUCKETS];
+static PathCacheStats stats;                // hits and misses are atomic, the rest under cache_lock
+// bumped on every change the watches report and whenever the entries are dropped
+static unsigned long generation;
+
+static uint32_t hash_name(const char* name, const PathSet* set) {
+    uint32_t h = 2166136261u ^ (uint32_t)(uintptr_t)set;     // FNV-1a, seeded per PATH
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// drops every entry (PATH sets and their watches stay). cache_lock is held for writing
+static void drop_entries(void) {
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        Entry* e = buckets[i];
+        while (e) {
+            Entry* next = e->next;
+            free(e->name);
+            free(e->resolved);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    stats.entries = 0;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+}
+
+// watches dir, or its parent while dir doesn't exist (so its creation is noticed).
+// returns the watch or -1
+static int watch_dir(const char* dir, int* on_parent) {
+    *on_parent = 0;
+    int wd = inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+    if (wd >= 0 || errno != ENOENT) return wd;
+
+    char parent[PATH_MAX];
+    if (snprintf(parent, sizeof(parent), "%s", dir) >= (int)sizeof(parent)) return -1;
+    char* slash = strrchr(parent, '/');
+    if (slash == parent) slash++;            // "/x": the parent is "/"
+    *slash = '\0';
+    *on_parent = 1;
+    return inotify_add_watch(inotify_fd, parent, WATCH_MASK);
+}
+
+// after a change: directories that appeared get their own watch, ones that vanished
+// fall back to watching their parent
+static void rewatch(void) {
+    for (PathSet* set = path_sets; set; set = set->next) {
+        for (int i = 0; i < set->dir_count; i++) {
+            if (set->dirs[i][0] == '/' && (set->wds[i] < 0 || set->on_parent[i])) {
+                __atomic_store_n(&set->wds[i], watch_dir(set->dirs[i], &set->on_parent[i]), __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+// applies what the watches report, as soon as they do: lookups never touch the
+// inotify fd, so a hit costs no system call
+static void* watcher_thread(void* arg) {
+    (void)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("[ERROR] inotify read failed");
+            return NULL;
+        }
+
+        pthread_rwlock_wrlock(&cache_lock);
+        for (char* p = buf; p < buf + n; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->mask & IN_IGNORED) {
+                // the watched directory is gone
+                for (PathSet* set = path_sets; set; set = set->next) {
+                    for (int i = 0; i < set->dir_count; i++) {
+                        if (set->wds[i] == ev->wd) __atomic_store_n(&set->wds[i], -1, __ATOMIC_RELAXED);
+                    }
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        rewatch();
+        // a search running now may have read a directory before this change, even with
+        // nothing cached: moving the generation keeps it from storing what it found
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+        if (stats.entries > 0) {
+            drop_entries();
+            stats.invalidations++;
+        }
+        pthread_rwlock_unlock(&cache_lock);
+    }
+}
+
+static void start_watcher(void) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) return;
+    inotify_fd = fd;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watcher_thread, NULL) != 0) {
+        close(fd);
+        inotify_fd = -1;                     // nobody would drop stale entries: no cache
+        return;
+    }
+    pthread_detach(tid);
+}
+
+static PathSet* add_path_set(const char* path_env) {
+    if (path_set_count >= MAX_PATH_SETS) return NULL;
+
+    int count = 1;
+    for (const char* p = path_env; *p; p++) {
+        if (*p == ':') count++;
+    }
+
+    PathSet* set = calloc(1, sizeof(PathSet));
+    char* copy = strdup(path_env);
+    char** dirs = calloc(count, sizeof(char*));
+    int* wds = calloc(count, sizeof(int));
+    int* on_parent = calloc(count, sizeof(int));
+    if (!set || !copy || !dirs || !wds || !on_parent) {
+        free(set);
+        free(copy);
+        free(dirs);
+        free(wds);
+        free(on_parent);
+        return NULL;
+    }
+    set->path_env = copy;
+    set->dirs = dirs;
+    set->wds = wds;
+    set->on_parent = on_parent;
+
+    // the dirs point into a second copy that gets split in place
+    char* split = strdup(path_env);
+    char* start = split;
+    for (int i = 0; i < count && split; i++) {
+        char* colon = strchr(start, ':');
+        if (colon) *colon = '\0';
+        dirs[i] = start;
+        if (start[0] != '/') set->relative = 1;
+        wds[i] = start[0] == '/' ? watch_dir(start, &on_parent[i]) : -1;
+        set->dir_count++;
+        if (colon) start = colon + 1;
+    }
+    if (!split) set->relative = 1;           // out of memory: never cache this one
+
+    set->next = path_sets;
+    path_sets = set;
+    path_set_count++;
+    return set;
+}
+
+// cache_lock is held, for writing to add a set that isn't there yet
+static PathSet* find_path_set(const char* path_env, int add) {
+    for (PathSet* set = path_sets; set; set = set->next) {
+        if (strcmp(set->path_env, path_env) == 0) return set;
+    }
+    return add ? add_path_set(path_env) : NULL;
+}
+
+// walks the PATH like execvp would. *cacheable is cleared when the answer depends on a
+// directory nobody is watching
+static char* search(const PathSet* set, const char* name, int* cacheable) {
+    char candidate[PATH_MAX];
+    *cacheable = 1;
+    for (int i = 0; i < set->dir_count; i++) {
+        if (__atomic_load_n(&set->wds[i], __ATOMIC_RELAXED) < 0) *cacheable = 0;
+        if (snprintf(candidate, sizeof(candidate), "%s/%s", set->dirs[i], name) >= (int)sizeof(candidate)) {
+            continue;
+        }
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            return strdup(candidate);
+        }
+    }
+    return NULL;
+}
+
+// copies a result out to the caller; 1 if there is one and it fits
+static int copy_out(const char* resolved, char* buf, size_t size) {
+    if (!resolved || strlen(resolved) >= size) return 0;
+    strcpy(buf, resolved);
+    return 1;
+}
+
+static Entry* find_entry(const PathSet* set, uint32_t hash, const char* name) {
+    for (Entry* e = buckets[hash % CACHE_BUCKETS]; e; e = e->next) {
+        if (e->hash == hash && e->set == set && strcmp(e->name, name) == 0) return e;
+    }
+    return NULL;
+}
+
+// keeps a search result. returns 0 if it couldn't, and the caller still owns resolved.
+// cache_lock is held for writing
+static int insert(const PathSet* set, uint32_t hash, const char* name, char* resolved) {
+    if (stats.entries >= MAX_ENTRIES) drop_entries();
+    Entry* e = malloc(sizeof(Entry));
+    char* name_copy = strdup(name);
+    if (!e || !name_copy) {
+        free(e);
+        free(name_copy);
+        return 0;
+    }
+    Entry** bucket = &buckets[hash % CACHE_BUCKETS];
+    e->set = set;
+    e->hash = hash;
+    e->name = name_copy;
+    e->resolved = resolved;
+    e->next = *bucket;
+    *bucket = e;
+    stats.entries++;
+    return 1;
+}
+
+const char* pathcache_lookup(const char* name, const char* path_env, char* buf, size_t size) {
+    if (!path_env || !*name || strchr(name, '/')) return NULL;
+    pthread_once(&watcher_once, start_watcher);
+    if (inotify_fd < 0) return NULL;
+
+    // a hit only reads the table
+    PathSet* set;
+    uint32_t hash = 0;
+    int hit = 0, found = 0;
+    pthread_rwlock_rdlock(&cache_lock);
+    set = find_path_set(path_env, 0);
+    if (set && !set->relative) {
+        hash = hash_name(name, set);
+        Entry* e = find_entry(set, hash, name);
+        if (e) {
+            hit = 1;
+            found = copy_out(e->resolved, buf, size);
+        }
+    }
+    pthread_rwlock_unlock(&cache_lock);
+    if (hit) {
+        __atomic_add_fetch(&stats.hits, 1, __ATOMIC_RELAXED);
+        return found ? buf : NULL;
+    }
+
+    if (!set) {
+        // a PATH not seen before: its directories get watched
+        pthread_rwlock_wrlock(&cache_lock);
+        set = find_path_set(path_env, 1);
+        pthread_rwlock_unlock(&cache_lock);
+        if (!set) return NULL;
+        hash = hash_name(name, set);
+    }
+    if (set->relative) return NULL;
+
+    // the search runs unlocked. if the entries were dropped meanwhile it may have seen a
+    // directory from before the change, so its answer is used but not kept
+    __atomic_add_fetch(&stats.misses, 1, __ATOMIC_RELAXED);
+    unsigned long seen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    int cacheable;
+    char* resolved = search(set, name, &cacheable);
+    found = copy_out(resolved, buf, size);
+    int kept = 0;
+    if (cacheable) {
+        pthread_rwlock_wrlock(&cache_lock);
+        if (seen == __atomic_load_n(&generation, __ATOMIC_ACQUIRE) && !find_entry(set, hash, name)) {
+            kept = insert(set, hash, name, resolved);
+        }
+        pthread_rwlock_unlock(&cache_lock);
+    }
+    if (!kept) free(resolved);
+    return found ? buf : NULL;
+}
+
+void pathcache_stats(PathCacheStats* out) {
+    pthread_rwlock_rdlock(&cache_lock);
+    *out = stats;
+    pthread_rwlock_unlock(&cache_lock);
+    out->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    out->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+}
+
+void pathcache_flush(void) {
+    pthread_rwlock_wrlock(&cache_lock);
+    drop_entries();
+    stats.invalidations++;
+    pthread_rwlock_unlock(&cache_lock);
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+#include "plan.h"
+#include "parser.h"
+
+// the operator a token stands for, or -1 for a plain word
+static int redirect_kind(const char* token) {
+    if (token[0] != '<' && token[0] != '>' && token[0] != '2') return -1;   // most tokens
+    if (strcmp(token, "<") == 0) return REDIRECT_IN;
+    if (strcmp(token, ">") == 0) return REDIRECT_OUT;
+    if (strcmp(token, "2>") == 0) return REDIRECT_ERR;
+    if (strcmp(token, "2>&1") == 0) return REDIRECT_ERR_TO_OUT;
+    return -1;
+}
+
+static int is_pipe(const char* token) {
+    return token[0] == '|' && token[1] == '\0';
+}
+
+static int is_operator(const char* token) {
+    return is_pipe(token) || redirect_kind(token) >= 0;
+}
+
+// formats a syntax error into the arena. returns -1 if even that does not fit
+static int plan_error(Plan* plan, Arena* arena, const char* fmt, const char* arg) {
+    char message[256];
+    snprintf(message, sizeof(message), fmt, arg);
+    plan->error = arena_strdup(arena, message);
+    return plan->error ? 0 : -1;
+}
+
+int plan_build(Plan* plan, const char* command, Arena* arena) {
+    plan->stages = NULL;
+    plan->stage_count = 0;
+    plan->error = NULL;
+
+    // tokenize a copy, parseInput cuts the string in place
+    char* text = arena_strdup(arena, command);
+    char** tokens = text ? arena_alloc(arena, sizeof(char*) * (countTokens(text) + 1)) : NULL;
+    if (!tokens) return -1;
+    int count;
+    parseInput(text, tokens, &count);
+    if (count == 0) return 0;
+
+    // one pass to size things: stages and redirections
+    int stage_count = 1, redirect_total = 0;
+    for (int i = 0; i < count; i++) {
+        if (is_pipe(tokens[i])) {
+            stage_count++;
+        } else if (redirect_kind(tokens[i]) >= 0) {
+            redirect_total++;
+        }
+    }
+    Stage* stages = arena_alloc(arena, sizeof(Stage) * stage_count);
+    Redirect* redirects = arena_alloc(arena, sizeof(Redirect) * (redirect_total + 1));
+    if (!stages || !redirects) return -1;
+
+    // one pass to fill them in. each stage's argv is its own slice of the token vector,
+    // compacted in place: the words move left over the redirections, and the NULL lands
+    // at the latest on the slot of the "|" (or the terminating NULL) that ends the slice
+    int start = 0;
+    for (int s = 0; s < stage_count; s++) {
+        int end = start;
+        while (end < count && !is_pipe(tokens[end])) end++;
+        if (end == start) {
+            const char* msg = (s == stage_count - 1 && s > 0) ? "Error: Command missing after pipe.\n"
+                                                              : "Error: Empty command between pipes.\n";
+            return plan_error(plan, arena, "%s", msg);
+        }
+
+        Stage* stage = &stages[s];
+        stage->argv = &tokens[start];
+        stage->argc = 0;
+        stage->redirects = redirects;
+        stage->redirect_count = 0;
+        stage->program = NULL;
+
+        for (int i = start; i < end; i++) {
+            int kind = redirect_kind(tokens[i]);
+            if (kind < 0) {
+                stage->argv[stage->argc++] = tokens[i];
+                continue;
+            }
+            Redirect* r = &stage->redirects[stage->redirect_count++];
+            r->kind = kind;
+            r->path = NULL;
+            if (kind != REDIRECT_ERR_TO_OUT) {
+                if (i + 1 >= end || is_operator(tokens[i + 1])) {
+                    return plan_error(plan, arena, "Error: Missing filename after '%s'.\n", tokens[i]);
+                }
+                r->path = tokens[++i];
+            }
+        }
+        stage->argv[stage->argc] = NULL;
+        if (stage->argc == 0) return plan_error(plan, arena, "%s", "Error: Empty command.\n");
+
+        redirects += stage->redirect_count;
+        start = end + 1;
+    }
+
+    plan->stages = stages;
+    plan->stage_count = stage_count;
+    return 0;
+}
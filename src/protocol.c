@@ -0,0 +1,80 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+void frame_encode(unsigned char out[FRAME_HEADER_SIZE], uint8_t type, uint8_t flags,
+                  uint32_t tag, uint32_t length) {
+    uint32_t tag_be = htonl(tag);
+    uint32_t len_be = htonl(length);
+
+    out[0] = type;
+    out[1] = flags;
+    out[2] = 0;                          // reserved
+    out[3] = 0;
+    memcpy(out + 4, &tag_be, 4);
+    memcpy(out + 8, &len_be, 4);
+}
+
+void frame_decode(const unsigned char in[FRAME_HEADER_SIZE], FrameHeader* header) {
+    uint32_t tag_be, len_be;
+
+    memcpy(&tag_be, in + 4, 4);
+    memcpy(&len_be, in + 8, 4);
+    header->type = in[0];
+    header->flags = in[1];
+    header->tag = ntohl(tag_be);
+    header->length = ntohl(len_be);
+}
+
+void stats_encode(unsigned char out[TASK_STATS_SIZE], const TaskStats* stats) {
+    uint64_t fields[TASK_STATS_SIZE / 8] = {
+        stats->queue_us, stats->run_us, stats->total_us, stats->user_us,
+        stats->sys_us, stats->max_rss_kb, stats->output_bytes,
+    };
+    for (int i = 0; i < TASK_STATS_SIZE / 8; i++) {
+        uint64_t be = htobe64(fields[i]);
+        memcpy(out + 8 * i, &be, 8);
+    }
+}
+
+void stats_decode(const unsigned char in[TASK_STATS_SIZE], TaskStats* stats) {
+    uint64_t fields[TASK_STATS_SIZE / 8];
+    for (int i = 0; i < TASK_STATS_SIZE / 8; i++) {
+        memcpy(&fields[i], in + 8 * i, 8);
+        fields[i] = be64toh(fields[i]);
+    }
+    stats->queue_us = fields[0];
+    stats->run_us = fields[1];
+    stats->total_us = fields[2];
+    stats->user_us = fields[3];
+    stats->sys_us = fields[4];
+    stats->max_rss_kb = fields[5];
+    stats->output_bytes = fields[6];
+}
+
+int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int write_full(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
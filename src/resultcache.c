@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "resultcache.h"
+#include "session.h"
+#include "protocol.h"
+#include "log.h"
+
+#define CACHE_BUCKETS 1024
+#define MAX_ALLOWED 256                     // programs in the allowlist
+#define ENTRY_MAX_BYTES (256 * 1024)        // bigger output is streamed, not kept
+#define TOTAL_MAX_BYTES (32 * 1024 * 1024)  // least recently used entries go past this
+#define MAX_INPUTS 8                        // < redirections in one cacheable line
+
+typedef struct Allowed {
+    char* name;
+    int ttl_ms;
+} Allowed;
+
+// a file the command read through <, as it was when the command started
+typedef struct CacheInput {
+    char* path;                 // absolute
+    int missing;                // didn't exist; the entry holds the error message
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} CacheInput;
+
+typedef struct CacheEntry {
+    struct CacheEntry* hash_next;
+    struct CacheEntry* lru_prev;            // most recently used first
+    struct CacheEntry* lru_next;
+    int refcount;                           // the table's, plus one per replay in progress
+    int linked;                             // still in the table
+    uint32_t hash;
+    char* key;
+    long long expires_ms;
+    int status;                             // wait status, never a signal
+    CacheInput inputs[MAX_INPUTS];
+    int input_count;
+    char* data;                             // the captured records
+    size_t len;
+    size_t cost;                            // what it counts against TOTAL_MAX_BYTES
+} CacheEntry;
+
+// a client sharing a running command's output
+typedef struct Subscriber {
+    struct Subscriber* next;
+    Connection* conn;
+    uint32_t tag;
+} Subscriber;
+
+struct CacheFill {
+    int refcount;                           // the task's, plus one per client joining right now
+    struct CacheFill* running_next;         // in the running table while linked
+    int linked;
+    char* key;
+    uint32_t hash;
+    long long expires_ms;                   // counted from when the command started
+    int keep;                               // store the result when it finishes
+    CacheInput inputs[MAX_INPUTS];
+    int input_count;
+    OutputCapture capture;                  // its lock also guards subscribers and finished
+    Subscriber* subscribers;
+    int finished;
+};
+
+static Allowed allowed[MAX_ALLOWED];
+static int allowed_count = 0;
+static int enabled = 0;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry* buckets[CACHE_BUCKETS];
+static CacheEntry* lru_head = NULL;
+static CacheEntry* lru_tail = NULL;
+static size_t total_bytes = 0;
+static CacheFill* running[CACHE_BUCKETS];  // fills of commands queued or running now
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static uint32_t hash_key(const char* key) {
+    uint32_t h = 2166136261u;               // FNV-1a
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void resultcache_init(const char* allowlist_path, int default_ttl_ms) {
+    if (!allowlist_path) return;
+    FILE* f = fopen(allowlist_path, "r");
+    if (!f) {
+        perror(allowlist_path);
+        exit(1);
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char name[256];
+        int ttl = default_ttl_ms;
+        int fields = sscanf(line, "%255s %d", name, &ttl);
+        if (fields < 1) continue;
+        if (ttl <= 0 || allowed_count == MAX_ALLOWED || !(allowed[allowed_count].name = strdup(name))) {
+            fprintf(stderr, "%s: bad or too many entries at \"%s\"\n", allowlist_path, name);
+            exit(1);
+        }
+        allowed[allowed_count++].ttl_ms = ttl;
+    }
+    fclose(f);
+    enabled = 1;
+    log_info("[INFO] Result cache on for %d program(s), default TTL %d ms.\n", allowed_count, default_ttl_ms);
+}
+
+int resultcache_enabled(void) {
+    return enabled;
+}
+
+// the program's TTL, or 0 if it isn't on the allowlist
+static int allowed_ttl(const char* name) {
+    for (int i = 0; i < allowed_count; i++) {
+        if (strcmp(allowed[i].name, name) == 0) return allowed[i].ttl_ms;
+    }
+    return 0;
+}
+
+static void record_input(CacheInput* input) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    input->missing = stat(input->path, &st) < 0;
+    input->dev = st.st_dev;
+    input->ino = st.st_ino;
+    input->size = st.st_size;
+    input->mtime = st.st_mtim;
+}
+
+// is every input still what the command saw?
+static int inputs_unchanged(const CacheInput* inputs, int count) {
+    for (int i = 0; i < count; i++) {
+        CacheInput now = { .path = inputs[i].path };
+        record_input(&now);
+        if (now.missing != inputs[i].missing || now.dev != inputs[i].dev || now.ino != inputs[i].ino ||
+            now.size != inputs[i].size || now.mtime.tv_sec != inputs[i].mtime.tv_sec ||
+            now.mtime.tv_nsec != inputs[i].mtime.tv_nsec) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void free_inputs(CacheInput* inputs, int count) {
+    for (int i = 0; i < count; i++) free(inputs[i].path);
+}
+
+static void entry_unref(CacheEntry* entry) {
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    free_inputs(entry->inputs, entry->input_count);
+    free(entry->key);
+    free(entry->data);
+    free(entry);
+}
+
+static void lru_unlink(CacheEntry* entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(CacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+// takes an entry out of the table and the LRU list. cache_lock is held
+static void unlink_entry(CacheEntry* entry) {
+    if (!entry->linked) return;
+    CacheEntry** link = &buckets[entry->hash % CACHE_BUCKETS];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    lru_unlink(entry);
+
+    entry->linked = 0;
+    total_bytes -= entry->cost;
+    entry_unref(entry);                     // the table's reference
+}
+
+// cache_lock is held
+static CacheEntry* find_entry(const char* key, uint32_t hash) {
+    for (CacheEntry* e = buckets[hash % CACHE_BUCKETS]; e; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->key, key) == 0) return e;
+    }
+    return NULL;
+}
+
+// sends captured records to the client, the way the command's own frames went out
+static void send_records(Connection* conn, uint32_t tag, const char* data, size_t size) {
+    for (size_t at = 0; at < size; ) {
+        uint8_t type = (uint8_t)data[at];
+        uint32_t len;
+        memcpy(&len, data + at + 1, 4);
+        conn_send_frame(conn, type, 0, tag, data + at + 5, len);
+        at += 5 + len;
+    }
+}
+
+// sends a stored result
+static void replay(Connection* conn, uint32_t tag, const CacheEntry* entry) {
+    send_records(conn, tag, entry->data, entry->len);
+    uint32_t code = htonl(WEXITSTATUS(entry->status));
+    conn_send_frame(conn, FRAME_EXIT, 0, tag, &code, sizeof(code));
+    conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+}
+
+static void fill_unref(CacheFill* fill) {
+    if (__atomic_sub_fetch(&fill->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    free_inputs(fill->inputs, fill->input_count);
+    capture_release(&fill->capture);
+    free(fill->key);
+    free(fill);
+}
+
+// cache_lock is held for these four
+static CacheFill* find_running(const char* key, uint32_t hash) {
+    for (CacheFill* f = running[hash % CACHE_BUCKETS]; f; f = f->running_next) {
+        if (f->hash == hash && strcmp(f->key, key) == 0) return f;
+    }
+    return NULL;
+}
+
+static void link_running(CacheFill* fill) {
+    CacheFill** bucket = &running[fill->hash % CACHE_BUCKETS];
+    fill->running_next = *bucket;
+    *bucket = fill;
+    fill->linked = 1;
+}
+
+static void unlink_running(CacheFill* fill) {
+    if (!fill->linked) return;
+    CacheFill** link = &running[fill->hash % CACHE_BUCKETS];
+    while (*link != fill) link = &(*link)->running_next;
+    *link = fill->running_next;
+    fill->linked = 0;
+}
+
+// did both commands find their < files in the same state?
+static int same_inputs(const CacheFill* a, const CacheFill* b) {
+    for (int i = 0; i < a->input_count; i++) {
+        const CacheInput* x = &a->inputs[i];
+        const CacheInput* y = &b->inputs[i];
+        if (x->missing != y->missing || x->dev != y->dev || x->ino != y->ino || x->size != y->size ||
+            x->mtime.tv_sec != y->mtime.tv_sec || x->mtime.tv_nsec != y->mtime.tv_nsec) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the key: cwd, environment and the command's words, each on a line of its own (a
+// command line can't contain a newline). NULL when out of memory
+static char* build_key(const char* cwd, const Session* session, char* argv[], int argc) {
+    size_t size = strlen(cwd) + 18;
+    for (int i = 0; i < argc; i++) size += strlen(argv[i]) + 1;
+    char* key = malloc(size);
+    if (!key) return NULL;
+    size_t len = snprintf(key, size, "%s\n%016" PRIx64, cwd, session_env_hash(session));
+    for (int i = 0; i < argc; i++) {
+        len += snprintf(key + len, size - len, "\n%s", argv[i]);
+    }
+    return key;
+}
+
+// a new subscriber of fill gets everything the command sent so far, then the rest as it
+// comes. returns 0 if the command already finished or no longer keeps its output
+static int join_running(CacheFill* fill, Connection* conn, uint32_t tag) {
+    Subscriber* sub = malloc(sizeof(Subscriber));
+    if (!sub) return 0;
+
+    OutputCapture* capture = &fill->capture;
+    pthread_mutex_lock(&capture->lock);
+    if (fill->finished || capture->overflow) {
+        pthread_mutex_unlock(&capture->lock);
+        free(sub);
+        return 0;
+    }
+    send_records(conn, tag, capture->data, capture->len);
+    conn_ref(conn);
+    conn_command_started(conn);              // counts against the client's in-flight limit
+    sub->conn = conn;
+    sub->tag = tag;
+    sub->next = fill->subscribers;
+    fill->subscribers = sub;
+    __atomic_add_fetch(&capture->listeners, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&capture->lock);
+    return 1;
+}
+
+// capture->fanout: sends a frame of the running command on to its subscribers. the
+// capture lock is held
+static void fan_out(OutputCapture* capture, uint8_t type, const void* data, size_t len) {
+    CacheFill* fill = (CacheFill*)((char*)capture - offsetof(CacheFill, capture));
+    for (Subscriber* sub = fill->subscribers; sub; sub = sub->next) {
+        conn_send_frame(sub->conn, type, 0, sub->tag, data, len);
+    }
+}
+
+static CacheFill* new_fill(char* key, uint32_t hash, int ttl, const char* cwd,
+                           const char** inputs, int input_count) {
+    CacheFill* fill = calloc(1, sizeof(CacheFill));
+    if (!fill) {
+        free(key);
+        return NULL;
+    }
+    fill->refcount = 1;
+    fill->key = key;
+    fill->hash = hash;
+    fill->keep = 1;
+    fill->expires_ms = now_ms() + ttl;
+    capture_init(&fill->capture, ENTRY_MAX_BYTES, fan_out);
+    for (int i = 0; i < input_count; i++) {
+        char path[PATH_MAX];
+        const char* name = inputs[i];
+        if (name[0] != '/') {
+            if (snprintf(path, sizeof(path), "%s/%s", cwd, name) >= (int)sizeof(path)) break;
+            name = path;
+        }
+        if (!(fill->inputs[i].path = strdup(name))) break;
+        record_input(&fill->inputs[i]);
+        fill->input_count++;
+    }
+    if (fill->input_count < input_count) {
+        fill_unref(fill);
+        return NULL;
+    }
+    return fill;
+}
+
+int resultcache_serve(Connection* conn, uint32_t tag, char* argv[], int argc, CacheFill** fill) {
+    *fill = NULL;
+    if (!enabled) return 0;
+
+    // every stage has to run an allowed program, and nothing may be written
+    const char* inputs[MAX_INPUTS];
+    int input_count = 0;
+    int ttl = INT_MAX;
+    for (int i = 0; i < argc; i++) {
+        if (i == 0 || strcmp(argv[i - 1], "|") == 0) {
+            int program_ttl = allowed_ttl(argv[i]);
+            if (program_ttl == 0) return 0;
+            if (program_ttl < ttl) ttl = program_ttl;
+        }
+        if (strcmp(argv[i], ">") == 0 || strcmp(argv[i], "2>") == 0) return 0;
+        if (strcmp(argv[i], "<") == 0) {
+            if (i + 1 == argc || input_count == MAX_INPUTS) return 0;
+            inputs[input_count++] = argv[++i];
+        }
+    }
+
+    const Session* session = conn->session;
+    char cwd_buf[PATH_MAX];
+    const char* cwd = session_cwd(session, cwd_buf, sizeof(cwd_buf));
+    char* key = cwd ? build_key(cwd, session, argv, argc) : NULL;
+    if (!key) return 0;
+    uint32_t hash = hash_key(key);
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry* entry = find_entry(key, hash);
+    if (entry) {
+        __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+        lru_unlink(entry);
+        lru_push_front(entry);
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (entry) {
+        // the checks stat files, so they run outside the lock
+        if (now_ms() < entry->expires_ms && inputs_unchanged(entry->inputs, entry->input_count)) {
+            replay(conn, tag, entry);
+            entry_unref(entry);
+            free(key);
+            return 1;
+        }
+        pthread_mutex_lock(&cache_lock);
+        unlink_entry(entry);
+        pthread_mutex_unlock(&cache_lock);
+        entry_unref(entry);
+    }
+
+    // a miss. if the same command is running already (same inputs too), share its
+    // output; otherwise this one runs and becomes what later lines share
+    CacheFill* mine = new_fill(key, hash, ttl, cwd, inputs, input_count);
+    if (!mine) return 0;
+    pthread_mutex_lock(&cache_lock);
+    CacheFill* running = find_running(mine->key, mine->hash);
+    if (running && same_inputs(running, mine)) {
+        __atomic_add_fetch(&running->refcount, 1, __ATOMIC_RELAXED);
+    } else {
+        running = NULL;
+        link_running(mine);
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (running) {
+        int joined = join_running(running, conn, tag);
+        fill_unref(running);
+        if (joined) {
+            fill_unref(mine);
+            return 2;
+        }
+        // it finished in the meantime; run our own after all
+    }
+    *fill = mine;
+    return 0;
+}
+
+OutputCapture* resultcache_capture(CacheFill* fill) {
+    return fill ? &fill->capture : NULL;
+}
+
+int resultcache_shared(CacheFill* fill) {
+    return fill && __atomic_load_n(&fill->capture.listeners, __ATOMIC_RELAXED) > 0;
+}
+
+void resultcache_no_store(CacheFill* fill) {
+    if (fill) fill->keep = 0;
+}
+
+// ends a running command for its subscribers: EXIT with status, or an error if it
+// was cancelled. nobody can join once this returns
+static void finish_running(CacheFill* fill, int status, int cancelled) {
+    pthread_mutex_lock(&cache_lock);
+    unlink_running(fill);
+    pthread_mutex_unlock(&cache_lock);
+
+    pthread_mutex_lock(&fill->capture.lock);
+    fill->finished = 1;
+    Subscriber* sub = fill->subscribers;
+    fill->subscribers = NULL;
+    __atomic_store_n(&fill->capture.listeners, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&fill->capture.lock);
+
+    uint32_t code = htonl(WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+    uint8_t flags = WIFSIGNALED(status) ? FRAME_FLAG_SIGNALED : 0;
+    const char* msg = "Error: the shared command was cancelled\n";
+    while (sub) {
+        Subscriber* next = sub->next;
+        if (cancelled) {
+            conn_send_frame(sub->conn, FRAME_ERROR, 0, sub->tag, msg, strlen(msg));
+        } else {
+            conn_send_frame(sub->conn, FRAME_EXIT, flags, sub->tag, &code, sizeof(code));
+        }
+        conn_send_frame(sub->conn, FRAME_DONE, 0, sub->tag, NULL, 0);
+        conn_command_finished(sub->conn);
+        conn_unref(sub->conn);
+        free(sub);
+        sub = next;
+    }
+}
+
+void resultcache_abandon(CacheFill* fill) {
+    if (!fill) return;
+    finish_running(fill, 0, 1);
+    fill_unref(fill);
+}
+
+void resultcache_complete(CacheFill* fill, int status) {
+    if (!fill) return;
+    finish_running(fill, status, 0);
+    if (!fill->keep || fill->capture.overflow || WIFSIGNALED(status) || now_ms() >= fill->expires_ms) {
+        fill_unref(fill);
+        return;
+    }
+
+    CacheEntry* entry = calloc(1, sizeof(CacheEntry));
+    if (!entry) {
+        fill_unref(fill);
+        return;
+    }
+    // the entry takes over the fill's key, inputs and output; nothing else reads them
+    // now that the fill is finished
+    entry->refcount = 1;
+    entry->linked = 1;
+    entry->hash = fill->hash;
+    entry->key = fill->key;
+    entry->expires_ms = fill->expires_ms;
+    entry->status = status;
+    memcpy(entry->inputs, fill->inputs, sizeof(fill->inputs));
+    entry->input_count = fill->input_count;
+    entry->data = fill->capture.data;
+    entry->len = fill->capture.len;
+    entry->cost = sizeof(CacheEntry) + strlen(entry->key) + entry->len;
+    fill->key = NULL;
+    fill->input_count = 0;
+    fill->capture.data = NULL;
+    fill_unref(fill);
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry* old = find_entry(entry->key, entry->hash);
+    if (old) unlink_entry(old);
+    CacheEntry** bucket = &buckets[entry->hash % CACHE_BUCKETS];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    lru_push_front(entry);
+    total_bytes += entry->cost;
+    while (total_bytes > TOTAL_MAX_BYTES && lru_tail != entry) unlink_entry(lru_tail);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -1,214 +1,804 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <arpa/inet.h>
 #include "scheduler.h"
-#include "parser.h"
+#include "taskqueue.h"
+#include "policy.h"
+#include "taskpool.h"
 #include "executor.h"
+#include "spawner.h"
+#include "builtins.h"
+#include "pathcache.h"
+#include "output.h"
+#include "config.h"
+#include "admission.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
+#include "threadblock.h"
 
-// these define our scheduling quantum (time slice) for each round
-#define FIRST_ROUND_QUANTUM 3   // first time a task runs, it gets 3 seconds
-#define NEXT_ROUND_QUANTUM 7    // subsequent rounds get 7 seconds
 #define BUFFER_SIZE 4096        // for reading/writing data
 
+// every worker thread owns a run queue (see taskqueue.h). new tasks are spread over
+// the queues and an idle worker steals from the others, so no lock is shared by all workers
+typedef struct Worker {
+    int id;
+    pthread_t tid;
+    RunQueue queue;
+    int wake_fd;                // eventfd, written when work shows up for this worker
+    int timer_fd;               // timerfd ticking once a second while a demo task runs
+    int idle;                   // set while the worker waits on wake_fd
+} Worker;
+
 // global variables for our task management
-Task* task_queue = NULL;        // our linked list of tasks starts empty
-pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;  // mutex to protect the queue
+static Worker* workers = NULL;
+static int worker_count = 0;
+static unsigned int next_queue = 0;  // round robin target for new tasks
+static int devnull_fd = -1;          // stdin of every shell command, opened once
 int task_id_counter = 1;        // we start counting tasks from 1
 
 // Function declarations
-void execute_shell_command(Task* task);
-
-// this function adds a new task to our queue (basic version without socket)
-void add_task(const char* command, int client_id, int burst_time, int is_shell) {
-    Task* new_task = (Task*)malloc(sizeof(Task)); // allocate memory for the new task
-    new_task->task_id = task_id_counter++;       // increment the task id counter as we create a new task
+static int start_shell_command(Task* task, int* status);
+
+// returns NULL when there is no memory for the task
+static Task* create_task(const char* command, int client_id, int burst_time, int is_shell,
+                         Connection* conn, uint32_t tag, CacheFill* fill) {
+    Task* new_task = taskpool_get();             // a recycled task, or one from a new slab
+    if (!new_task) return NULL;
+    new_task->command = arena_strdup(&new_task->arena, command);  // any length, no truncation
+    // shell commands are compiled once, here, into the plan the child will run
+    if (!new_task->command || (is_shell && plan_build(&new_task->plan, command, &new_task->arena) < 0)) {
+        taskpool_put(new_task);
+        return NULL;
+    }
+    new_task->task_id = __atomic_fetch_add(&task_id_counter, 1, __ATOMIC_RELAXED);  // event loops add tasks concurrently
+    new_task->tag = tag;
     new_task->client_id = client_id;
     new_task->burst_time = burst_time;           // total time needed for the task
     new_task->remaining_time = burst_time;       // initially, remaining time equals burst time
     new_task->is_shell = is_shell;
     new_task->round_count = 0;                   // task hasn't run yet
-    new_task->socket_fd = -1;                    // no socket in this version
+    new_task->conn = conn;                       // store the connection to send results back
+    if (conn) conn_ref(conn);                    // keeps the socket open while the task exists
     new_task->current_iteration = 0;             // for demo tasks, start at iteration 0
-    strncpy(new_task->command, command, sizeof(new_task->command) - 1);
-    new_task->command[sizeof(new_task->command) - 1] = '\0';
+    new_task->pid = 0;
+    new_task->pids = NULL;
+    new_task->status_fd = -1;
+    // the session as of this line: a later cd or export doesn't change a queued command
+    new_task->session = is_shell && conn ? session_ref(conn->session) : NULL;
+    new_task->fill = fill;
+    new_task->out_fd = -1;
+    new_task->err_fd = -1;
+    new_task->running_on = -1;
+    clock_gettime(CLOCK_MONOTONIC, &new_task->received_at);
+    new_task->wait_ns = 0;
+    new_task->run_ns = 0;
+    new_task->output = (OutputCount){ 0 };
+    new_task->started_ns = 0;
+    new_task->usage = (PipelineResult){ 0 };
+    new_task->queue = NULL;
     new_task->next = NULL;
+    new_task->prev = NULL;
+    new_task->heap_index = -1;
+    new_task->flow = NULL;
+
+    // the client's task list lets a disconnect find its tasks without scanning every queue
+    new_task->client_prev = NULL;
+    new_task->client_next = NULL;
+    if (conn) {
+        pthread_mutex_lock(&conn->task_lock);
+        new_task->client_next = conn->tasks;
+        if (conn->tasks) conn->tasks->client_prev = new_task;
+        conn->tasks = new_task;
+        pthread_mutex_unlock(&conn->task_lock);
+    }
+    return new_task;
+}
 
-    pthread_mutex_lock(&queue_mutex);            // protect the queue while we add the task
-    if (task_queue == NULL) {
-        task_queue = new_task;                   // if queue is empty, new task becomes head
+// unlinks the task from its client's list. the caller holds conn->task_lock
+static void unlink_client_task(Task* task) {
+    Connection* conn = task->conn;
+    if (task->client_prev) {
+        task->client_prev->client_next = task->client_next;
     } else {
-        Task* temp = task_queue;
-        while (temp->next != NULL) temp = temp->next;
-        temp->next = new_task;                   // add new task to the end of queue
+        conn->tasks = task->client_next;
     }
-    pthread_mutex_unlock(&queue_mutex);
+    if (task->client_next) task->client_next->client_prev = task->client_prev;
+}
 
-    printf("[QUEUE] Added Task ID %d (Client #%d), Burst Time: %d, Shell: %d\n",
-           new_task->task_id, client_id, burst_time, is_shell);
+// waits for every stage of a shell task's pipeline and keeps their resource usage in
+// task->usage. returns the wait status of the last stage, the one the client sees
+// (1 << 8 if that one never started)
+static int reap_stages(Task* task) {
+    task->usage = (PipelineResult){ .status = 1 << 8 };
+    for (int i = 0; i < task->plan.stage_count; i++) {
+        int status;
+        struct rusage usage;
+        if (task->pids[i] > 0 && wait4(task->pids[i], &status, 0, &usage) > 0) {
+            if (i == task->plan.stage_count - 1) task->usage.status = status;
+            pipeline_add_usage(&task->usage, &usage);
+        }
+    }
+    task->pid = 0;
+    return task->usage.status;
 }
 
-// this function adds a task with socket information (used for remote execution)
-void add_task_with_socket(const char* command, int client_id, int burst_time, int is_shell, int socket_fd) {
-    Task* new_task = (Task*)malloc(sizeof(Task));
-    new_task->task_id = task_id_counter++;
-    new_task->client_id = client_id;
-    new_task->burst_time = burst_time;
-    new_task->remaining_time = burst_time;
-    new_task->is_shell = is_shell;
-    new_task->round_count = 0;
-    new_task->socket_fd = socket_fd;             // store the socket to send results back
-    new_task->current_iteration = 0;             // start at iteration 0 for demo tasks
-    strncpy(new_task->command, command, sizeof(new_task->command) - 1);
-    new_task->command[sizeof(new_task->command) - 1] = '\0';
-    new_task->next = NULL;
+// waits until a shell task's pipeline is done and returns the last stage's wait status,
+// from the spawner helper that started it or by reaping the stages directly
+static int collect_status(Task* task) {
+    if (task->status_fd < 0) return reap_stages(task);
 
-    pthread_mutex_lock(&queue_mutex);
-    if (task_queue == NULL) {
-        task_queue = new_task;
-    } else {
-        Task* temp = task_queue;
-        while (temp->next != NULL) temp = temp->next;
-        temp->next = new_task;
+    if (read_full(task->status_fd, &task->usage, sizeof(task->usage)) < 0) {
+        task->usage = (PipelineResult){ .status = 1 << 8 };   // the helper died
+    }
+    close(task->status_fd);
+    task->status_fd = -1;
+    task->pid = 0;
+    return task->usage.status;
+}
+
+// kills a shell task's process group if it is still around (stopped in a queue, or the
+// client left mid-command) and reaps its stages. a helper reaps its own children, so
+// then dropping the status pipe is enough
+static void release_process(Task* task) {
+    if (task->pid > 0) {
+        kill(-task->pid, SIGKILL);               // works on stopped processes too
+        if (task->status_fd >= 0) {
+            close(task->status_fd);
+            task->status_fd = -1;
+            task->pid = 0;
+        } else {
+            reap_stages(task);
+        }
+    }
+    if (task->out_fd >= 0) close(task->out_fd);
+    if (task->err_fd >= 0) close(task->err_fd);
+    task->out_fd = task->err_fd = -1;
+}
+
+static void free_task(Task* task) {
+    metrics_count(COUNT_OUTPUT_BYTES, task->output.bytes);
+    release_process(task);
+    if (task->conn) {
+        pthread_mutex_lock(&task->conn->task_lock);
+        unlink_client_task(task);
+        pthread_mutex_unlock(&task->conn->task_lock);
     }
-    pthread_mutex_unlock(&queue_mutex);
+    conn_unref(task->conn);                      // drop the task's hold on the client
+    session_unref(task->session);
+    resultcache_abandon(task->fill);             // NULL unless the command didn't finish
+    taskpool_put(task);                          // back to the pool, arena and all
+}
 
-    printf("[QUEUE] Added Task ID %d (Client #%d), Burst Time: %d, Shell: %d\n",
-           new_task->task_id, client_id, burst_time, is_shell);
+// ends a task that could not be queued and tells the client why
+static void fail_task(Task* task, const char* msg) {
+    conn_send_frame(task->conn, FRAME_ERROR, 0, task->tag, msg, strlen(msg));
+    conn_send_frame(task->conn, FRAME_DONE, 0, task->tag, NULL, 0);
+    conn_command_finished(task->conn);
+    free_task(task);
 }
 
-// removes a specific task from our queue
-void remove_task(Task* task) {
-    if (!task) return;
+// adds a task to a run queue. returns -1 (task untouched) when the queue cannot grow
+static int push_task(RunQueue* queue, Task* task) {
+    clock_gettime(CLOCK_MONOTONIC, &task->queued_at);
+    trace_task(TRACE_ENQUEUE, task, 0);
+    pthread_mutex_lock(&queue->lock);
+    int rc = runqueue_push(queue, task);
+    pthread_mutex_unlock(&queue->lock);
+    return rc;
+}
 
-    Task* curr = task_queue;
-    Task* prev = NULL;
+static void wake_worker(Worker* worker) {
+    uint64_t one = 1;
+    if (write(worker->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("[ERROR] eventfd write failed");
+    }
+}
 
-    while (curr) {
-        if (curr == task) {
-            if (prev == NULL) {
-                task_queue = curr->next;         // if it's the first task, update head
-            } else {
-                prev->next = curr->next;         // skip this task in the linked list
+// spreads tasks over the worker queues and wakes whoever should run them
+static void place_task(Task* task) {
+    unsigned int target = __atomic_fetch_add(&next_queue, 1, __ATOMIC_RELAXED) % worker_count;
+    if (push_task(&workers[target].queue, task) < 0) {
+        log_error("[ERROR] Out of memory queueing Task ID %d\n", task->task_id);
+        fail_task(task, "Error: server out of memory\n");
+        return;
+    }
+
+    // the owner always hears about it (a shell task may preempt its demo). if the owner
+    // is busy, also wake an idle worker so it can steal the task right away
+    wake_worker(&workers[target]);
+    if (!__atomic_load_n(&workers[target].idle, __ATOMIC_SEQ_CST)) {
+        for (int i = 1; i < worker_count; i++) {
+            Worker* other = &workers[(target + i) % worker_count];
+            if (__atomic_load_n(&other->idle, __ATOMIC_SEQ_CST)) {
+                wake_worker(other);
+                break;
             }
-            free(curr);                          // free the memory
-            return;
         }
-        prev = curr;
-        curr = curr->next;
     }
 }
 
-// removes all tasks for a specific client (used when client disconnects)
-void remove_tasks_by_client(int client_id) {
-    pthread_mutex_lock(&queue_mutex);            // protect the queue while we modify it
-    Task* curr = task_queue;
-    Task* prev = NULL;
+static void enqueue_task(Task* task) {
+    // log first: once the task is queued a worker may run and free it at any moment
+    log_debug("[QUEUE] Added Task ID %d (Client #%d), Burst Time: %d, Shell: %d\n",
+              task->task_id, task->client_id, task->burst_time, task->is_shell);
+    place_task(task);
+}
 
-    while (curr) {
-        if (curr->client_id == client_id) {
-            Task* to_delete = curr;
-            if (prev == NULL) {
-                task_queue = curr->next;
-                curr = task_queue;
-            } else {
-                prev->next = curr->next;
-                curr = curr->next;
+void resume_parked_tasks(Task* parked) {
+    while (parked) {
+        Task* next = parked->parked_next;
+        parked->parked_next = NULL;
+        log_debug("[RESUME] Task ID %d (Client #%d), its client caught up with the output\n",
+                  parked->task_id, parked->client_id);
+        place_task(parked);
+        parked = next;
+    }
+}
+
+// the client is behind on reading this task's output: the task leaves the worker and
+// waits on the connection until the event loop has sent enough. returns 0 if the ring
+// had room again by now (the caller requeues it). checked under send_mutex, which the
+// loop's flush takes too, so the task can't miss the drain
+static int park_for_output(Task* task) {
+    Connection* conn = task->conn;
+    int parked = 0;
+    if (!conn) return 0;
+    pthread_mutex_lock(&conn->send_mutex);
+    if (conn_output_full(conn)) {
+        trace_task(TRACE_PARK, task, 0);         // before the loop can take it
+        task->parked_next = conn->parked;
+        conn->parked = task;
+        parked = 1;
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    return parked;
+}
+
+// this function adds a new task to our queue (basic version without socket)
+void add_task(const char* command, int client_id, int burst_time, int is_shell) {
+    Task* task = create_task(command, client_id, burst_time, is_shell, NULL, 0, NULL);
+    if (task) enqueue_task(task);
+}
+
+// this function adds a task with its client connection (used for remote execution)
+void add_task_with_conn(const char* command, int client_id, int burst_time, int is_shell, Connection* conn, uint32_t tag,
+                        CacheFill* fill) {
+    Task* task = create_task(command, client_id, burst_time, is_shell, conn, tag, fill);
+    if (!task) {
+        resultcache_abandon(fill);
+        const char* msg = "Error: server out of memory\n";
+        conn_send_frame(conn, FRAME_ERROR, 0, tag, msg, strlen(msg));
+        conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+        conn_command_finished(conn);
+        return;
+    }
+    enqueue_task(task);
+}
+
+// takes the next task for this worker: from its own queue if it has one, otherwise
+// stolen from another worker. shell tasks anywhere win over our own demo tasks
+static Task* next_task(Worker* self) {
+    Task* task = NULL;
+
+    pthread_mutex_lock(&self->queue.lock);
+    if (runqueue_has_shell(&self->queue)) task = runqueue_pop(&self->queue);
+    pthread_mutex_unlock(&self->queue.lock);
+    if (task) return task;
+
+    // first look for a shell task to steal, then settle for anything
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 1; i < worker_count; i++) {
+            RunQueue* victim = &workers[(self->id + i) % worker_count].queue;
+            if (__atomic_load_n(&victim->length, __ATOMIC_RELAXED) == 0) continue;  // cheap peek
+            pthread_mutex_lock(&victim->lock);
+            if (pass == 1 || runqueue_has_shell(victim)) task = runqueue_pop(victim);
+            pthread_mutex_unlock(&victim->lock);
+            if (task) {
+                log_debug("[STEAL] Worker %d took Task ID %d from Worker %d\n",
+                          self->id, task->task_id, (self->id + i) % worker_count);
+                return task;
             }
-            free(to_delete);
-        } else {
-            prev = curr;
-            curr = curr->next;
+        }
+        if (pass == 0) {
+            // no shell work anywhere else, run our own demo tasks before stealing demos
+            pthread_mutex_lock(&self->queue.lock);
+            task = runqueue_pop(&self->queue);
+            pthread_mutex_unlock(&self->queue.lock);
+            if (task) return task;
         }
     }
+    return NULL;
+}
 
-    pthread_mutex_unlock(&queue_mutex);
+// frees a task of a client that left, once it is out of every queue. the caller holds
+// conn->task_lock
+static void drop_client_task(Task* task) {
+    metrics_count(COUNT_OUTPUT_BYTES, task->output.bytes);
+    unlink_client_task(task);
+    release_process(task);
+    conn_command_finished(task->conn);
+    conn_unref(task->conn);                  // never the last ref, the caller holds one
+    session_unref(task->session);
+    resultcache_abandon(task->fill);
+    taskpool_put(task);
 }
 
-// this is our main scheduling loop that runs in a separate thread
-void* scheduler_loop(void* arg) {
-    while (1) {
-        pthread_mutex_lock(&queue_mutex);
-        if (task_queue == NULL) {
-            pthread_mutex_unlock(&queue_mutex);
-            usleep(100000);                      // sleep a bit if no tasks
+// removes all queued tasks of a client (used when client disconnects). it walks the
+// client's own task list instead of every queue. stopped shell commands are killed.
+// tasks that are already running end at their next quantum, their sends just fail.
+// lock order is conn->task_lock, then a queue lock. a command other clients joined
+// (see resultcache.h) stays and runs for them
+void remove_tasks_by_client(Connection* conn) {
+    pthread_mutex_lock(&conn->task_lock);
+
+    // tasks parked for output the client will never read: no queue, no worker has them.
+    // the connection is closed, so nothing parks here any more after this
+    pthread_mutex_lock(&conn->send_mutex);
+    Task* parked = conn->parked;
+    conn->parked = NULL;
+    pthread_mutex_unlock(&conn->send_mutex);
+    while (parked) {
+        Task* next = parked->parked_next;
+        parked->parked_next = NULL;
+        if (resultcache_shared(parked->fill)) {
+            resume_parked_tasks(parked);     // just this one: still runs for the clients that joined it
+        } else {
+            drop_client_task(parked);
+        }
+        parked = next;
+    }
+
+    Task* curr = conn->tasks;
+    while (curr) {
+        Task* next = curr->client_next;
+        int removed = 0;
+        if (resultcache_shared(curr->fill)) {
+            curr = next;
             continue;
         }
 
-        // select the next task to run (shortest remaining time for demo, priority for shell)
-        Task* selected = task_queue;
-        Task* curr = task_queue;
-        while (curr) {
-            if (!curr->is_shell && curr->remaining_time < selected->remaining_time) {
-                selected = curr;                  // pick task with least time remaining
+        // a worker may move the task between queues while we look, so recheck under the lock
+        RunQueue* queue;
+        while ((queue = __atomic_load_n(&curr->queue, __ATOMIC_ACQUIRE)) != NULL) {
+            pthread_mutex_lock(&queue->lock);
+            if (curr->queue == queue) {
+                runqueue_remove(queue, curr);
+                removed = 1;
+            }
+            pthread_mutex_unlock(&queue->lock);
+            if (removed) break;
+        }
+
+        int running_on = __atomic_load_n(&curr->running_on, __ATOMIC_RELAXED);
+        if (!removed && running_on >= 0) {
+            wake_worker(&workers[running_on]);   // it notices the closed connection and stops early
+        }
+
+        if (removed) drop_client_task(curr);
+        curr = next;
+    }
+    pthread_mutex_unlock(&conn->task_lock);
+}
+
+int scheduler_queued_tasks(void) {
+    int queued = 0;
+    for (int i = 0; i < worker_count; i++) {
+        queued += __atomic_load_n(&workers[i].queue.length, __ATOMIC_RELAXED);
+    }
+    return queued;
+}
+
+int scheduler_worker_state(int worker, int* busy) {
+    if (worker >= worker_count) return -1;
+    *busy = !__atomic_load_n(&workers[worker].idle, __ATOMIC_RELAXED);
+    return __atomic_load_n(&workers[worker].queue.length, __ATOMIC_RELAXED);
+}
+
+// nobody wants the task's output any more: its client left and no one shares it
+static int task_orphaned(Task* task) {
+    return conn_is_closed(task->conn) && !resultcache_shared(task->fill);
+}
+
+// tells the client how the task ended, using the status from waitpid
+static void send_exit_status(Task* task, int status) {
+    uint32_t code = 0;
+    uint8_t flags = 0;
+    if (WIFSIGNALED(status)) {
+        code = htonl(WTERMSIG(status));
+        flags = FRAME_FLAG_SIGNALED;
+    } else {
+        code = htonl(WEXITSTATUS(status));
+    }
+    conn_send_frame(task->conn, FRAME_EXIT, flags, task->tag, &code, sizeof(code));
+}
+
+// blocks until someone enqueues work (a stale wakeup just means one extra look at the queues)
+static void wait_for_work(Worker* self) {
+    struct pollfd pfd = { .fd = self->wake_fd, .events = POLLIN };
+    uint64_t count;
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+    }
+    if (read(self->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("[ERROR] eventfd read failed");
+    }
+}
+
+// does our own queue hold a task the running one should make way for (see policy.h)?
+static int preempt_waiting(Worker* self, const Task* running) {
+    if (__atomic_load_n(&self->queue.length, __ATOMIC_RELAXED) == 0) return 0;
+    pthread_mutex_lock(&self->queue.lock);
+    int found = policy_preempts(&self->queue, running);
+    pthread_mutex_unlock(&self->queue.lock);
+    return found;
+}
+
+// waits for the next one second demo tick. returns 1 if a shell task arrived for this
+// worker or the client left in the meantime, so the caller can end the round early
+static int wait_for_tick(Worker* self, Task* task) {
+    struct pollfd pfds[2] = {
+        { .fd = self->timer_fd, .events = POLLIN },
+        { .fd = self->wake_fd, .events = POLLIN },
+    };
+    int preempt = 0;
+    uint64_t count;
+
+    while (1) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] poll failed");
+            return preempt;
+        }
+        if (pfds[1].revents & POLLIN) {
+            if (read(self->wake_fd, &count, sizeof(count)) > 0 &&
+                (preempt_waiting(self, task) || conn_is_closed(task->conn))) {
+                preempt = 1;
             }
-            if (curr->is_shell && !selected->is_shell) {
-                selected = curr;                  // shell commands get priority
+        }
+        if (pfds[0].revents & POLLIN) {
+            if (read(self->timer_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("[ERROR] timerfd read failed");
+            }
+            return preempt;
+        }
+    }
+}
+
+// runs up to `iterations` demo iterations, one per timer tick. returns how many ran
+static int run_demo_round(Worker* self, Task* task, int iterations) {
+    struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+    struct itimerspec off = { { 0, 0 }, { 0, 0 } };
+    int done = 0;
+
+    timerfd_settime(self->timer_fd, 0, &tick, NULL);
+    while (done < iterations && task->current_iteration < task->burst_time) {
+        char output[BUFFER_SIZE];
+        snprintf(output, sizeof(output), "Demo %d/%d\n", task->current_iteration, task->burst_time - 1);
+        conn_send_frame(task->conn, FRAME_STDOUT, 0, task->tag, output, strlen(output));
+        task->output.bytes += strlen(output);
+        int preempt = wait_for_tick(self, task);
+        task->current_iteration++;
+        done++;
+        if (preempt || conn_is_closed(task->conn) || conn_output_full(task->conn)) break;
+    }
+    timerfd_settime(self->timer_fd, 0, &off, NULL);
+    return done;
+}
+
+static void arm_timer(Worker* self, long ms) {
+    struct itimerspec its = { .it_value = { ms / 1000, (ms % 1000) * 1000000 } };
+    timerfd_settime(self->timer_fd, 0, &its, NULL);
+}
+
+static long elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// runs a shell task for one quantum: starts it the first time, resumes its stopped
+// process group after that, and forwards its output meanwhile. returns 1 when the
+// command finished (*status holds the wait status), or 0 when the quantum ran out (or
+// the client's output ring filled up) and the process group was stopped again. output
+// the group writes while stopped waits in the pipes until the next quantum
+static int run_shell_slice(Worker* self, Task* task, int quantum, int* status) {
+    if (task->pid == 0) {
+        int64_t picked = monotonic_ns();
+        if (!start_shell_command(task, status)) return 1;
+        task->started_ns = monotonic_ns();
+        metrics_observe(STAGE_SPAWN, task->started_ns - picked);
+        trace_task_at(TRACE_SPAWN, task, task->pid, task->started_ns);
+    } else {
+        kill(-task->pid, SIGCONT);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    arm_timer(self, quantum * 1000L);
+
+    int pipes[2] = { task->out_fd, task->err_fd };
+    int wait_fds[2] = { self->timer_fd, self->wake_fd };
+    int preempt = 0, shortened = 0;
+    uint64_t count;
+
+    while (!preempt) {
+        int which = stream_output_until(task->conn, task->tag, pipes, wait_fds, 2,
+                                        resultcache_capture(task->fill), &task->output);
+        if (which == -1) break;              // both pipes at EOF
+        if (which == STREAM_OUTPUT_FULL) break;  // the client is behind, stop until it catches up
+        if (read(wait_fds[which], &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            perror("[ERROR] timer/eventfd read failed");
+        }
+        if (which == 0 || task_orphaned(task)) {
+            preempt = 1;                         // quantum used up (or the shortened slice), or nobody is listening
+        } else if (!shortened && preempt_waiting(self, task)) {
+            // a new command is waiting for this worker: it gets the CPU once this one
+            // had at least SHELL_MIN_SLICE_MS, rather than after the whole quantum
+            long ran = elapsed_ms(&start);
+            if (ran >= SHELL_MIN_SLICE_MS) {
+                preempt = 1;
+            } else {
+                arm_timer(self, SHELL_MIN_SLICE_MS - ran);
+                shortened = 1;
             }
-            curr = curr->next;
         }
+    }
+    arm_timer(self, 0);                          // disarm
+    if (task->started_ns && task->output.first_ns) {
+        metrics_observe(STAGE_FIRST_OUTPUT, task->output.first_ns - task->started_ns);
+        trace_task_at(TRACE_FIRST_BYTE, task, 0, task->output.first_ns);
+        task->started_ns = 0;
+    }
+    task->out_fd = pipes[0];
+    task->err_fd = pipes[1];
+
+    if (pipes[0] >= 0 || pipes[1] >= 0) {
+        kill(-task->pid, SIGSTOP);               // the whole pipeline, not just the first child
+        return 0;
+    }
+    *status = collect_status(task);
+    return 1;
+}
+
+static int64_t ns_since(clockid_t clock, const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000000LL + (now.tv_nsec - since->tv_nsec);
+}
+
+// bills the round a task just had: the worker time goes to the client's flow in the
+// queue the task came from (fair share is by time, not by task count), and to the
+// client's totals with the CPU its command used. a shell command's CPU is known once
+// its processes are reaped, in task->usage: when it finishes, CPU beyond the worker
+// time it was billed (a pipeline busy on several cores) is billed to the flow as well.
+// a demo runs on the worker thread, its CPU is that thread's
+static void charge_task(Task* task, const struct timespec* wall_start, const struct timespec* cpu_start,
+                        int finished) {
+    int64_t wall = ns_since(CLOCK_MONOTONIC, wall_start);
+    int64_t cpu = task->is_shell ? 0 : ns_since(CLOCK_THREAD_CPUTIME_ID, cpu_start);
+    int64_t cost = wall;
+    RunQueue* origin = task->flow->queue;
+    task->run_ns += wall;
+    if (task->is_shell && finished) {
+        cpu = (task->usage.user_us + task->usage.sys_us) * 1000LL;
+        if (cpu > task->run_ns) cost += cpu - task->run_ns;
+    }
+    pthread_mutex_lock(&origin->lock);
+    runqueue_charge(origin, task, cost);
+    pthread_mutex_unlock(&origin->lock);
+    if (task->conn) {
+        __atomic_add_fetch(&task->conn->run_ns, wall, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&task->conn->cpu_ns, cpu, __ATOMIC_RELAXED);
+    }
+}
+
+// doubles the quotes of s into out, for a CSV field
+static void csv_quote(char* out, size_t size, const char* s) {
+    size_t n = 0;
+    out[n++] = '"';
+    for (; *s && n + 3 < size; s++) {
+        if (*s == '"') out[n++] = '"';
+        out[n++] = *s;
+    }
+    out[n++] = '"';
+    out[n] = '\0';
+}
+
+#define STATS_COLUMNS "time,task_id,client_id,client_ip,kind,exit,queue_ms,run_ms,total_ms,user_ms,sys_ms," \
+                      "max_rss_kb,output_bytes,command\n"
+
+// what the task cost: a STATS frame for its client between EXIT and DONE, and with
+// -S a line in the stats log
+static void report_task_stats(Task* task, int status) {
+    TaskStats stats = {
+        .queue_us = task->wait_ns / 1000,
+        .run_us = task->run_ns / 1000,
+        .total_us = ns_since(CLOCK_MONOTONIC, &task->received_at) / 1000,
+        .user_us = task->usage.user_us,
+        .sys_us = task->usage.sys_us,
+        .max_rss_kb = task->usage.max_rss_kb,
+        .output_bytes = task->output.bytes,
+    };
+    unsigned char payload[TASK_STATS_SIZE];
+    stats_encode(payload, &stats);
+    conn_send_frame(task->conn, FRAME_STATS, 0, task->tag, payload, sizeof(payload));
+
+    if (!log_stats_enabled()) return;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    char command[512];
+    csv_quote(command, sizeof(command), task->command);
+    int code = WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+    log_stats("%ld.%03ld,%d,%d,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%lu,%lu,%s\n",
+              (long)now.tv_sec, now.tv_nsec / 1000000, task->task_id, task->client_id,
+              task->conn ? task->conn->ip : "", task->is_shell ? "shell" : "demo", code,
+              stats.queue_us / 1e3, stats.run_us / 1e3, stats.total_us / 1e3, stats.user_us / 1e3,
+              stats.sys_us / 1e3, (unsigned long)stats.max_rss_kb, (unsigned long)stats.output_bytes, command);
+}
+
+// this is the scheduling loop every worker thread runs
+void* scheduler_loop(void* arg) {
+    Worker* self = arg;
+    trace_name_thread("worker", self->id);
+
+    while (1) {
+        Task* selected = next_task(self);
+        if (selected == NULL) {
+            // advertise that we are idle, then look once more so an enqueue that missed
+            // the flag cannot leave its task sitting there until the next wakeup
+            __atomic_store_n(&self->idle, 1, __ATOMIC_SEQ_CST);
+            selected = next_task(self);
+            if (selected == NULL) wait_for_work(self);
+            __atomic_store_n(&self->idle, 0, __ATOMIC_SEQ_CST);
+            if (selected == NULL) continue;
+        }
+        __atomic_store_n(&selected->running_on, self->id, __ATOMIC_RELAXED);
+        int64_t waited = ns_since(CLOCK_MONOTONIC, &selected->queued_at);
+        selected->wait_ns += waited;
+        if (selected->round_count == 0) {
+            // how long it waited for a worker, what admission control watches
+            admission_record_wait(waited);
+            metrics_observe(STAGE_QUEUE, waited);
+        }
+        trace_task(TRACE_SELECT, selected, waited / 1000 < INT_MAX ? (int)(waited / 1000) : INT_MAX);
 
         // calculate how long this task should run
-        int quantum = (selected->round_count == 0) ? FIRST_ROUND_QUANTUM : NEXT_ROUND_QUANTUM;
-        int runtime = (selected->is_shell || selected->remaining_time < quantum)
-                      ? selected->remaining_time : quantum;
+        int runtime = policy_round_time(selected);
 
-        printf("[SCHEDULER] Running Task ID %d (Client #%d)... Remaining Time: %d, Round: %d\n",
-               selected->task_id, selected->client_id, selected->remaining_time, selected->round_count + 1);
+        log_debug("[SCHEDULER] Worker %d running Task ID %d (Client #%d)... Remaining Time: %d, Round: %d\n",
+                  self->id, selected->task_id, selected->client_id, selected->remaining_time, selected->round_count + 1);
 
-        pthread_mutex_unlock(&queue_mutex);
+        struct timespec wall_start, cpu_start;
+        clock_gettime(CLOCK_MONOTONIC, &wall_start);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
 
+        int exit_status = 0;                     // wait status, demo tasks always "exit" with 0
+        int finished = 0;
+        trace_task(TRACE_QUANTUM_START, selected, runtime);
         if (!selected->is_shell) {
-            // handle demo command: show progress for N iterations
-            int total_iterations = selected->burst_time;
-            int iterations_this_round = (runtime > total_iterations - selected->current_iteration) ? 
-                                      total_iterations - selected->current_iteration : runtime;
-            
-            // run for the calculated number of iterations
-            for (int i = 0; i < iterations_this_round && selected->current_iteration < total_iterations; i++) {
-                char output[BUFFER_SIZE];
-                snprintf(output, sizeof(output), "Demo %d/%d\n", selected->current_iteration, total_iterations - 1);
-                send(selected->socket_fd, output, strlen(output), 0);
-                sleep(1);                        // sleep 1 second between iterations
-                selected->current_iteration++;
-            }
+            // handle demo command: one progress line per timer tick. the round ends
+            // early if a shell task shows up in our queue or the client goes away
+            runtime = run_demo_round(self, selected, runtime);
         } else {
-            // handle shell command execution
-            execute_shell_command(selected);
+            // handle shell command execution, one quantum at a time
+            finished = run_shell_slice(self, selected, runtime, &exit_status);
         }
 
-        pthread_mutex_lock(&queue_mutex);
         if (!selected->is_shell) {
             selected->remaining_time -= runtime;  // update remaining time for demo tasks
+            finished = selected->remaining_time <= 0;
         }
+        trace_task(TRACE_QUANTUM_END, selected, selected->is_shell ? finished : runtime);
         selected->round_count++;
+        __atomic_store_n(&selected->running_on, -1, __ATOMIC_RELAXED);
+        charge_task(selected, &wall_start, &cpu_start, finished);
+        int task_id = selected->task_id, client_id = selected->client_id;  // for logs after parking
 
         // check if task is complete
-        if (selected->remaining_time <= 0 || selected->is_shell) {
-            printf("[DONE] Task ID %d completed.\n", selected->task_id);
-            send(selected->socket_fd, "__TASK_DONE__", strlen("__TASK_DONE__"), 0);
-            remove_task(selected);
+        if (finished) {
+            log_debug("[DONE] Task ID %d completed.\n", selected->task_id);
+            send_exit_status(selected, exit_status);
+            trace_task(TRACE_EXIT, selected, WIFSIGNALED(exit_status) ? -WTERMSIG(exit_status)
+                                                                      : WEXITSTATUS(exit_status));
+            report_task_stats(selected, exit_status);
+            metrics_count(COUNT_COMPLETED, 1);
+            metrics_observe(STAGE_TOTAL, ns_since(CLOCK_MONOTONIC, &selected->received_at));
+            resultcache_complete(selected->fill, exit_status);  // a no-op unless the result is cacheable
+            selected->fill = NULL;
+            conn_send_frame(selected->conn, FRAME_DONE, 0, selected->tag, NULL, 0);
+            trace_task(TRACE_DONE, selected, 0);
+            conn_command_finished(selected->conn);    // lets a paused client send more
+            free_task(selected);
+        } else if (task_orphaned(selected)) {
+            // the client left while this task was running, nobody wants the rest
+            log_debug("[DONE] Task ID %d dropped, client is gone.\n", selected->task_id);
+            trace_task(TRACE_DONE, selected, 1);
+            conn_command_finished(selected->conn);
+            free_task(selected);
+        } else if (park_for_output(selected)) {
+            // from here the loop may requeue it at any moment, so it is not ours to touch.
+            // it is in the client's task list, a disconnect frees it from there
+            log_warn("[BLOCKED] Task ID %d stopped, Client #%d is not reading its output\n",
+                     task_id, client_id);
         } else {
-            printf("[PREEMPT] Task ID %d paused, %d seconds remaining\n",
-                   selected->task_id, selected->remaining_time);
+            if (selected->is_shell) {
+                log_debug("[PREEMPT] Task ID %d stopped after round %d\n",
+                          selected->task_id, selected->round_count);
+            } else {
+                log_debug("[PREEMPT] Task ID %d paused, %d seconds remaining\n",
+                          selected->task_id, selected->remaining_time);
+            }
+            trace_task(TRACE_PREEMPT, selected, 0);
+            if (push_task(&self->queue, selected) < 0) {  // back into our own queue for another round
+                fail_task(selected, "Error: server out of memory\n");
+            }
         }
-
-        pthread_mutex_unlock(&queue_mutex);
     }
 
     return NULL;
 }
 
-// starts up our scheduler thread
+// starts one scheduler thread per worker, each pinned to a core when there are enough
 void init_scheduler() {
-    pthread_t tid;
-    pthread_create(&tid, NULL, scheduler_loop, NULL);
-    pthread_detach(tid);                         // thread will clean itself up when done
+    worker_count = server_config.workers;
+    workers = calloc(worker_count, sizeof(Worker));
+    if (!workers) {
+        perror("[ERROR] Out of memory");
+        exit(1);
+    }
+
+    if (server_config.stats_log && log_open_stats(server_config.stats_log, STATS_COLUMNS) < 0) {
+        perror(server_config.stats_log);
+        exit(1);
+    }
+
+    devnull_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (devnull_fd < 0) {
+        perror("[ERROR] /dev/null");
+        exit(1);
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].id = i;
+        runqueue_init(&workers[i].queue);
+        workers[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        workers[i].timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (workers[i].wake_fd < 0 || workers[i].timer_fd < 0) {
+            perror("[ERROR] eventfd/timerfd failed");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i].tid, NULL, scheduler_loop, &workers[i]) != 0) {
+            perror("[ERROR] pthread_create failed");
+            exit(1);
+        }
+        if (worker_count <= cores) {
+            // one worker per core keeps each run queue warm in that core's cache
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i, &set);
+            pthread_setaffinity_np(workers[i].tid, sizeof(set), &set);
+        }
+        pthread_detach(workers[i].tid);          // thread will clean itself up when done
+    }
+    log_info("[INFO] Scheduler started with %d worker(s).\n", worker_count);
 }
 
 // cleanup function (not really used but good practice)
@@ -216,118 +806,128 @@ void shutdown_scheduler() {
     // cleanup logic if needed
 }
 
-void execute_shell_command(Task* task) {
-    char* parsedCommand[50];
-    int argCount;
-    
-    // Parse the command
-    parseInput(task->command, parsedCommand, &argCount);
-    
-    if (parsedCommand[0] == NULL) {
-        send(task->socket_fd, "\n", 1, 0);
-        return;
+// looks every stage's program up in the PATH cache, on the PATH of the task's session
+static void resolve_programs(Task* task) {
+    const char* path_env = session_getenv(task->session, "PATH");
+    char buf[PATH_MAX];
+    for (int i = 0; i < task->plan.stage_count; i++) {
+        Stage* stage = &task->plan.stages[i];
+        if (pathcache_lookup(stage->argv[0], path_env, buf, sizeof(buf))) {
+            stage->program = arena_strdup(&task->arena, buf);
+        }
     }
+}
 
-    // Check for pipes and redirections first
-    int pipeFound = 0, redirectFound = 0;
-    int inputRedirectFound = 0, outputRedirectFound = 0, errorRedirectFound = 0;
+static void count_spawn_failures(const SpawnFailures* failures) {
+    if (failures->fork) metrics_count(COUNT_FORK_FAILURES, failures->fork);
+    if (failures->exec) metrics_count(COUNT_EXEC_FAILURES, failures->exec);
+}
 
-    for (int j = 0; j < argCount; j++) {
-        if (strcmp(parsedCommand[j], "|") == 0) pipeFound = 1;
-        if (strcmp(parsedCommand[j], "<") == 0) {
-            redirectFound = 1;
-            inputRedirectFound = 1;
-        }
-        if (strcmp(parsedCommand[j], ">") == 0) {
-            redirectFound = 1;
-            outputRedirectFound = 1;
-        }
-        if (strcmp(parsedCommand[j], "2>") == 0 || strcmp(parsedCommand[j], "2>&1") == 0) {
-            redirectFound = 1;
-            errorRedirectFound = 1;
-        }
-    }
+// passes on the errors of a pipeline that didn't start. they reach clients sharing the
+// command too, but a failure of the moment is not kept in the result cache
+static void stream_start_errors(Task* task, int out_fd, int err_fd) {
+    int pipes[2] = { out_fd, err_fd };
+    resultcache_no_store(task->fill);
+    stream_output_until(task->conn, task->tag, pipes, NULL, 0, resultcache_capture(task->fill),
+                        &task->output);
+}
 
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("pipe failed");
-        return;
+// starts a shell command's pipeline in its own process group, so the scheduler can stop
+// and resume everything it spawns. on success the process group, the stage pids and the
+// read ends of the stdout/stderr pipes are stored in the task and 1 is returned.
+// otherwise returns 0 with *status set to the result (0 for an empty command, 1 << 8 on errors)
+static int start_shell_command(Task* task, int* status) {
+    const int failed = 1 << 8;                    // looks like "exited with 1" to the caller
+
+    // the plan was compiled when the task was queued
+    *status = 0;
+    if (task->plan.error) {
+        conn_send_frame(task->conn, FRAME_STDERR, 0, task->tag, task->plan.error, strlen(task->plan.error));
+        task->output.bytes += strlen(task->plan.error);
+        capture_append(resultcache_capture(task->fill), FRAME_STDERR, task->plan.error, strlen(task->plan.error));
+        *status = failed;
+        return 0;
+    }
+    if (task->plan.stage_count == 0) {
+        return 0;
     }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        if (!redirectFound) {
-            // Only redirect to pipe if there's no file redirection
-            close(pipefd[0]);
-            dup2(pipefd[1], STDOUT_FILENO);
-            dup2(pipefd[1], STDERR_FILENO);
-            close(pipefd[1]);
+    // echo, pwd and friends answer from here, without a process
+    const Stage* first = &task->plan.stages[0];
+    if (task->plan.stage_count == 1) {
+        int builtin_status = builtin_run(first, task->session, task->conn, task->tag,
+                                         resultcache_capture(task->fill), &task->output.bytes);
+        if (builtin_status >= 0) {
+            *status = builtin_status;
+            return 0;
         }
+    }
 
-        // Execute command based on type
-        if (pipeFound && redirectFound) {
-            handlePipeRedirect(parsedCommand);
-        } else if (pipeFound) {
-            int pipeCount = 0;
-            for (int j = 0; j < argCount; j++) {
-                if (strcmp(parsedCommand[j], "|") == 0) pipeCount++;
-            }
-            if (pipeCount > 1) {
-                handleMultiplePipes(parsedCommand);
-            } else {
-                handlePipes(parsedCommand);
-            }
-        } else if (redirectFound) {
-            if ((inputRedirectFound && outputRedirectFound) ||
-                (inputRedirectFound && errorRedirectFound) ||
-                (outputRedirectFound && errorRedirectFound)) {
-                handleCombinedRedirect(parsedCommand);
-            } else if (inputRedirectFound) {
-                inputRedirect(parsedCommand);
-            } else {
-                handleRedirect(parsedCommand);
-            }
-        } else {
-            // For simple commands without redirection, use execvp directly
-            execvp(parsedCommand[0], parsedCommand);
-            // If execvp fails, print error and exit
-            char error_msg[BUFFER_SIZE];
-            if (argCount > 1) {
-                snprintf(error_msg, sizeof(error_msg), "%s: %s: No such file or directory\n", 
-                        parsedCommand[0], parsedCommand[1]);
-            } else {
-                snprintf(error_msg, sizeof(error_msg), "%s: missing operand\n", parsedCommand[0]);
-            }
-            write(STDERR_FILENO, error_msg, strlen(error_msg));
-            exit(1);
+    const char* cwd = task->session ? task->session->cwd : NULL;
+    char** envp = task->session ? task->session->env : NULL;
+    resolve_programs(task);
+
+    // with a spawner pool the helper starts the pipeline and passes its pipes back
+    SpawnedJob job;
+    if (spawner_enabled() && spawner_launch(&task->plan, cwd, envp, &job) == 0) {
+        count_spawn_failures(&job.failures);
+        if (job.group == 0) {
+            // nothing started; pass on the errors and take the status the helper sent
+            stream_start_errors(task, job.out_fd, job.err_fd);
+            task->status_fd = job.status_fd;
+            *status = collect_status(task);
+            return 0;
         }
-        exit(0);
-    } else if (pid > 0) {
-        // Parent process
-        close(pipefd[1]);
-
-        if (!redirectFound) {
-            // Only read from pipe if there's no file redirection
-            char buffer[BUFFER_SIZE];
-            ssize_t bytes;
-            
-            while ((bytes = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-                buffer[bytes] = '\0';
-                send(task->socket_fd, buffer, bytes, 0);
-            }
-            close(pipefd[0]);
-        }
-        
-        // Wait for child process
-        int status;
-        waitpid(pid, &status, 0);
+        task->pid = job.group;
+        task->out_fd = job.out_fd;
+        task->err_fd = job.err_fd;
+        task->status_fd = job.status_fd;
+        return 1;
+    }
 
-        // For redirected commands, send a success message
-        if (redirectFound && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            send(task->socket_fd, "", 0, 0);
-        }
+    // one pipe per stream so the client can tell stdout and stderr apart
+    int outfd[2], errfd[2];
+    if (pipe2(outfd, O_CLOEXEC) == -1) {
+        perror("pipe failed");
+        resultcache_no_store(task->fill);
+        *status = failed;
+        return 0;
+    }
+    if (pipe2(errfd, O_CLOEXEC) == -1) {
+        perror("pipe failed");
+        close(outfd[0]);
+        close(outfd[1]);
+        resultcache_no_store(task->fill);
+        *status = failed;
+        return 0;
     }
-}
 
+    enlarge_pipe(outfd[1]);
 
+    // every stage is spawned straight from here, no copy of the server is forked. the
+    // commands get no terminal input: outside the foreground group a read would stop them
+    task->pids = arena_alloc(&task->arena, sizeof(pid_t) * task->plan.stage_count);
+    pid_t group = 0;
+    SpawnFailures failures = { 0 };
+    if (task->pids) {
+        group = spawnPlan(&task->plan, cwd, envp, devnull_fd, outfd[1], errfd[1], task->pids, &failures);
+        count_spawn_failures(&failures);
+    } else {
+        const char* msg = "Error: server out of memory\n";
+        write_full(errfd[1], msg, strlen(msg));
+    }
+    close(outfd[1]);
+    close(errfd[1]);
+
+    if (group == 0) {
+        // nothing started; pass on the errors spawnPlan left in the pipe
+        stream_start_errors(task, outfd[0], errfd[0]);
+        *status = failed;
+        return 0;
+    }
+
+    task->pid = group;
+    task->out_fd = outfd[0];
+    task->err_fd = errfd[0];
+    return 1;
+}
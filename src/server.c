@@ -1,120 +1,439 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <sys/wait.h>
 #include "executor.h"
 #include "parser.h"
 #include "scheduler.h"
+#include "connection.h"
+#include "config.h"
+#include "spawner.h"
+#include "builtins.h"
+#include "resultcache.h"
+#include "admission.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
+#include "threadblock.h"
 
 // for phase 3
 #include <pthread.h>
 
-#define PORT 8081
-#define BUFFER_SIZE 32767
-
-// since we will keep track of the thread numbers assigned to each client
+#define BUFFER_SIZE 32767       // longest command line we accept
+#define READ_CHUNK 65536        // per-loop scratch buffer for recv
+#define MAX_EVENTS 256          // events handled per epoll_wait call
+#define MAX_PARSED_ARGS 64      // longer lines are never a demo or a builtin, they go straight to the scheduler
+
+// each event loop owns its own epoll instance and listening socket (SO_REUSEPORT
+// lets the kernel spread new connections across the loops)
+typedef struct EventLoop {
+    int id;
+    int epfd;
+    int listen_fd;
+    pthread_t tid;
+    LoopNotifier notifier;               // wakes the loop when a paused client can continue
+    int64_t received_ns;                 // when the lines being handled were read, for the metrics
+    char scratch[READ_CHUNK];            // recv lands here before it is split into lines
+    char commandCopy[BUFFER_SIZE + 1];   // parseInput modifies its input, so it works on a copy
+} EventLoop;
+
+// since we will keep track of the client numbers assigned to each connection
 int client_counter = 0;
-pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void *handle_client(void *arg) {
-    int client_socket = *((int *)arg);
-    free(arg);
+static void close_client(EventLoop* loop, Connection* conn) {
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn_close(conn);                    // first, so running tasks woken below see it closed
+    metrics_count(COUNT_CONNECTIONS_CLOSED, 1);
+    remove_tasks_by_client(conn);
+    conn_unref(conn);                    // drop the loop's reference
+}
 
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    getpeername(client_socket, (struct sockaddr *)&client_addr, &addr_len);
+static void client_gone(EventLoop* loop, Connection* conn) {
+    if (!conn_is_closed(conn)) {
+        log_info("[INFO] Client #%d - %s:%d disconnected.\n", conn->client_id, conn->ip, conn->port);
+    }
+    close_client(loop, conn);
+}
 
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    int client_port = ntohs(client_addr.sin_port);
+// a client that sent its FIN may also be gone for good. its socket says so once a
+// reply drew a reset
+static int peer_gone(Connection* conn) {
+    struct pollfd pfd = { .fd = conn->fd, .events = 0 };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR));
+}
 
-    int client_number;
-    pthread_mutex_lock(&counter_mutex);
-    client_counter++;
-    client_number = client_counter;
-    pthread_mutex_unlock(&counter_mutex);
+// turns a command away with a BUSY frame when admission control says the server is
+// overloaded. returns 1 if it did
+static int refuse_if_busy(Connection* conn, uint32_t tag, const char* clientCommand) {
+    uint32_t retry_after_ms;
+    char reason[160];
+    if (admission_check(conn, &retry_after_ms, reason, sizeof(reason)) == 0) return 0;
+
+    unsigned char payload[4 + sizeof(reason)];
+    uint32_t be = htonl(retry_after_ms);
+    size_t len = strlen(reason);
+    memcpy(payload, &be, sizeof(be));
+    memcpy(payload + sizeof(be), reason, len);
+    conn_send_frame(conn, FRAME_BUSY, 0, tag, payload, sizeof(be) + len);
+    conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+    metrics_count(COUNT_BUSY, 1);
+    log_warn("[BUSY] [Client #%d - %s:%d] Refused \"%s\", retry after %u ms\n",
+             conn->client_id, conn->ip, conn->port, clientCommand, retry_after_ms);
+    return 1;
+}
 
-    printf("[INFO] Client #%d connected from %s:%d. Assigned to Thread-%d.\n",
-           client_number, client_ip, client_port, client_number);
+// answers "server-status" with the load a balancer in front of us cares about: how many
+// commands wait for a worker, how long they waited over the last second, and whether
+// new ones are being refused
+static void send_status(Connection* conn, uint32_t tag) {
+    QueueWaitStats stats;
+    admission_stats(&stats);
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+                       "queued=%d wait_samples=%ld wait_p50_ms=%.2f wait_p90_ms=%.2f wait_p99_ms=%.2f "
+                       "wait_max_ms=%.2f overloaded=%d busy_replies=%ld\n",
+                       stats.queued, stats.samples, stats.p50_ms, stats.p90_ms, stats.p99_ms,
+                       stats.max_ms, stats.overloaded, stats.busy_replies);
+    uint32_t code = htonl(0);
+    conn_send_frame(conn, FRAME_STDOUT, 0, tag, line, len);
+    conn_send_frame(conn, FRAME_EXIT, 0, tag, &code, sizeof(code));
+    conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+}
 
-    char clientCommand[BUFFER_SIZE];
-    char commandCopy[BUFFER_SIZE];  // Add a copy for parsing
-    char *parsedCommand[50];
-    int argCount;
+// handles one complete command line. returns -1 if the client asked to disconnect
+static int handle_command(EventLoop* loop, Connection* conn, const char* clientCommand) {
+    uint32_t tag = conn->next_tag++;     // every line gets a tag, even ones we reject
+    char* parsedCommand[MAX_PARSED_ARGS + 1];
+    int argCount = countTokens(clientCommand);
+
+    log_debug("[RECEIVED] [Client #%d - %s:%d] Received command: \"%s\"\n",
+              conn->client_id, conn->ip, conn->port, clientCommand);
+    metrics_count(COUNT_COMMANDS, 1);
+
+    if (strcmp(clientCommand, "exit") == 0) {
+        Task* parked;
+        // best effort, what the socket takes right now. parked tasks go back to a queue
+        // for the disconnect to remove them
+        if (conn_flush_output(conn, &parked) == 0) resume_parked_tasks(parked);
+        log_info("[INFO] [Client #%d - %s:%d] Client requested disconnect.\n",
+                 conn->client_id, conn->ip, conn->port);
+        return -1;
+    }
 
-    while (1) {
-        memset(clientCommand, 0, sizeof(clientCommand));
-        memset(commandCopy, 0, sizeof(commandCopy));
-        int bytesReceived = recv(client_socket, clientCommand, sizeof(clientCommand), 0);
+    // answered right here, so it works even while commands are being refused
+    if (strcmp(clientCommand, "server-status") == 0) {
+        send_status(conn, tag);
+        return 0;
+    }
+    if (strcmp(clientCommand, "server-trace") == 0) {
+        trace_dump(conn, tag);
+        return 0;
+    }
 
-        if (bytesReceived <= 0) {
-            printf("[INFO] Client #%d - %s:%d disconnected.\n", client_number, client_ip, client_port);
-            remove_tasks_by_client(client_number);
-            break;
+    if (argCount == 0) {
+        // nothing to run, but the client is still waiting for the end of this command
+        conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+        return 0;
+    }
+
+    int parsed = argCount <= MAX_PARSED_ARGS;
+    if (parsed) {
+        // Make a copy before parsing since parseInput modifies the string
+        strcpy(loop->commandCopy, clientCommand);
+        parseInput(loop->commandCopy, parsedCommand, &argCount);
+    }
+
+    // cd and export change this client's session right away, so the lines after them see it
+    if (parsed && builtin_session(conn, tag, parsedCommand, argCount)) {
+        return 0;
+    }
+
+    // Check if it's a demo task like "./demo 5"
+    if (parsed && argCount == 2 && (strcmp(parsedCommand[0], "./demo") == 0 || strcmp(parsedCommand[0], "demo") == 0)) {
+        int burst_time = atoi(parsedCommand[1]);
+        if (burst_time > 0) {
+            if (refuse_if_busy(conn, tag, clientCommand)) return 0;
+            conn_command_started(conn);
+            add_task_with_conn(clientCommand, conn->client_id, burst_time, 0, conn, tag, NULL);  // 0 = non-shell
+            metrics_observe(STAGE_RECEIVE, monotonic_ns() - loop->received_ns);
+        } else {
+            char *err = "Usage: ./demo <burst_time>\n";
+            conn_send_frame(conn, FRAME_ERROR, 0, tag, err, strlen(err));
+            conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
         }
+        return 0;
+    }
 
-        printf("[RECEIVED] [Client #%d - %s:%d] Received command: \"%s\"\n",
-               client_number, client_ip, client_port, clientCommand);
+    // a read-only command that ran a moment ago is answered from the result cache
+    // (or shares the output of the same command running for someone else)
+    CacheFill* fill = NULL;
+    int cached = parsed ? resultcache_serve(conn, tag, parsedCommand, argCount, &fill) : 0;
+    if (cached) {
+        metrics_count(COUNT_CACHE_HITS, 1);
+        log_debug("[CACHE] [Client #%d - %s:%d] %s \"%s\"\n", conn->client_id, conn->ip, conn->port,
+                  cached == 1 ? "Served from the result cache:" : "Joined the running command", clientCommand);
+        return 0;
+    }
+
+    // Otherwise it's a shell command - use the original command string
+    if (refuse_if_busy(conn, tag, clientCommand)) {
+        resultcache_abandon(fill);       // nobody joined it yet, it just never runs
+        return 0;
+    }
+    conn_command_started(conn);
+    add_task_with_conn(clientCommand, conn->client_id, -1, 1, conn, tag, fill);  // 1 = shell command
+    metrics_observe(STAGE_RECEIVE, monotonic_ns() - loop->received_ns);
+
+    log_debug("[EXECUTING] [Client #%d - %s:%d] Scheduled command: \"%s\"\n",
+              conn->client_id, conn->ip, conn->port, clientCommand);
+    return 0;
+}
 
-        if (strcmp(clientCommand, "exit") == 0) {
-            printf("[INFO] [Client #%d - %s:%d] Client requested disconnect.\n",
-                   client_number, client_ip, client_port);
-            remove_tasks_by_client(client_number);
+// splits data into newline-terminated commands. complete lines are handled straight
+// from the caller's buffer; whatever is left (a partial line, or every remaining line
+// while the client has too many commands in flight) is kept in the connection
+static int process_input(EventLoop* loop, Connection* conn, char* data, size_t len) {
+    char* line = data;
+    char* end = data + len;
+    char* nl;
+    int held_back = 0;
+
+    while ((nl = memchr(line, '\n', end - line)) != NULL) {
+        // stop taking commands until one finishes, the notifier brings us back here
+        if (conn_should_pause(conn, server_config.max_inflight)) {
+            held_back = 1;
+            break;
+        }
+        // or until the client reads what it has been sent, EPOLLOUT brings us back
+        if (conn_output_full(conn)) {
+            conn->output_held = 1;
+            held_back = 1;
             break;
         }
 
-        // Make a copy before parsing since parseInput modifies the string
-        strncpy(commandCopy, clientCommand, sizeof(commandCopy) - 1);
-        parseInput(commandCopy, parsedCommand, &argCount);
-        
-        if (parsedCommand[0] == NULL) continue;
-
-        // Check if it's a demo task like "./demo 5"
-        if ((strcmp(parsedCommand[0], "./demo") == 0 || strcmp(parsedCommand[0], "demo") == 0) && argCount == 2) {
-            int burst_time = atoi(parsedCommand[1]);
-            if (burst_time > 0) {
-                add_task_with_socket(clientCommand, client_number, burst_time, 0, client_socket);  // 0 = non-shell
-                continue;
+        size_t line_len = nl - line;
+        if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+        if (line_len > BUFFER_SIZE) return -1;
+        line[line_len] = '\0';
+        if (handle_command(loop, conn, line) < 0) return -1;
+        line = nl + 1;
+    }
+
+    size_t rest = end - line;
+    if (rest > BUFFER_SIZE && !held_back) {
+        log_error("[ERROR] [Client #%d - %s:%d] Command longer than %d bytes.\n",
+                  conn->client_id, conn->ip, conn->port, BUFFER_SIZE);
+        return -1;
+    }
+    if (rest > 0 && data != conn->inbuf) {
+        if (conn_buffer_append(conn, line, rest) < 0) return -1;
+    } else if (data == conn->inbuf) {
+        conn_buffer_consume(conn, len - rest);
+    }
+    return 0;
+}
+
+// drains the socket until it would block, as required with edge-triggered epoll.
+// a paused client, or one that doesn't read its output, is left unread so TCP pushes
+// back on it
+static void handle_readable(EventLoop* loop, Connection* conn) {
+    while (!__atomic_load_n(&conn->paused, __ATOMIC_SEQ_CST)) {
+        if (conn_output_full(conn)) {
+            conn->output_held = 1;
+            return;
+        }
+
+        ssize_t bytesReceived = recv(conn->fd, loop->scratch, sizeof(loop->scratch), 0);
+
+        if (bytesReceived < 0 && errno == EINTR) continue;
+        if (bytesReceived < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+        if (bytesReceived <= 0) {
+            log_info("[INFO] Client #%d - %s:%d disconnected.\n", conn->client_id, conn->ip, conn->port);
+            close_client(loop, conn);
+            return;
+        }
+
+        int result;
+        loop->received_ns = monotonic_ns();
+        if (conn->inlen == 0) {
+            result = process_input(loop, conn, loop->scratch, bytesReceived);
+        } else {
+            // finish the partial line we kept from the last read
+            if (conn_buffer_append(conn, loop->scratch, bytesReceived) < 0) {
+                result = -1;
             } else {
-                char *err = "Usage: ./demo <burst_time>\n";
-                send(client_socket, err, strlen(err), 0);
-                continue;
+                result = process_input(loop, conn, conn->inbuf, conn->inlen);
             }
         }
 
-        // Otherwise it's a shell command - use the original command string
-        add_task_with_socket(clientCommand, client_number, -1, 1, client_socket);  // 1 = shell command
+        if (result < 0) {
+            close_client(loop, conn);
+            return;
+        }
+    }
+}
+
+// a paused client had a command finish: run the lines we held back, then read again
+static void resume_client(EventLoop* loop, Connection* conn) {
+    if (conn_is_closed(conn)) return;
+    if (conn->hung_up && peer_gone(conn)) {
+        client_gone(loop, conn);             // the lines held back have nobody to answer
+        return;
+    }
+
+    // a worker that flushed this client's output wakes us for the tasks parked on it
+    Task* parked;
+    if (conn_flush_output(conn, &parked) == 0) resume_parked_tasks(parked);
+    if (conn_output_full(conn)) {
+        conn->output_held = 1;               // still behind, EPOLLOUT brings us back
+        return;
+    }
+    conn->output_held = 0;
+
+    // lines held back since an earlier read are timed from now, not from that read
+    loop->received_ns = monotonic_ns();
+    if (conn->inlen > 0 && process_input(loop, conn, conn->inbuf, conn->inlen) < 0) {
+        close_client(loop, conn);
+        return;
+    }
+    handle_readable(loop, conn);
+}
+
+// the socket has room again: send what the workers couldn't, then let the tasks that
+// were stopped for this client go on and read its commands again. returns -1 when the
+// caller must not touch conn any more (closed, or already read by resume_client)
+static int handle_writable(EventLoop* loop, Connection* conn) {
+    Task* parked;
+    if (conn_flush_output(conn, &parked) < 0) {
+        client_gone(loop, conn);
+        return -1;
+    }
+    resume_parked_tasks(parked);
+    if (conn->output_held && !conn_output_full(conn)) {
+        conn->output_held = 0;
+        resume_client(loop, conn);
+        return -1;
+    }
+    return 0;
+}
+
+static void handle_notifications(EventLoop* loop) {
+    notifier_drain(&loop->notifier);
 
-        printf("[EXECUTING] [Client #%d - %s:%d] Scheduled command: \"%s\"\n",
-               client_number, client_ip, client_port, clientCommand);
+    Connection* conn;
+    while ((conn = notifier_pop(&loop->notifier)) != NULL) {
+        resume_client(loop, conn);
+        conn_unref(conn);                // reference taken by conn_notify_loop
     }
+}
+
+static void handle_accept(EventLoop* loop) {
+    while (1) {
+        struct sockaddr_in client_address;
+        socklen_t addrlen = sizeof(client_address);
+        int client_socket = accept4(loop->listen_fd, (struct sockaddr *)&client_address,
+                                    &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("[ERROR] Socket accept failed");
+            }
+            return;
+        }
+
+        // replies are several small frames (output, EXIT, DONE); Nagle would hold the
+        // later ones back until the client's delayed ACK
+        int one = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-    close(client_socket);
-    pthread_exit(NULL);
+        int client_number = __atomic_add_fetch(&client_counter, 1, __ATOMIC_RELAXED);
+        Connection* conn = conn_create(client_socket, client_number, loop->id, &loop->notifier,
+                                       &client_address);
+        if (!conn) {
+            close(client_socket);
+            continue;
+        }
+        conn->weight = client_weight(conn->ip);
+
+        // edge triggered, EPOLLOUT comes back only after a send hit EAGAIN: the loop then drains the output ring
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn };
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+            perror("[ERROR] epoll_ctl failed");
+            conn_close(conn);
+            conn_unref(conn);
+            continue;
+        }
+
+        metrics_count(COUNT_CONNECTIONS_OPENED, 1);
+        log_info("[INFO] Client #%d connected from %s:%d. Assigned to Loop-%d.\n",
+                 client_number, conn->ip, conn->port, loop->id);
+    }
 }
 
+static void* event_loop_run(void* arg) {
+    EventLoop* loop = arg;
+    struct epoll_event events[MAX_EVENTS];
+    trace_name_thread("loop", loop->id);
 
-int main()
-{
+    while (1) {
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[ERROR] epoll_wait failed");
+            exit(1);
+        }
+
+        for (int i = 0; i < n; i++) {
+            Connection* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                handle_accept(loop);     // the listening socket is registered with a NULL pointer
+            } else if ((void*)conn == (void*)&loop->notifier) {
+                handle_notifications(loop);
+            } else {
+                // gone for good (a reset, or conn_close after a failed send): a paused client's
+                // socket isn't read, so this is the only word of it we get
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    client_gone(loop, conn);
+                    continue;
+                }
+                if ((events[i].events & EPOLLOUT) && handle_writable(loop, conn) < 0) continue;
+                if (events[i].events & EPOLLRDHUP) conn->hung_up = 1;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                    handle_readable(loop, conn);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static int create_listen_socket(void) {
     int server_socket;
-    struct sockaddr_in server_address, client_address;
+    struct sockaddr_in server_address;
     int opt = 1;
 
     // Create the server socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_socket == -1)
     {
         perror("[ERROR] Socket creation failed");
         exit(1);
     }
 
-    // allow the socket to be reused
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+    // allow the socket to be reused, and shared by every event loop
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
     {
         perror("[ERROR] setsockopt failed");
         exit(1);
@@ -123,7 +442,7 @@ int main()
     // set the server address
     memset(&server_address, 0, sizeof(server_address));
     server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(PORT);
+    server_address.sin_port = htons(server_config.port);
     server_address.sin_addr.s_addr = INADDR_ANY;
 
     // bind it to the address
@@ -134,41 +453,83 @@ int main()
     }
 
     // now listen for incoming connections
-    if (listen(server_socket, 5) < 0)
+    if (listen(server_socket, SOMAXCONN) < 0)
     {
         perror("[ERROR] Socket listen failed");
         exit(EXIT_FAILURE);
     }
+    return server_socket;
+}
 
-    printf("[INFO] Server started, waiting for client connections...\n");
+int main(int argc, char* argv[])
+{
+    parse_config(argc, argv);
 
-    init_scheduler();
+    // a client that vanishes mid-send must not take the whole server down
+    signal(SIGPIPE, SIG_IGN);
+
+    // the spawner helpers are forked first, while the server is still small and has
+    // no other threads or sockets
+    spawner_init(server_config.spawners);
+    log_init(server_config.log_level);
+    if (server_config.trace_file) trace_init(server_config.trace_file);
+    resultcache_init(server_config.cache_allowlist, server_config.cache_ttl_ms);
 
-    while (1)
+    EventLoop* loops = calloc(server_config.loops, sizeof(EventLoop));
+    if (!loops)
     {
-        socklen_t addrlen = sizeof(client_address);
-        int *client_socket = malloc(sizeof(int)); // dynamically allocated for each thread
-        *client_socket = accept(server_socket, (struct sockaddr *)&client_address, &addrlen);
+        perror("[ERROR] Out of memory");
+        exit(1);
+    }
 
-        if (*client_socket < 0)
+    for (int i = 0; i < server_config.loops; i++)
+    {
+        loops[i].id = i;
+        loops[i].listen_fd = create_listen_socket();
+        loops[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loops[i].epfd < 0)
         {
-            perror("[ERROR] Socket accept failed");
-            free(client_socket);
-            continue;
+            perror("[ERROR] epoll_create1 failed");
+            exit(1);
+        }
+
+        // level-triggered so a backlog left over after EMFILE is retried on the next wakeup
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        if (epoll_ctl(loops[i].epfd, EPOLL_CTL_ADD, loops[i].listen_fd, &ev) < 0)
+        {
+            perror("[ERROR] epoll_ctl failed");
+            exit(1);
         }
 
-        printf("[INFO] New client connected.\n");
+        if (notifier_init(&loops[i].notifier) < 0)
+        {
+            perror("[ERROR] eventfd failed");
+            exit(1);
+        }
+        struct epoll_event nev = { .events = EPOLLIN, .data.ptr = &loops[i].notifier };
+        if (epoll_ctl(loops[i].epfd, EPOLL_CTL_ADD, loops[i].notifier.efd, &nev) < 0)
+        {
+            perror("[ERROR] epoll_ctl failed");
+            exit(1);
+        }
+    }
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, handle_client, client_socket) != 0)
+    log_info("[INFO] Server started on port %d with %d event loop(s), waiting for client connections...\n",
+             server_config.port, server_config.loops);
+
+    init_scheduler();
+    if (server_config.metrics_port > 0) metrics_start(server_config.metrics_port);
+
+    for (int i = 1; i < server_config.loops; i++)
+    {
+        if (pthread_create(&loops[i].tid, NULL, event_loop_run, &loops[i]) != 0)
         {
             perror("[ERROR] pthread_create failed");
-            free(client_socket);
+            exit(1);
         }
-
-        pthread_detach(tid); // to ensure resources are released when thread terminates
+        pthread_detach(loops[i].tid); // to ensure resources are released when thread terminates
     }
 
-    close(server_socket);
+    event_loop_run(&loops[0]);           // the main thread runs the first loop
     return 0;
-}
\ No newline at end of file
+}
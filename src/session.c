@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include "session.h"
+
+extern char **environ;
+
+Session* session_ref(Session* session) {
+    if (session) __atomic_add_fetch(&session->refcount, 1, __ATOMIC_RELAXED);
+    return session;
+}
+
+void session_unref(Session* session) {
+    if (!session) return;
+    if (__atomic_sub_fetch(&session->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    for (int i = 0; i < session->env_count; i++) free(session->env[i]);
+    free(session->env);
+    free(session->cwd);
+    free(session);
+}
+
+// the variables a session starts from: its own, or the server's for NULL
+static char** base_env(const Session* session) {
+    return session ? session->env : environ;
+}
+
+// index of name's entry in env, or -1
+static int find_env(char** env, const char* name, size_t name_len) {
+    for (int i = 0; env[i]; i++) {
+        if (strncmp(env[i], name, name_len) == 0 && env[i][name_len] == '=') return i;
+    }
+    return -1;
+}
+
+const char* session_getenv(const Session* session, const char* name) {
+    char** env = base_env(session);
+    int i = find_env(env, name, strlen(name));
+    return i < 0 ? NULL : env[i] + strlen(name) + 1;
+}
+
+const char* session_cwd(const Session* session, char* buf, size_t size) {
+    if (session) return session->cwd;
+    return getcwd(buf, size);
+}
+
+static uint64_t hash_env(char** env) {
+    uint64_t h = 14695981039346656037ull;       // FNV-1a, with a separator after each string
+    for (int i = 0; env[i]; i++) {
+        for (const char* p = env[i]; *p; p++) {
+            h ^= (unsigned char)*p;
+            h *= 1099511628211ull;
+        }
+        h ^= 0xff;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// the server's environment never changes after startup, so its hash is taken once
+static pthread_once_t environ_once = PTHREAD_ONCE_INIT;
+static uint64_t environ_hash;
+
+static void hash_environ(void) {
+    environ_hash = hash_env(environ);
+}
+
+uint64_t session_env_hash(const Session* session) {
+    if (session) return session->env_hash;
+    pthread_once(&environ_once, hash_environ);
+    return environ_hash;
+}
+
+// a copy of base with assignment ("NAME=value") set, replacing an existing NAME
+static Session* copy_session(const Session* base, const char* cwd, const char* assignment) {
+    char** env = base_env(base);
+    int count = 0;
+    while (env[count]) count++;
+
+    size_t name_len = strcspn(assignment, "=");
+    int replace = find_env(env, assignment, name_len);
+
+    Session* session = calloc(1, sizeof(Session));
+    if (!session) return NULL;
+    session->refcount = 1;
+    session->env = calloc(count + 2, sizeof(char*));
+    session->cwd = strdup(cwd);
+    if (!session->env || !session->cwd) goto fail;
+
+    for (int i = 0; i < count; i++) {
+        session->env[session->env_count] = strdup(i == replace ? assignment : env[i]);
+        if (!session->env[session->env_count++]) goto fail;
+    }
+    if (replace < 0) {
+        session->env[session->env_count] = strdup(assignment);
+        if (!session->env[session->env_count++]) goto fail;
+    }
+    session->env_hash = hash_env(session->env);
+    return session;
+
+fail:
+    session_unref(session);
+    return NULL;
+}
+
+Session* session_with_cwd(const Session* base, const char* cwd) {
+    size_t len = strlen(cwd) + sizeof("PWD=");
+    char* pwd = malloc(len);
+    if (!pwd) return NULL;
+    snprintf(pwd, len, "PWD=%s", cwd);
+    Session* session = copy_session(base, cwd, pwd);
+    free(pwd);
+    return session;
+}
+
+Session* session_with_env(const Session* base, const char* assignment) {
+    char buf[PATH_MAX];
+    const char* cwd = session_cwd(base, buf, sizeof(buf));
+    if (!cwd) return NULL;
+    return copy_session(base, cwd, assignment);
+}
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include "spawner.h"
+#include "executor.h"
+#include "plan.h"
+#include "output.h"
+#include "protocol.h"
+
+#define REQUEST_MAX (128 * 1024)    // stages, cwd and environment; bigger requests spawn in the worker
+#define REQUEST_MAX_PARTS 1024      // iovecs per request (IOV_MAX)
+#define REQUEST_MAX_STAGES 64       // longer pipelines spawn in the worker
+
+typedef struct Helper {
+    int sock;                   // our end of the helper's SOCK_SEQPACKET pair
+    pthread_mutex_t lock;       // one request/reply exchange at a time
+} Helper;
+
+// a command the helper started and has not fully reaped yet
+typedef struct Job {
+    struct Job* next;
+    int status_fd;              // write end of the task's status pipe
+    PipelineResult result;
+    int live;                   // stages still running
+    int count;
+    pid_t pids[];               // one per stage, -1 for stages that didn't start
+} Job;
+
+// the sizes that lead a spawn request, so the helper can rebuild the plan without
+// parsing the command again
+typedef struct RequestShape {
+    int argc;
+    int redirect_count;
+} RequestShape;
+
+// the bytes of a reply to a spawn request, the fds travel next to them
+typedef struct SpawnReply {
+    pid_t group;                // -1 when the helper couldn't even make the pipes
+    SpawnFailures failures;
+} SpawnReply;
+
+static Helper* helpers = NULL;
+static int helper_count = 0;
+static unsigned int next_helper = 0;
+
+void pipeline_add_usage(PipelineResult* result, const struct rusage* usage) {
+    result->user_us += usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec;
+    result->sys_us += usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec;
+    if (usage->ru_maxrss > result->max_rss_kb) result->max_rss_kb = usage->ru_maxrss;
+}
+
+// ---------------------------------------------------------------- helper side
+
+// sends the reply to one spawn request: the process group, the failures and three fds
+static int send_reply(int sock, SpawnReply* reply, int out_fd, int err_fd, int status_fd) {
+    int fds[3] = { out_fd, err_fd, status_fd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = reply, .iov_len = sizeof(*reply) };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control, .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+static void finish_job(Job* job) {
+    write_full(job->status_fd, &job->result, sizeof(job->result));   // EPIPE if the task is gone
+    close(job->status_fd);
+    free(job);
+}
+
+// takes the next string of a request, NULL if it runs past the end
+static char* next_string(char** p, char* end) {
+    char* string = *p;
+    char* nul = string < end ? memchr(string, '\0', end - string) : NULL;
+    if (!nul) return NULL;
+    *p = nul + 1;
+    return string;
+}
+
+// rebuilds the plan from a request: the stage count, a RequestShape per stage, then
+// "cwd\0", and per stage "program\0", its argv and its redirects (the kind, then
+// "path\0"), then "NAME=value\0"... to the end. every string stays in the request. an
+// empty program, cwd or path means none; no variables mean the helper's own (which
+// are the server's)
+static int parse_request(char* request, size_t len, Plan* plan, const char** cwd,
+                         char*** envp, Arena* arena) {
+    char* end = request + len;
+    int stage_count;
+    if (len < sizeof(stage_count)) return -1;
+    memcpy(&stage_count, request, sizeof(stage_count));
+    char* p = request + sizeof(stage_count);
+    if (stage_count <= 0 || stage_count > REQUEST_MAX_STAGES ||
+        (size_t)(end - p) < sizeof(RequestShape) * stage_count) {
+        return -1;
+    }
+    RequestShape shapes[REQUEST_MAX_STAGES];
+    memcpy(shapes, p, sizeof(RequestShape) * stage_count);
+    p += sizeof(RequestShape) * stage_count;
+
+    char* dir = next_string(&p, end);
+    if (!dir) return -1;
+    *cwd = *dir ? dir : NULL;
+
+    plan->stages = arena_alloc(arena, sizeof(Stage) * stage_count);
+    if (!plan->stages) return -1;
+    plan->stage_count = stage_count;
+    for (int i = 0; i < stage_count; i++) {
+        Stage* stage = &plan->stages[i];
+        stage->argc = shapes[i].argc;
+        stage->redirect_count = shapes[i].redirect_count;
+        if (stage->argc <= 0 || stage->redirect_count < 0) return -1;
+        stage->argv = arena_alloc(arena, sizeof(char*) * (stage->argc + 1));
+        stage->redirects = arena_alloc(arena, sizeof(Redirect) * (stage->redirect_count + 1));
+        if (!stage->argv || !stage->redirects) return -1;
+
+        char* program = next_string(&p, end);
+        if (!program) return -1;
+        stage->program = *program ? program : NULL;
+        for (int k = 0; k < stage->argc; k++) {
+            if (!(stage->argv[k] = next_string(&p, end))) return -1;
+        }
+        stage->argv[stage->argc] = NULL;
+        for (int k = 0; k < stage->redirect_count; k++) {
+            Redirect* redirect = &stage->redirects[k];
+            if ((size_t)(end - p) < sizeof(redirect->kind)) return -1;
+            memcpy(&redirect->kind, p, sizeof(redirect->kind));
+            p += sizeof(redirect->kind);
+            char* path = next_string(&p, end);
+            if (!path) return -1;
+            redirect->path = *path ? path : NULL;
+        }
+    }
+
+    int count = 0;
+    for (char* q = p; q < end; q += strlen(q) + 1) count++;
+    *envp = NULL;
+    if (count == 0) return 0;
+    *envp = arena_alloc(arena, sizeof(char*) * (count + 1));
+    if (!*envp) return -1;
+    for (int i = 0; i < count; i++, p += strlen(p) + 1) (*envp)[i] = p;
+    (*envp)[count] = NULL;
+    return 0;
+}
+
+// spawns one command, answers the server, and remembers the job
+static void handle_request(int sock, char* request, size_t len, Arena* arena, int devnull, Job** jobs) {
+    int outfd[2], errfd[2], statusfd[2];
+    if (pipe2(outfd, O_CLOEXEC) < 0) goto fail;
+    if (pipe2(errfd, O_CLOEXEC) < 0) goto fail_out;
+    if (pipe2(statusfd, O_CLOEXEC) < 0) goto fail_err;
+    enlarge_pipe(outfd[1]);
+
+    Plan plan = { 0 };
+    Job* job = NULL;
+    SpawnReply reply = { 0 };
+    const char* cwd;
+    char** envp;
+    arena_reset(arena);
+    if (parse_request(request, len, &plan, &cwd, &envp, arena) == 0 &&
+        (job = malloc(sizeof(Job) + sizeof(pid_t) * plan.stage_count)) != NULL) {
+        reply.group = spawnPlan(&plan, cwd, envp, devnull, outfd[1], errfd[1], job->pids, &reply.failures);
+    }
+    close(outfd[1]);
+    close(errfd[1]);
+
+    if (send_reply(sock, &reply, outfd[0], errfd[0], statusfd[0]) < 0) {
+        perror("[SPAWNER] sendmsg failed");
+    }
+    close(outfd[0]);
+    close(errfd[0]);
+    close(statusfd[0]);
+
+    if (reply.group == 0) {
+        PipelineResult failed = { .status = 1 << 8 };
+        write_full(statusfd[1], &failed, sizeof(failed));
+        close(statusfd[1]);
+        free(job);
+        return;
+    }
+    job->status_fd = statusfd[1];
+    job->result = (PipelineResult){ .status = 1 << 8 };
+    job->count = plan.stage_count;
+    job->live = 0;
+    for (int i = 0; i < job->count; i++) {
+        if (job->pids[i] > 0) job->live++;
+    }
+    job->next = *jobs;
+    *jobs = job;
+    return;
+
+fail_err:
+    close(errfd[0]);
+    close(errfd[1]);
+fail_out:
+    close(outfd[0]);
+    close(outfd[1]);
+fail:
+    perror("[SPAWNER] pipe failed");
+    send(sock, &(SpawnReply){ .group = -1 }, sizeof(SpawnReply), MSG_NOSIGNAL);   // no fds, the worker falls back
+}
+
+// reaps every exited child and reports jobs whose last stage is gone
+static void reap_children(Job** jobs) {
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        for (Job** link = jobs; *link; link = &(*link)->next) {
+            Job* job = *link;
+            int i = 0;
+            while (i < job->count && job->pids[i] != pid) i++;
+            if (i == job->count) continue;
+
+            if (i == job->count - 1) job->result.status = status;
+            pipeline_add_usage(&job->result, &usage);
+            if (--job->live == 0) {
+                *link = job->next;
+                finish_job(job);
+            }
+            break;
+        }
+    }
+}
+
+static void helper_main(int sock, pid_t server) {
+    // die with the server, and don't let a terminal ^C meant for it hit us first
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != server) _exit(0);       // it was already gone
+    signal(SIGINT, SIG_IGN);
+
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    int sigfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (sigfd < 0 || devnull < 0) {
+        perror("[SPAWNER] setup failed");
+        _exit(1);
+    }
+
+    static char request[REQUEST_MAX + 1];
+    static char arena_space[4096];
+    Arena arena;
+    arena_init(&arena, arena_space, sizeof(arena_space));
+    Job* jobs = NULL;
+
+    while (1) {
+        struct pollfd pfds[2] = { { .fd = sock, .events = POLLIN }, { .fd = sigfd, .events = POLLIN } };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            _exit(1);
+        }
+        if (pfds[1].revents) {
+            struct signalfd_siginfo info;
+            while (read(sigfd, &info, sizeof(info)) > 0) {
+            }
+            reap_children(&jobs);
+        }
+        if (pfds[0].revents) {
+            ssize_t n = recv(sock, request, sizeof(request) - 1, 0);
+            if (n <= 0) break;               // the server is gone
+            request[n] = '\0';
+            handle_request(sock, request, n, &arena, devnull, &jobs);
+        }
+    }
+
+    for (Job* job = jobs; job; job = job->next) {
+        for (int i = 0; i < job->count; i++) {
+            if (job->pids[i] > 0) kill(job->pids[i], SIGKILL);
+        }
+    }
+    _exit(0);
+}
+
+// ---------------------------------------------------------------- server side
+
+void spawner_init(int count) {
+    if (count <= 0) return;
+    helpers = calloc(count, sizeof(Helper));
+    if (!helpers) {
+        perror("[ERROR] Out of memory");
+        exit(1);
+    }
+
+    fflush(stdout);                          // or the helpers would print it again
+    pid_t server = getpid();
+    for (int i = 0; i < count; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+            perror("[ERROR] socketpair failed");
+            exit(1);
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("[ERROR] fork failed");
+            exit(1);
+        }
+        if (pid == 0) {
+            for (int k = 0; k < i; k++) close(helpers[k].sock);
+            close(pair[0]);
+            helper_main(pair[1], server);
+        }
+        close(pair[1]);
+        helpers[i].sock = pair[0];
+        pthread_mutex_init(&helpers[i].lock, NULL);
+    }
+    helper_count = count;
+}
+
+int spawner_enabled(void) {
+    return helper_count > 0;
+}
+
+// adds one part to a request, -1 if there are too many
+static int add_part(struct iovec* parts, int* count, const void* data, size_t len) {
+    if (*count == REQUEST_MAX_PARTS) return -1;
+    parts[(*count)++] = (struct iovec){ .iov_base = (void*)data, .iov_len = len };
+    return 0;
+}
+
+// a string of the request, NULL sent as ""
+static int add_string(struct iovec* parts, int* count, const char* string) {
+    return add_part(parts, count, string ? string : "", string ? strlen(string) + 1 : 1);
+}
+
+int spawner_launch(const Plan* plan, const char* cwd, char* const envp[], SpawnedJob* job) {
+    if (helper_count == 0 || plan->stage_count > REQUEST_MAX_STAGES) return -1;
+
+    // the request goes out straight from the plan's strings, gathered by sendmsg
+    struct iovec parts[REQUEST_MAX_PARTS];
+    int part_count = 0;
+    size_t total = 0;
+    RequestShape shapes[REQUEST_MAX_STAGES];
+    for (int i = 0; i < plan->stage_count; i++) {
+        shapes[i] = (RequestShape){ plan->stages[i].argc, plan->stages[i].redirect_count };
+    }
+    add_part(parts, &part_count, &plan->stage_count, sizeof(plan->stage_count));
+    add_part(parts, &part_count, shapes, sizeof(RequestShape) * plan->stage_count);
+    add_string(parts, &part_count, cwd);
+    for (int i = 0; i < plan->stage_count; i++) {
+        const Stage* stage = &plan->stages[i];
+        if (add_string(parts, &part_count, stage->program) < 0) return -1;
+        for (int k = 0; k < stage->argc; k++) {
+            if (add_string(parts, &part_count, stage->argv[k]) < 0) return -1;
+        }
+        for (int k = 0; k < stage->redirect_count; k++) {
+            const Redirect* redirect = &stage->redirects[k];
+            if (add_part(parts, &part_count, &redirect->kind, sizeof(redirect->kind)) < 0 ||
+                add_string(parts, &part_count, redirect->path) < 0) {
+                return -1;
+            }
+        }
+    }
+    for (int i = 0; envp && envp[i]; i++) {
+        if (add_string(parts, &part_count, envp[i]) < 0) return -1;
+    }
+    for (int i = 0; i < part_count; i++) total += parts[i].iov_len;
+    if (total > REQUEST_MAX) return -1;
+    struct msghdr request = { .msg_iov = parts, .msg_iovlen = part_count };
+
+    Helper* helper = &helpers[__atomic_fetch_add(&next_helper, 1, __ATOMIC_RELAXED) % helper_count];
+
+    SpawnReply reply = { .group = -1 };
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &reply, .iov_len = sizeof(reply) };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control, .msg_controllen = sizeof(control),
+    };
+
+    pthread_mutex_lock(&helper->lock);
+    ssize_t n = -1;
+    if (sendmsg(helper->sock, &request, MSG_NOSIGNAL) >= 0) {
+        do {
+            n = recvmsg(helper->sock, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+    }
+    pthread_mutex_unlock(&helper->lock);
+
+    struct cmsghdr* cmsg = n == sizeof(reply) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    job->group = reply.group;
+    job->failures = reply.failures;
+    job->out_fd = fds[0];
+    job->err_fd = fds[1];
+    job->status_fd = fds[2];
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "taskpool.h"
+
+#define TASKS_PER_SLAB 64
+
+// tasks are created on the event loop threads and freed on the workers, so one
+// shared list; the lock is held for a couple of pointer moves only
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static Task* free_tasks = NULL;    // linked through Task.next
+
+// carves a fresh slab into free tasks. the caller holds pool_lock
+static int grow_pool(void) {
+    Task* slab = malloc(sizeof(Task) * TASKS_PER_SLAB);
+    if (!slab) return -1;
+    for (int i = 0; i < TASKS_PER_SLAB; i++) {
+        arena_init(&slab[i].arena, slab[i].arena_space, sizeof(slab[i].arena_space));
+        slab[i].next = free_tasks;
+        free_tasks = &slab[i];
+    }
+    return 0;
+}
+
+Task* taskpool_get(void) {
+    pthread_mutex_lock(&pool_lock);
+    if (!free_tasks && grow_pool() < 0) {
+        pthread_mutex_unlock(&pool_lock);
+        return NULL;
+    }
+    Task* task = free_tasks;
+    free_tasks = task->next;
+    pthread_mutex_unlock(&pool_lock);
+    return task;
+}
+
+void taskpool_put(Task* task) {
+    arena_reset(&task->arena);     // outside the lock, it may free overflow blocks
+    pthread_mutex_lock(&pool_lock);
+    task->next = free_tasks;
+    free_tasks = task;
+    pthread_mutex_unlock(&pool_lock);
+}
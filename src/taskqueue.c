@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include "taskqueue.h"
+
+#define HEAP_INITIAL 64
+
+enum { CLASS_FRESH, CLASS_STOPPED, CLASS_DEMO };
+
+void runqueue_init(RunQueue* queue) {
+    memset(queue, 0, sizeof(*queue));
+    pthread_mutex_init(&queue->lock, NULL);
+}
+
+// shell tasks that already ran have a stopped process group waiting for them. the
+// class is picked from round_count, which only changes while the task is not queued
+static int task_class(const Task* task) {
+    if (!task->is_shell) return CLASS_DEMO;
+    return task->round_count == 0 ? CLASS_FRESH : CLASS_STOPPED;
+}
+
+static TaskList* shell_list(ClientFlow* flow, int cls) {
+    return cls == CLASS_FRESH ? &flow->fresh_shell : &flow->stopped_shell;
+}
+
+static int flow_has(const ClientFlow* flow, int cls) {
+    if (cls == CLASS_FRESH) return flow->fresh_shell.head != NULL;
+    if (cls == CLASS_STOPPED) return flow->stopped_shell.head != NULL;
+    return flow->demos.size > 0;
+}
+
+// heap order: least remaining time first, earlier enqueue first on ties (what the
+// old list scan did, since it only switched on a strictly smaller time)
+static int heap_before(const Task* a, const Task* b) {
+    if (a->remaining_time != b->remaining_time) return a->remaining_time < b->remaining_time;
+    return a->seq < b->seq;
+}
+
+static void heap_place(TaskHeap* heap, int index, Task* task) {
+    heap->items[index] = task;
+    task->heap_index = index;
+}
+
+static void sift_up(TaskHeap* heap, int index) {
+    Task* task = heap->items[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!heap_before(task, heap->items[parent])) break;
+        heap_place(heap, index, heap->items[parent]);
+        index = parent;
+    }
+    heap_place(heap, index, task);
+}
+
+static void sift_down(TaskHeap* heap, int index) {
+    Task* task = heap->items[index];
+    int size = heap->size;
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= size) break;
+        if (child + 1 < size && heap_before(heap->items[child + 1], heap->items[child])) child++;
+        if (!heap_before(heap->items[child], task)) break;
+        heap_place(heap, index, heap->items[child]);
+        index = child;
+    }
+    heap_place(heap, index, task);
+}
+
+static int heap_push(TaskHeap* heap, Task* task) {
+    if (heap->size == heap->cap) {
+        int cap = heap->cap ? heap->cap * 2 : HEAP_INITIAL;
+        Task** grown = realloc(heap->items, sizeof(Task*) * cap);
+        if (!grown) return -1;
+        heap->items = grown;
+        heap->cap = cap;
+    }
+    heap->items[heap->size++] = task;
+    sift_up(heap, heap->size - 1);
+    return 0;
+}
+
+static void heap_remove(TaskHeap* heap, Task* task) {
+    int index = task->heap_index;
+    Task* last = heap->items[--heap->size];
+    if (last != task) {
+        // move the last leaf into the hole and restore the order in whichever direction
+        heap_place(heap, index, last);
+        if (index > 0 && heap_before(last, heap->items[(index - 1) / 2])) {
+            sift_up(heap, index);
+        } else {
+            sift_down(heap, index);
+        }
+    }
+    task->heap_index = -1;
+}
+
+static void ring_append(RunQueue* queue, ClientFlow* flow, int cls) {
+    FlowRing* ring = &queue->rings[cls];
+    flow->ring_next[cls] = NULL;
+    flow->ring_prev[cls] = ring->tail;
+    if (ring->tail) ring->tail->ring_next[cls] = flow;
+    else ring->head = flow;
+    ring->tail = flow;
+    flow->in_ring[cls] = 1;
+}
+
+static void ring_unlink(RunQueue* queue, ClientFlow* flow, int cls) {
+    FlowRing* ring = &queue->rings[cls];
+    if (flow->ring_prev[cls]) flow->ring_prev[cls]->ring_next[cls] = flow->ring_next[cls];
+    else ring->head = flow->ring_next[cls];
+    if (flow->ring_next[cls]) flow->ring_next[cls]->ring_prev[cls] = flow->ring_prev[cls];
+    else ring->tail = flow->ring_prev[cls];
+    flow->in_ring[cls] = 0;
+}
+
+static ClientFlow* find_flow(RunQueue* queue, const Task* task) {
+    ClientFlow** bucket = &queue->flows[(unsigned)task->client_id % FLOW_BUCKETS];
+    for (ClientFlow* flow = *bucket; flow; flow = flow->hash_next) {
+        if (flow->client_id == task->client_id) return flow;
+    }
+
+    ClientFlow* flow = calloc(1, sizeof(ClientFlow));
+    if (!flow) return NULL;
+    flow->client_id = task->client_id;
+    flow->weight = task->conn && task->conn->weight > 0 ? task->conn->weight : 1;
+    flow->queue = queue;
+    flow->hash_next = *bucket;
+    *bucket = flow;
+    return flow;
+}
+
+// drops a flow that has no tasks left, debt and all
+static void flow_release(RunQueue* queue, ClientFlow* flow) {
+    if (--flow->refs > 0) return;
+    ClientFlow** link = &queue->flows[(unsigned)flow->client_id % FLOW_BUCKETS];
+    while (*link != flow) link = &(*link)->hash_next;
+    *link = flow->hash_next;
+    free(flow->demos.items);
+    free(flow);
+}
+
+int runqueue_push(RunQueue* queue, Task* task) {
+    ClientFlow* flow = find_flow(queue, task);
+    if (!flow) return -1;
+    int cls = task_class(task);
+    task->seq = queue->next_seq++;
+
+    if (cls == CLASS_DEMO) {
+        if (heap_push(&flow->demos, task) < 0) {
+            if (flow->refs == 0) {           // made just now for this task, drop it again
+                flow->refs = 1;
+                flow_release(queue, flow);
+            }
+            return -1;
+        }
+    } else {
+        TaskList* list = shell_list(flow, cls);
+        task->next = NULL;
+        task->prev = list->tail;
+        if (list->tail) {
+            list->tail->next = task;
+        } else {
+            list->head = task;
+        }
+        list->tail = task;
+        queue->shell_count++;
+        if (cls == CLASS_FRESH) queue->fresh_count++;
+    }
+    flow->refs++;
+    if (!flow->in_ring[cls]) ring_append(queue, flow, cls);
+
+    __atomic_store_n(&task->queue, queue, __ATOMIC_RELEASE);   // remove_tasks_by_client peeks at it
+    __atomic_store_n(&queue->length, queue->length + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// takes a queued task out of its flow; the flow's reference stays with the caller
+static ClientFlow* unlink_task(RunQueue* queue, Task* task) {
+    ClientFlow* flow = find_flow(queue, task);   // exists, the task holds a reference
+    int cls = task_class(task);
+    if (cls == CLASS_DEMO) {
+        heap_remove(&flow->demos, task);
+    } else {
+        TaskList* list = shell_list(flow, cls);
+        if (task->prev) task->prev->next = task->next; else list->head = task->next;
+        if (task->next) task->next->prev = task->prev; else list->tail = task->prev;
+        task->next = NULL;
+        task->prev = NULL;
+        queue->shell_count--;
+        if (cls == CLASS_FRESH) queue->fresh_count--;
+    }
+    if (!flow_has(flow, cls)) {
+        // an idle flow keeps its debt but no credit saved up while it had nothing to run
+        ring_unlink(queue, flow, cls);
+        if (flow->deficit[cls] > 0) flow->deficit[cls] = 0;
+    }
+
+    __atomic_store_n(&task->queue, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->length, queue->length - 1, __ATOMIC_RELAXED);
+    return flow;
+}
+
+void runqueue_remove(RunQueue* queue, Task* task) {
+    flow_release(queue, unlink_task(queue, task));
+}
+
+// the flow whose turn it is in a class: the head of the ring once it has a deficit to
+// spend. when no flow in the ring has one, all of them get as many quanta as it
+// takes for the first to have one again
+static ClientFlow* next_flow(RunQueue* queue, int cls) {
+    FlowRing* ring = &queue->rings[cls];
+    if (!ring->head) return NULL;
+    if (ring->head->deficit[cls] > 0) return ring->head;
+
+    // the head's turn is over: it goes to the back, the next flow with credit is up
+    ClientFlow* head = ring->head;
+    ring_unlink(queue, head, cls);
+    ring_append(queue, head, cls);
+    for (ClientFlow* flow = ring->head; flow; flow = flow->ring_next[cls]) {
+        if (flow->deficit[cls] > 0) {
+            while (ring->head != flow) {
+                ClientFlow* skipped = ring->head;
+                ring_unlink(queue, skipped, cls);
+                ring_append(queue, skipped, cls);
+            }
+            return flow;
+        }
+    }
+
+    // everyone is out: add rounds of quanta until someone is in credit
+    int64_t rounds = INT64_MAX;
+    for (ClientFlow* flow = ring->head; flow; flow = flow->ring_next[cls]) {
+        int64_t quantum = DRR_QUANTUM_NS * flow->weight;
+        int64_t needed = (-flow->deficit[cls]) / quantum + 1;
+        if (needed < rounds) rounds = needed;
+    }
+    ClientFlow* first = NULL;
+    for (ClientFlow* flow = ring->head; flow; flow = flow->ring_next[cls]) {
+        flow->deficit[cls] += rounds * DRR_QUANTUM_NS * flow->weight;
+        if (!first && flow->deficit[cls] > 0) first = flow;
+    }
+    while (ring->head != first) {
+        ClientFlow* skipped = ring->head;
+        ring_unlink(queue, skipped, cls);
+        ring_append(queue, skipped, cls);
+    }
+    return first;
+}
+
+Task* runqueue_pop(RunQueue* queue) {
+    for (int cls = 0; cls < RUN_CLASSES; cls++) {
+        ClientFlow* flow = next_flow(queue, cls);
+        if (!flow) continue;
+        Task* task = cls == CLASS_FRESH ? flow->fresh_shell.head :
+                     cls == CLASS_STOPPED ? flow->stopped_shell.head : flow->demos.items[0];
+        unlink_task(queue, task);
+        task->flow = flow;
+        task->run_class = cls;
+        return task;
+    }
+    return NULL;
+}
+
+void runqueue_charge(RunQueue* queue, Task* task, int64_t cost_ns) {
+    ClientFlow* flow = task->flow;
+    flow->deficit[task->run_class] -= cost_ns;
+    task->flow = NULL;
+    flow_release(queue, flow);
+}
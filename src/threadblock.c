@@ -0,0 +1,21 @@
+#include <stdlib.h>
+#include <time.h>
+#include "threadblock.h"
+
+void* thread_block_register(ThreadBlockList* list, size_t size, void (*init)(void* block)) {
+    ThreadBlock* block = calloc(1, size);
+    if (!block) return NULL;
+    pthread_mutex_lock(&list->lock);
+    block->id = ++list->count;
+    if (init) init(block);
+    block->next = list->first;
+    __atomic_store_n(&list->first, block, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&list->lock);
+    return block;
+}
+
+int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "trace.h"
+#include "protocol.h"
+#include "threadblock.h"
+
+// one task event, 32 bytes
+typedef struct TraceEvent {
+    int64_t ns;                 // CLOCK_MONOTONIC
+    int32_t task_id;
+    int32_t client_id;
+    int32_t round;
+    int32_t remaining;          // demo tasks: seconds left, shell tasks: -1
+    int32_t arg;                // see the event types in trace.h
+    int16_t type;
+    int16_t shell;
+} TraceEvent;
+
+typedef struct TraceRing {
+    ThreadBlock block;          // its id is the track, in the order threads first recorded
+    uint64_t head;              // events ever recorded; only the owner writes it
+    char name[32];
+    TraceEvent events[TRACE_EVENTS];
+} TraceRing;
+
+int trace_on;
+
+static const char* trace_path;
+static ThreadBlockList rings = THREAD_BLOCK_LIST;    // its lock also guards the names
+static __thread TraceRing* my_ring;
+static int dumping;                 // one dump at a time
+
+static const char* event_names[TRACE_EVENT_TYPES] = {
+    "enqueue", "select", "quantum", "quantum", "preempt", "park", "spawn", "first byte", "exit", "done",
+};
+
+void trace_init(const char* path) {
+    trace_path = path;
+    trace_on = 1;
+}
+
+static void name_ring(void* block) {
+    TraceRing* ring = block;
+    snprintf(ring->name, sizeof(ring->name), "thread-%d", ring->block.id);
+}
+
+static TraceRing* trace_ring(void) {
+    return my_ring ? my_ring : (my_ring = thread_block_register(&rings, sizeof(TraceRing), name_ring));
+}
+
+void trace_name_thread(const char* kind, int id) {
+    if (!trace_on) return;
+    TraceRing* ring = trace_ring();
+    if (!ring) return;
+    pthread_mutex_lock(&rings.lock);             // a dump may be reading the name
+    snprintf(ring->name, sizeof(ring->name), "%s-%d", kind, id);
+    pthread_mutex_unlock(&rings.lock);
+}
+
+void trace_record(int type, int64_t ns, int task_id, int client_id, int round, int remaining,
+                  int shell, int arg) {
+    TraceRing* ring = trace_ring();
+    if (!ring) return;
+    uint64_t head = ring->head;
+    TraceEvent* event = &ring->events[head & (TRACE_EVENTS - 1)];
+    event->ns = ns ? ns : monotonic_ns();
+    event->task_id = task_id;
+    event->client_id = client_id;
+    event->round = round;
+    event->remaining = remaining;
+    event->arg = arg;
+    event->type = type;
+    event->shell = shell;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);   // the oldest event is overwritten
+}
+
+static void write_event(FILE* f, const TraceRing* ring, const TraceEvent* e) {
+    double ts = e->ns / 1e3;                    // Chrome traces count in microseconds
+    const char* name = event_names[e->type];
+    const char* phase = e->type == TRACE_QUANTUM_START ? "B" : e->type == TRACE_QUANTUM_END ? "E" : "i";
+    fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+               "\"args\":{\"task\":%d,\"client\":%d,\"round\":%d,\"remaining\":%d,\"arg\":%d}}",
+            name, e->shell ? "shell" : "demo", phase, *phase == 'i' ? "\"s\":\"t\"," : "", ts, ring->block.id,
+            e->task_id, e->client_id, e->round, e->remaining, e->arg);
+
+    // each task also gets a span of its own, from when it was first queued to its DONE
+    if ((e->type == TRACE_ENQUEUE && e->round == 0) || e->type == TRACE_DONE) {
+        fprintf(f, ",\n{\"name\":\"Task %d (Client #%d)\",\"cat\":\"%s\",\"ph\":\"%s\",\"id\":%d,\"ts\":%.3f,"
+                   "\"pid\":1,\"tid\":%d}",
+                e->task_id, e->client_id, e->shell ? "shell" : "demo", e->type == TRACE_DONE ? "e" : "b",
+                e->task_id, ts, ring->block.id);
+    }
+}
+
+// copies out a ring's events while its thread keeps recording: events overwritten
+// during the copy are dropped, and so is event now - TRACE_EVENTS, whose slot the thread
+// may be filling with event now as we read it. returns how many are in out
+static long snapshot(const TraceRing* ring, TraceEvent* out) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+    for (uint64_t i = start; i < head; i++) out[i - start] = ring->events[i & (TRACE_EVENTS - 1)];
+    uint64_t now = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t safe = now >= TRACE_EVENTS ? now + 1 - TRACE_EVENTS : 0;
+    if (safe <= start) return head - start;
+    if (safe >= head) return 0;
+    memmove(out, out + (safe - start), sizeof(TraceEvent) * (head - safe));
+    return head - safe;
+}
+
+// writes every ring to the trace file. returns the events written, -1 with errno set
+static long write_trace(void) {
+    TraceEvent* events = malloc(sizeof(TraceEvent) * TRACE_EVENTS);
+    FILE* f = events ? fopen(trace_path, "w") : NULL;
+    if (!f) {
+        int saved = errno;
+        free(events);
+        errno = saved;
+        return -1;
+    }
+
+    long written = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"server\"}}");
+    for (TraceRing* ring = thread_blocks(&rings); ring; ring = (TraceRing*)ring->block.next) {
+        pthread_mutex_lock(&rings.lock);
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                ring->block.id, ring->name);
+        fprintf(f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"sort_index\":%d}}", ring->block.id, ring->block.id);
+        pthread_mutex_unlock(&rings.lock);
+
+        long count = snapshot(ring, events);
+        // a quantum cut in two by the ring wrapping would leave an unmatched end
+        long first = 0;
+        while (first < count && events[first].type == TRACE_QUANTUM_END) first++;
+        for (long i = first; i < count; i++) write_event(f, ring, &events[i]);
+        written += count - first;
+    }
+    fprintf(f, "\n]}\n");
+    free(events);
+    if (fclose(f) != 0) return -1;
+    return written;
+}
+
+typedef struct DumpRequest {
+    Connection* conn;
+    uint32_t tag;
+} DumpRequest;
+
+static void reply(Connection* conn, uint32_t tag, uint8_t type, const char* text, int code) {
+    uint32_t be = htonl(code);
+    conn_send_frame(conn, type, 0, tag, text, strlen(text));
+    conn_send_frame(conn, FRAME_EXIT, 0, tag, &be, sizeof(be));
+    conn_send_frame(conn, FRAME_DONE, 0, tag, NULL, 0);
+}
+
+static void* dump_thread(void* arg) {
+    DumpRequest* request = arg;
+    char line[512];
+    long written = write_trace();
+    if (written < 0) {
+        snprintf(line, sizeof(line), "server-trace: %s: %s\n", trace_path, strerror(errno));
+        reply(request->conn, request->tag, FRAME_STDERR, line, 1);
+    } else {
+        snprintf(line, sizeof(line), "%ld events written to %s\n", written, trace_path);
+        reply(request->conn, request->tag, FRAME_STDOUT, line, 0);
+    }
+    __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+    conn_unref(request->conn);
+    free(request);
+    return NULL;
+}
+
+void trace_dump(Connection* conn, uint32_t tag) {
+    if (!trace_on) {
+        reply(conn, tag, FRAME_STDERR, "server-trace: tracing is off, start the server with -t file\n", 1);
+        return;
+    }
+    if (__atomic_exchange_n(&dumping, 1, __ATOMIC_ACQUIRE)) {
+        reply(conn, tag, FRAME_STDERR, "server-trace: a dump is already being written\n", 1);
+        return;
+    }
+
+    // writing a few MB of JSON is not for the event loop
+    DumpRequest* request = malloc(sizeof(DumpRequest));
+    pthread_t tid;
+    if (request) {
+        request->conn = conn;
+        request->tag = tag;
+        conn_ref(conn);
+        if (pthread_create(&tid, NULL, dump_thread, request) == 0) {
+            pthread_detach(tid);
+            return;
+        }
+        conn_unref(conn);
+        free(request);
+    }
+    __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+    reply(conn, tag, FRAME_STDERR, "server-trace: out of resources\n", 1);
+}